@@ -1,6 +1,8 @@
 // Date   : October 21, 2020
 // Author : Eric Park
 
+#define _GNU_SOURCE // accept4()
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -9,32 +11,208 @@
 #include <errno.h>
 #include <time.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-typedef struct ClientListNode
-{
-    struct ClientListNode *next;
-    char *name;
-    int sockfd;
-} ClientListNode;
+#define BACKLOG_SIZE 10
+#define SERVING_SIZE 20
+#define MAX_EVENTS 1024
+#define TYPE_FIELD_SIZE 2
+#define TYPE_FIELD_START_INDEX 0
+#define SOURCE_FIELD_SIZE 20
+#define SOURCE_FIELD_START_INDEX 2
+#define DESTINATION_FIELD_SIZE 20
+#define DESTINATION_FIELD_START_INDEX 22
+#define LENGTH_FIELD_SIZE 4
+#define LENGTH_FIELD_START_INDEX  42
+#define MESSAGE_ID_FIELD_SIZE 4
+#define MESSAGE_ID_FIELD_START_INDEX 46
+#define DATA_START_INDEX 50
+#define MAX_MESSAGE_SIZE 450
+#define MAX_DATA_SIZE 400
+#define HEADER_SIZE 50
+#define RING_SIZE 1024 // A power of two, room for two whole messages
+#define SIG_STOP_SERVING -1
+#define SIG_OK 1
+#define SIG_READ_MORE 2
+#define SIG_CLIENT_ALREADY_PRESENT -1
+#define SIG_CLIENT_NOT_PRESENT -2
+#define SIG_MESSAGE_DROPPED -3
+#define SERVER_NAME "Server"
+#define PARTIAL_MESSAGE_MAX_AGE 60
+#define REGISTRY_MIN_CAPACITY 64
+#define PRINT_LIST_MAX 20
+#define DEFAULT_HIGH_WATER 65536 // Bytes queued for a client before it is slow
+#define DEFAULT_LOW_WATER 16384  // Bytes queued when it has caught up again
+#define CHANNEL_BUCKETS 256 // A power of two
+#define MAX_SHARDS 64
+#define FORWARD_RING_SIZE 1024 // A power of two
 
 typedef struct
 {
-    ClientListNode *head;
+    char name[SOURCE_FIELD_SIZE + 1];
+    unsigned hash;
+    int sockfd; // -1 for an empty slot
+    int shard;  // Shard serving the client
+} ClientSlot;
+
+// The client registry. Names are kept in an open addressing hash table with
+// linear probing, and fdSlots maps each socket to its client's slot, so both
+// lookups and deregistration take constant time however many are online.
+// There is one registry for all shards, so a name is taken or free for every
+// shard at once; lookups share the lock and changes hold it alone.
+typedef struct
+{
+    ClientSlot *slots;
+    size_t capacity; // A power of two, kept at least twice size
     size_t size;
+    int *fdSlots;    // Mapping from socket descriptors to slots, -1 for
+    int maxFds;      //   sockets that haven't registered
+    pthread_rwlock_t lock;
 } ClientList;
 
+// Bytes received from a client, in a ring buffer of RING_SIZE bytes. The
+// client may send several messages back to back, or a message in pieces, so
+// the buffer holds complete messages still to be dispatched followed by at
+// most one partial one.
 typedef struct
 {
-    void *buffer;
-    ssize_t size;
+    char *buffer;
+    size_t head; // Offset of the first byte not yet dispatched
+    size_t size;
     time_t last_retrieved;
 } Message;
 
+// What to do about a client whose outbound queue is over the high-water mark
+enum SlowClientPolicy
+{
+    POLICY_DROP,       // Drop new messages for it until it catches up
+    POLICY_DISCONNECT, // Close its connection
+    POLICY_PAUSE       // Stop reading from whoever sends to it until it
+                       //   drains to the low-water mark
+};
+
+typedef struct
+{
+    unsigned port;
+    enum SlowClientPolicy slowPolicy;
+    size_t highWater, lowWater;
+    int threads;
+} Config;
+
+// An encoded message. It is made once however many clients it goes to, and
+// each queue it waits in holds a reference; the last one to let go frees it.
+// The count is atomic, as the queues may belong to different shards.
+typedef struct
+{
+    atomic_int refs;
+    size_t size;
+    char data[];
+} SharedBuffer;
+
+// A message waiting to be written to a client
+typedef struct OutboundMessage
+{
+    struct OutboundMessage *next;
+    SharedBuffer *buffer;
+    size_t sent;
+} OutboundMessage;
+
+// A group room, created when its first member joins and freed when its last
+// one leaves. Channels are chained in Server.channels by name hash.
+typedef struct Channel
+{
+    struct Channel *next;
+    char name[DESTINATION_FIELD_SIZE + 1];
+    unsigned hash;
+    int *members;             // Sockets of the members
+    int numMembers, maxMembers;
+} Channel;
+
+// A connected client. Messages to it are written straight away while its
+// socket keeps up, and are queued, then written as the socket becomes
+// writable, when it doesn't.
+typedef struct
+{
+    Message message;          // Received bytes not yet dispatched
+    bool eof;                 // The client has stopped sending
+    OutboundMessage *head, *tail;
+    size_t queued;            // Bytes in the queue, not yet written
+    bool congested;           // Went over the high-water mark, and hasn't
+                              //   drained to the low-water mark since
+    int pausedOn;             // Socket whose queue this client is paused on,
+                              //   -1 when it is read as usual
+    int *pausedSenders;       // Clients paused on this one's queue
+    int numPaused, maxPaused;
+    Channel **joined;         // Channels the client is a member of
+    int numJoined, maxJoined;
+} Connection;
+
+// A lock-free queue of messages from one shard to another. Only the one
+// shard pushes and only the other pops, so each side just publishes its own
+// index and reads the other's.
+typedef struct
+{
+    _Alignas(64) atomic_size_t head; // Next slot to pop
+    _Alignas(64) atomic_size_t tail; // Next slot to push
+    SharedBuffer *slots[FORWARD_RING_SIZE];
+} ForwardRing;
+
+// Messages for another shard waiting for room in the ring to it, in order
+typedef struct
+{
+    SharedBuffer **items;
+    size_t head, size, max;
+} Backlog;
+
+struct Server;
+
+// What the shards share: the client registry, and a ring from every shard to
+// every other one
+typedef struct
+{
+    Config *config;
+    ClientList *clientList;
+    int numShards;
+    struct Server **servers;
+    ForwardRing *rings;       // rings[from * numShards + to]
+} Shards;
+
+// The event loop's state, one per shard. Sockets are watched edge-triggered,
+// so each wakeup costs in proportion to the sockets that are ready, not to the
+// descriptor range, and there is no FD_SETSIZE cap on how many clients may
+// connect. Each shard accepts on its own listener of one SO_REUSEPORT group
+// and owns the clients it accepts, and no other shard touches them.
+typedef struct Server
+{
+    Config *config;
+    Shards *shards;
+    int shard;                // Index of this shard
+    pthread_t thread;
+    int sockfd;               // Listening socket
+    int epollfd;
+    int eventfd;              // Written by other shards to wake this one
+    atomic_bool stopped;      // Done serving, so forwards to it are dropped
+    Backlog *backlogs;        // Per shard, forwards waiting for ring room
+    bool *wake;               // Shards forwarded to in this round
+    Connection **connections; // Mapping from socket descriptors to clients,
+    int maxFds;               //   NULL for descriptors that aren't clients
+    ClientList *clientList;
+    int *resumed;             // Clients to serve again once the events at
+    int numResumed, maxResumed; // hand are handled
+    Channel **channels;       // CHANNEL_BUCKETS chains of channels
+} Server;
+
 enum MessageType
 {
     HELLO = 1,
@@ -44,81 +222,254 @@ enum MessageType
     CHAT,
     EXIT,
     CLIENT_ALREADY_PRESENT_ERROR,
-    CANNOT_DELIVER_ERROR
+    CANNOT_DELIVER_ERROR,
+    JOIN,
+    LEAVE,
+    PUBLISH
 };
 
-unsigned getPortNumber(int argc, char **argv);
-void serveClients(int sockfd);
-void handleConnectionRequest(int sockfd, fd_set *active_fd_set);
-int readFromClient(int sockfd, Message **messages);
-void handleMessages(Message **messages, ClientList *clientList, 
-                    fd_set *read_fd_set, fd_set *active_fd_set);
+void parseArguments(int argc, char **argv, Config *config);
+void raiseFileLimit();
+int openListener(unsigned port);
+Server *createServer(Shards *shards, int shard, int sockfd);
+void freeServer(Server *server);
+void *serveClients(void *arg);
+void handleConnectionRequest(Server *server);
+void serveClient(Server *server, int sockfd);
+void closeClient(Server *server, int sockfd);
+int queueMessage(Server *server, int sockfd, SharedBuffer *buffer, int sender);
+int deliverMessage(Server *server, char *name, SharedBuffer *buffer,
+                   int sender);
+void forwardMessage(Server *server, int shard, SharedBuffer *buffer);
+bool pushForward(ForwardRing *ring, SharedBuffer *buffer);
+SharedBuffer *popForward(ForwardRing *ring);
+bool flushForwards(Server *server);
+void receiveForwards(Server *server);
+void handleForward(Server *server, SharedBuffer *buffer);
+int flushQueue(Server *server, int sockfd);
+void pauseClient(Server *server, int sockfd, int dest_sockfd);
+void resumeClients(Server *server, int sockfd);
+int readFromClient(int sockfd, Message *message);
+void copyFromMessage(Message *message, size_t offset, void *dest,
+                     size_t size);
+int handleMessages(Server *server, int sockfd);
 bool isMessagePartial(Message *message);
 int dispatchMessage(unsigned short type, char *source, char *destination,
                     unsigned int length, unsigned int msg_id, void *data,
-                    ClientList *clientList, int sockfd);
+                    Server *server, int sockfd);
 size_t makeClientListBuffer(void *buffer, ClientList *clientList);
-void *makeMessageBuffer(unsigned short type, char *source, char *destination,
-                       unsigned int length, unsigned int msg_id, void *data);
+SharedBuffer *makeMessageBuffer(unsigned short type, char *source,
+                               char *destination, unsigned int length,
+                               unsigned int msg_id, void *data);
+void releaseBuffer(SharedBuffer *buffer);
 void printMessage(unsigned short type, char *source, char *destination,
                   unsigned int length, unsigned int msg_id, void *data);
-int registerClient(ClientList *clientList, char *name, int sockfd);
+ClientList *createClientList();
+unsigned hashClientName(char *name);
+size_t findClientSlot(ClientList *clientList, char *name, unsigned hash);
+void growClientList(ClientList *clientList);
+int registerClient(ClientList *clientList, char *name, int sockfd, int shard);
 void deregisterClient(ClientList *clientList, int sockfd);
 void freeClientList(ClientList *clientList);
 void printClientList(ClientList *clientList);
-int clientNameToSockFd(ClientList *clientList, char *clientName);
-void organizeMessageBuffers(Message **messages, fd_set *read_fd_set);
-
-#define BACKLOG_SIZE 10
-#define SERVING_SIZE 20
-#define TYPE_FIELD_SIZE 2
-#define TYPE_FIELD_START_INDEX 0
-#define SOURCE_FIELD_SIZE 20
-#define SOURCE_FIELD_START_INDEX 2
-#define DESTINATION_FIELD_SIZE 20
-#define DESTINATION_FIELD_START_INDEX 22
-#define LENGTH_FIELD_SIZE 4
-#define LENGTH_FIELD_START_INDEX  42
-#define MESSAGE_ID_FIELD_SIZE 4
-#define MESSAGE_ID_FIELD_START_INDEX 46
-#define DATA_START_INDEX 50
-#define MAX_MESSAGE_SIZE 450
-#define MAX_DATA_SIZE 400
-#define HEADER_SIZE 50
-#define SIG_STOP_SERVING -1
-#define SIG_OK 1
-#define SIG_CLIENT_ALREADY_PRESENT -1
-#define SIG_CLIENT_NOT_PRESENT -2
-#define SERVER_NAME "Server"
-#define PARTIAL_MESSAGE_MAX_AGE 60
+int clientNameToSockFd(ClientList *clientList, char *clientName, int *shard);
+void organizeMessageBuffers(Server *server, int *ready_fds, int num_ready);
+Channel *findChannel(Server *server, char *name);
+void joinChannel(Server *server, char *name, int sockfd);
+void leaveChannel(Server *server, Channel *channel, int sockfd);
+int publishToChannel(Server *server, Channel *channel, SharedBuffer *buffer,
+                     int sockfd);
 
 int
 main(int argc, char **argv)
 {
-    int sockfd;
-    unsigned portNum;
-    struct sockaddr_in addr;
+    Config config;
+    Shards shards;
+    SharedBuffer *buffer;
+    int i;
 
     // Handle input and get portnumber
-    portNum = getPortNumber(argc, argv);
+    parseArguments(argc, argv, &config);
+
+    // Allow as many client sockets as the system lets us have
+    raiseFileLimit();
+
+    // Share the registry, and a ring from each shard to each other one
+    shards.config = &config;
+    shards.clientList = createClientList();
+    shards.numShards = config.threads;
+    shards.servers = malloc(config.threads * sizeof(Server *));
+    shards.rings = aligned_alloc(_Alignof(ForwardRing), config.threads *
+                                 config.threads * sizeof(ForwardRing));
+    for (i = 0; i < config.threads * config.threads; i++)
+    {
+        atomic_init(&shards.rings[i].head, 0);
+        atomic_init(&shards.rings[i].tail, 0);
+    }
+
+    // Give each shard a listener of its own
+    for (i = 0; i < config.threads; i++)
+        shards.servers[i] = createServer(&shards, i,
+                                         openListener(config.port));
+    printf("[chatserver] Listening...\n");
+
+    // Serve clients, a thread per shard
+    for (i = 0; i < config.threads; i++)
+    {
+        if (pthread_create(&shards.servers[i]->thread, NULL, serveClients,
+                           shards.servers[i]) != 0)
+        {
+            fprintf(stderr, "[chatserver] Failed to start shard %d\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < config.threads; i++)
+        pthread_join(shards.servers[i]->thread, NULL);
+
+    // Let go of what was forwarded to shards that had stopped
+    for (i = 0; i < config.threads * config.threads; i++)
+    {
+        while ((buffer = popForward(&shards.rings[i])))
+            releaseBuffer(buffer);
+    }
+    for (i = 0; i < config.threads; i++)
+        freeServer(shards.servers[i]);
+    free(shards.servers);
+    free(shards.rings);
+    freeClientList(shards.clientList);
+
+    return 0;
+}
+
+// Function  : parseArguments
+// Arguments : int of argc, char ** of argv, and Config * to fill in
+// Does      : 1) applies the defaults
+//             2) reads the options
+//             3) checks for the singular positional argument, port number
+// Returns   : nothing
+void
+parseArguments(int argc, char **argv, Config *config)
+{
+    char *rest;
+    int opt, usage = 0;
+    static struct option options[] =
+    {
+        { "slow-policy", required_argument, NULL, 'p' },
+        { "high-water", required_argument, NULL, 'H' },
+        { "low-water", required_argument, NULL, 'L' },
+        { "threads", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    config->slowPolicy = POLICY_PAUSE;
+    config->highWater = DEFAULT_HIGH_WATER;
+    config->lowWater = DEFAULT_LOW_WATER;
+    config->threads = 1;
+
+    while ((opt = getopt_long(argc, argv, "p:H:L:t:", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                if (strcmp(optarg, "drop") == 0)
+                    config->slowPolicy = POLICY_DROP;
+                else if (strcmp(optarg, "disconnect") == 0)
+                    config->slowPolicy = POLICY_DISCONNECT;
+                else if (strcmp(optarg, "pause") == 0)
+                    config->slowPolicy = POLICY_PAUSE;
+                else
+                    usage = 1;
+                break;
+            case 'H':
+                config->highWater = strtoul(optarg, &rest, 10);
+                break;
+            case 'L':
+                config->lowWater = strtoul(optarg, &rest, 10);
+                break;
+            case 't':
+                config->threads = (int)strtol(optarg, &rest, 10);
+                if (*rest || config->threads < 1 ||
+                    config->threads > MAX_SHARDS)
+                    usage = 1;
+                break;
+            default:
+                usage = 1;
+                break;
+        }
+    }
+
+    if (config->lowWater > config->highWater)
+    {
+        fprintf(stderr, "[chatserver] --low-water must not be above "
+                "--high-water\n");
+        usage = 1;
+    }
+
+    // Checks for the singular argument
+    if (usage || optind != argc - 1)
+    {
+        fprintf(stderr, "[chatserver] Usage: %s [options] <port number>\n",
+                argv[0]);
+        fprintf(stderr, "[chatserver]   -p, --slow-policy "
+                "<drop|disconnect|pause>\n");
+        fprintf(stderr, "[chatserver]   -H, --high-water <bytes>\n");
+        fprintf(stderr, "[chatserver]   -L, --low-water <bytes>\n");
+        fprintf(stderr, "[chatserver]   -t, --threads <1-%d>\n", MAX_SHARDS);
+        exit(EXIT_FAILURE);
+    }
+
+    // Gets port number
+    config->port = (unsigned)strtol(argv[optind], &rest, 10);
+}
+
+// Function  : raiseFileLimit
+// Arguments : nothing
+// Does      : raises the soft limit on open descriptors to the hard limit, as
+//             every client holds one
+// Returns   : nothing
+void
+raiseFileLimit()
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return;
+
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        fprintf(stderr, "[chatserver] Failed to raise the descriptor limit\n");
+}
+
+// Function  : openListener
+// Arguments : unsigned of port number
+// Does      : creates a non-blocking TCP socket, binds it to the port in the
+//             SO_REUSEPORT group of the shards' listeners, and listens
+// Returns   : int of socket file descriptor
+int
+openListener(unsigned port)
+{
+    int sockfd, on = 1;
+    struct sockaddr_in addr;
 
     // Create a TCP socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0)
     {
-        fprintf(stderr, "[chatserver] Failed to create socket in main()\n");
+        fprintf(stderr, "[chatserver] Failed to create socket in "
+                "openListener()\n");
         exit(EXIT_FAILURE);
     }
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
 
     // Bind socket to the port number
     bzero((char *) &addr, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(portNum);
+    addr.sin_port = htons(port);
     if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) 
     {
-        fprintf(stderr, "[chatserver] Failed to bind socket to port %d\n",
-                portNum);
+        fprintf(stderr, "[chatserver] Failed to bind socket to port %u\n",
+                port);
         exit(EXIT_FAILURE);
     }
 
@@ -129,327 +480,977 @@ main(int argc, char **argv)
         fprintf(stderr, "[chatserver] errno: %d\n", errno);
         exit(EXIT_FAILURE);
     }
-    printf("[chatserver] Listening...\n");
 
-    // Serve clients
-    serveClients(sockfd);
+    return sockfd;
+}
+
+// Function  : createServer
+// Arguments : Shards * of shared state, int of shard index, and int of its
+//             listening socket
+// Does      : allocates the shard's state, and watches its listener and the
+//             eventfd the other shards wake it with
+// Returns   : Server * of server
+Server *
+createServer(Shards *shards, int shard, int sockfd)
+{
+    Server *server;
+    struct epoll_event event;
+
+    // Allocate memory and initialize
+    server = calloc(1, sizeof(Server));
+    server->config = shards->config;
+    server->shards = shards;
+    server->shard = shard;
+    server->sockfd = sockfd;
+    server->clientList = shards->clientList;
+    server->channels = calloc(CHANNEL_BUCKETS, sizeof(Channel *));
+    server->backlogs = calloc(shards->numShards, sizeof(Backlog));
+    server->wake = calloc(shards->numShards, sizeof(bool));
+    atomic_init(&server->stopped, false);
+    server->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    server->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server->epollfd < 0 || server->eventfd < 0)
+    {
+        fprintf(stderr, "[chatserver] Failed to create shard %d\n", shard);
+        exit(EXIT_FAILURE);
+    }
+
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = sockfd;
+    epoll_ctl(server->epollfd, EPOLL_CTL_ADD, sockfd, &event);
+    event.data.fd = server->eventfd;
+    epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->eventfd, &event);
 
-    // Close socket
+    return server;
+}
+
+// Function  : freeServer
+// Arguments : Server * of a shard that has stopped serving
+// Does      : lets go of the forwards it still had waiting, and frees it
+// Returns   : nothing
+void
+freeServer(Server *server)
+{
+    Backlog *backlog;
+    int i;
+
+    for (i = 0; i < server->shards->numShards; i++)
+    {
+        backlog = &server->backlogs[i];
+        while (backlog->size > 0)
+        {
+            releaseBuffer(backlog->items[backlog->head++]);
+            backlog->size--;
+        }
+        free(backlog->items);
+    }
+
+    close(server->eventfd);
+    close(server->epollfd);
+    free(server->backlogs);
+    free(server->wake);
+    free(server->connections);
+    free(server->resumed);
+    free(server->channels); // Emptied as the last members closed
+    free(server);
+}
+
+// Function  : serveClients
+// Arguments : void * of the shard's Server
+// Does      : repetitively waits for ready sockets with epoll and serves
+//             incoming client requests. Each serving round writes out the
+//             queues of writable sockets, reads and dispatches the messages of
+//             readable ones, handles what other shards forwarded, serves the
+//             clients that were resumed, and then hands this round's forwards
+//             to their shards. While a ring to a shard is full, it waits for
+//             no more than a millisecond at a time, to retry.
+// Returns   : NULL
+void *
+serveClients(void *arg)
+{
+    Server *server = arg;
+    struct epoll_event *events;
+    Connection *conn;
+    int *ready_fds;
+    int num_events, num_ready;
+    int serving_round = 0;
+    bool backlogged = false;
+    int i, fd;
+
+    events = malloc(MAX_EVENTS * sizeof(struct epoll_event));
+    ready_fds = malloc(MAX_EVENTS * sizeof(int));
+
+    while (serving_round < SERVING_SIZE)
+    {
+        // Block until one or more sockets are ready
+        num_events = epoll_wait(server->epollfd, events, MAX_EVENTS,
+                                backlogged ? 1 : -1);
+        if (num_events < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[chatserver] epoll_wait() failed\n");
+            exit(EXIT_FAILURE);
+        }
+        if (num_events == 0)
+        {
+            backlogged = flushForwards(server);
+            continue;
+        }
+
+        printf("[chatserver]\n[chatserver] Serving round %d\n", serving_round);
+
+        // Service all the ready sockets
+        num_ready = 0;
+        for (i = 0; i < num_events; ++i)
+        {
+            fd = events[i].data.fd;
+            if (fd == server->sockfd) // Connection requests on original socket.
+            {
+                handleConnectionRequest(server);
+                continue;
+            }
+            if (fd == server->eventfd) // Messages from other shards
+            {
+                receiveForwards(server);
+                continue;
+            }
+
+            conn = server->connections[fd];
+            if (!conn) // Closed earlier in this round
+                continue;
+
+            if ((events[i].events & EPOLLOUT) &&
+                flushQueue(server, fd) == SIG_STOP_SERVING)
+            {
+                closeClient(server, fd);
+                continue;
+            }
+
+            // A paused client's input waits in its socket until it resumes
+            if ((events[i].events & ~EPOLLOUT) && conn->pausedOn < 0)
+                serveClient(server, fd);
+
+            if (server->connections[fd])
+                ready_fds[num_ready++] = fd;
+        }
+
+        // Clients whose destinations caught up
+        for (i = 0; i < server->numResumed; ++i)
+        {
+            fd = server->resumed[i];
+            if (server->connections[fd] &&
+                server->connections[fd]->pausedOn < 0)
+                serveClient(server, fd);
+        }
+        server->numResumed = 0;
+
+        printClientList(server->clientList);
+
+        organizeMessageBuffers(server, ready_fds, num_ready);
+
+        backlogged = flushForwards(server);
+
+        ++serving_round;
+    }
+
+    // Stop taking connections and forwards, and close any sockets that are
+    // still active
+    atomic_store(&server->stopped, true);
+    close(server->sockfd);
+    for (fd = 0; fd < server->maxFds; ++fd)
+    {
+        if (server->connections[fd])
+            closeClient(server, fd);
+    }
+
+    free(ready_fds);
+    free(events);
+
+    return NULL;
+}
+
+// Function  : handleConnectionRequest
+// Arguments : Server * of server
+// Does      : this function is called when there are connection requests on
+//             the server socket. It accepts them until none are left, as the
+//             socket is edge-triggered, watches each new non-blocking client
+//             socket for input and for room to write, and gives it a message
+//             buffer and an empty outbound queue.
+// Returns   : nothing
+void
+handleConnectionRequest(Server *server)
+{
+    struct sockaddr_in client_addr;
+    char host[INET_ADDRSTRLEN];
+    socklen_t client_addrlen;
+    struct epoll_event event;
+    Connection *conn;
+    int newsockfd, newMaxFds;
+
+    for (;;)
+    {
+        client_addrlen = sizeof(struct sockaddr_in);
+        newsockfd = accept4(server->sockfd, (struct sockaddr *)&client_addr,
+                            &client_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newsockfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fprintf(stderr, "[chatserver] accept() failed, errno: %d\n",
+                        errno);
+            return;
+        }
+
+        // Grow the mapping to cover the new descriptor
+        if (newsockfd >= server->maxFds)
+        {
+            newMaxFds = server->maxFds ? server->maxFds : 64;
+            while (newMaxFds <= newsockfd)
+                newMaxFds *= 2;
+            server->connections = realloc(server->connections,
+                                          newMaxFds * sizeof(Connection *));
+            memset(server->connections + server->maxFds, 0,
+                   (newMaxFds - server->maxFds) * sizeof(Connection *));
+            server->maxFds = newMaxFds;
+        }
+
+        conn = calloc(1, sizeof(Connection));
+        conn->message.buffer = malloc(RING_SIZE);
+        conn->message.last_retrieved = time(NULL);
+        conn->pausedOn = -1;
+        server->connections[newsockfd] = conn;
+
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = newsockfd;
+        if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, newsockfd, &event) < 0)
+        {
+            fprintf(stderr, "[chatserver] Failed to watch socket %d\n",
+                    newsockfd);
+            closeClient(server, newsockfd);
+            continue;
+        }
+
+        printf("[chatserver] Connected with host %s, port %d on socket %d, "
+               "shard %d\n", inet_ntop(AF_INET, &client_addr.sin_addr, host,
+                                        sizeof(host)),
+               ntohs(client_addr.sin_port), newsockfd, server->shard);
+    }
+}
+
+// Function  : serveClient
+// Arguments : Server * of server and int of client socket file descriptor
+// Does      : 1) dispatches messages left from before a pause
+//             2) reads and dispatches until the socket is drained, as it is
+//                edge-triggered, dispatching whenever the ring fills, unless
+//                the client gets paused
+//             3) closes the client once it has stopped sending and all it
+//                sent has been dispatched
+// Returns   : nothing
+void
+serveClient(Server *server, int sockfd)
+{
+    Connection *conn = server->connections[sockfd];
+    int status;
+
+    if (handleMessages(server, sockfd) == SIG_STOP_SERVING)
+        return;
+
+    while (!conn->eof && conn->pausedOn < 0)
+    {
+        status = readFromClient(sockfd, &conn->message);
+        if (status == SIG_STOP_SERVING)
+            conn->eof = true;
+        if (handleMessages(server, sockfd) == SIG_STOP_SERVING)
+            return;
+        if (status == SIG_OK)
+            break;
+    }
+
+    if (conn->eof && conn->pausedOn < 0)
+        closeClient(server, sockfd);
+}
+
+// Function  : closeClient
+// Arguments : Server * of server and int of client socket file descriptor
+// Does      : 1) writes what it can of the client's queue, such as a last
+//                error message
+//             2) resumes the clients paused on it, and takes it off the list
+//                of the client it is paused on
+//             3) takes it out of the channels it joined
+//             4) deregisters the client, closes the client socket, which also
+//                takes it out of epoll, and frees its buffers
+// Returns   : nothing
+void
+closeClient(Server *server, int sockfd)
+{
+    Connection *conn = server->connections[sockfd], *dest;
+    OutboundMessage *item;
+    int i;
+
+    flushQueue(server, sockfd);
+
+    if (conn->pausedOn >= 0 && conn->pausedOn != sockfd)
+    {
+        dest = server->connections[conn->pausedOn];
+        for (i = 0; i < dest->numPaused; i++)
+        {
+            if (dest->pausedSenders[i] == sockfd)
+            {
+                dest->pausedSenders[i] =
+                    dest->pausedSenders[--dest->numPaused];
+                break;
+            }
+        }
+    }
+    conn->pausedOn = -1;
+    resumeClients(server, sockfd);
+
+    while (conn->numJoined > 0)
+        leaveChannel(server, conn->joined[conn->numJoined - 1], sockfd);
+
+    // Deregister first, as another shard may be given the descriptor next
+    deregisterClient(server->clientList, sockfd);
     close(sockfd);
+    while (conn->head)
+    {
+        item = conn->head;
+        conn->head = item->next;
+        releaseBuffer(item->buffer);
+        free(item);
+    }
+    free(conn->message.buffer);
+    free(conn->pausedSenders);
+    free(conn->joined);
+    free(conn);
+    server->connections[sockfd] = NULL;
+    printf("[chatserver] Closed connection with socket %d\n", sockfd);
+}
 
-    return 0;
+// Function  : queueMessage
+// Arguments : Server * of server, int of destination socket, SharedBuffer *
+//             of a message, whose reference the queue takes over, and int of
+//             the socket of the client it is on behalf of, -1 for a message
+//             from another shard
+// Does      : 1) applies the slow client policy if the destination is
+//                congested: drops the message or gives up on the destination.
+//                A sender on another shard can't be paused, so under the
+//                pause policy its message is dropped instead.
+//             2) writes the message straight away when nothing is queued
+//                ahead of it, and queues whatever the socket won't take
+//             3) marks the destination congested over the high-water mark,
+//                and under the pause policy pauses the sender
+// Returns   : SIG_OK, SIG_MESSAGE_DROPPED, or SIG_STOP_SERVING when the
+//             destination must be closed
+int
+queueMessage(Server *server, int sockfd, SharedBuffer *buffer, int sender)
+{
+    Connection *conn = server->connections[sockfd];
+    Config *config = server->config;
+    OutboundMessage *item;
+    ssize_t sent = 0;
+
+    if (conn->congested && (config->slowPolicy == POLICY_DROP ||
+                            (config->slowPolicy == POLICY_PAUSE && sender < 0)))
+    {
+        printf("[chatserver] Dropped a message for slow socket %d\n", sockfd);
+        releaseBuffer(buffer);
+        return SIG_MESSAGE_DROPPED;
+    }
+
+    // Write straight away when nothing is waiting
+    if (!conn->head)
+    {
+        do
+            sent = send(sockfd, buffer->data, buffer->size, MSG_NOSIGNAL);
+        while (sent < 0 && errno == EINTR);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            fprintf(stderr, "[chatserver] Failed writing to socket %d\n",
+                    sockfd);
+            releaseBuffer(buffer);
+            return SIG_STOP_SERVING;
+        }
+        if (sent < 0)
+            sent = 0;
+        if ((size_t)sent == buffer->size)
+        {
+            releaseBuffer(buffer);
+            return SIG_OK;
+        }
+    }
+
+    item = malloc(sizeof(OutboundMessage));
+    item->next = NULL;
+    item->buffer = buffer;
+    item->sent = sent;
+    if (conn->tail)
+        conn->tail->next = item;
+    else
+        conn->head = item;
+    conn->tail = item;
+    conn->queued += buffer->size - sent;
+
+    if (!conn->congested && conn->queued > config->highWater)
+    {
+        printf("[chatserver] Socket %d is slow, %zu bytes queued\n", sockfd,
+               conn->queued);
+        conn->congested = true;
+    }
+
+    if (conn->congested && config->slowPolicy == POLICY_DISCONNECT)
+        return SIG_STOP_SERVING;
+    if (conn->congested && config->slowPolicy == POLICY_PAUSE && sender >= 0)
+        pauseClient(server, sender, sockfd);
+
+    return SIG_OK;
 }
 
-// Function  : getPortNumber
-// Arguments : int of argc and char ** of argv 
-// Does      : 1) checks for the singular argument, port number
-//             3) returns the port number
-// Returns   : unsigned int of port number
-unsigned
-getPortNumber(int argc, char **argv)
+// Function  : flushQueue
+// Arguments : Server * of server and int of client socket file descriptor
+// Does      : 1) writes queued messages until the queue is empty or the
+//                socket is full
+//             2) once the queue is at the low-water mark, the client is no
+//                longer congested and the clients paused on it resume
+// Returns   : SIG_STOP_SERVING if the socket failed, SIG_OK otherwise
+int
+flushQueue(Server *server, int sockfd)
 {
-    char *rest;
-    long portNum;
+    Connection *conn = server->connections[sockfd];
+    OutboundMessage *item;
+    ssize_t sent;
 
-    // Checks for the singular argument
-    if (argc != 2)
+    while ((item = conn->head))
     {
-        fprintf(stderr, "[httpproxy] Usage: %s <port number>\n", argv[0]);
-        exit(EXIT_FAILURE);
+        sent = send(sockfd, item->buffer->data + item->sent,
+                    item->buffer->size - item->sent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            fprintf(stderr, "[chatserver] Failed writing to socket %d\n",
+                    sockfd);
+            return SIG_STOP_SERVING;
+        }
+
+        item->sent += sent;
+        conn->queued -= sent;
+        if (item->sent < item->buffer->size)
+            continue;
+
+        conn->head = item->next;
+        if (!conn->head)
+            conn->tail = NULL;
+        releaseBuffer(item->buffer);
+        free(item);
     }
 
-    // Gets port number
-    portNum = strtol(argv[1], &rest, 10);
+    if (conn->congested && conn->queued <= server->config->lowWater)
+    {
+        printf("[chatserver] Socket %d caught up\n", sockfd);
+        conn->congested = false;
+        resumeClients(server, sockfd);
+    }
 
-    return (unsigned)portNum;
+    return SIG_OK;
 }
 
-// Function  : serveClients
-// Arguments : int of socket file descriptor
-// Does      : repetitively monitors a set of sockets and serves incoming client
-//             requests, by using select()
+// Function  : pauseClient
+// Arguments : Server * of server, int of the socket to stop reading, and int
+//             of the socket whose queue it waits on (possibly itself)
+// Does      : stops reading from the client until the destination's queue
+//             drains to the low-water mark
+// Returns   : nothing
+void
+pauseClient(Server *server, int sockfd, int dest_sockfd)
+{
+    Connection *conn = server->connections[sockfd];
+    Connection *dest = server->connections[dest_sockfd];
+
+    if (conn->pausedOn >= 0)
+        return;
+
+    if (dest->numPaused == dest->maxPaused)
+    {
+        dest->maxPaused = dest->maxPaused ? dest->maxPaused * 2 : 4;
+        dest->pausedSenders = realloc(dest->pausedSenders,
+                                      dest->maxPaused * sizeof(int));
+    }
+    dest->pausedSenders[dest->numPaused++] = sockfd;
+    conn->pausedOn = dest_sockfd;
+
+    printf("[chatserver] Paused socket %d until socket %d catches up\n",
+           sockfd, dest_sockfd);
+}
+
+// Function  : resumeClients
+// Arguments : Server * of server and int of client socket file descriptor
+// Does      : unpauses the clients paused on the client, and lists them to be
+//             served again once the events at hand are handled, as their
+//             input may be waiting in their rings and sockets
 // Returns   : nothing
 void
-serveClients(int sockfd)
+resumeClients(Server *server, int sockfd)
+{
+    Connection *dest = server->connections[sockfd];
+    int i, fd;
+
+    for (i = 0; i < dest->numPaused; i++)
+    {
+        fd = dest->pausedSenders[i];
+        server->connections[fd]->pausedOn = -1;
+        if (server->numResumed == server->maxResumed)
+        {
+            server->maxResumed = server->maxResumed ? server->maxResumed * 2 :
+                                                      16;
+            server->resumed = realloc(server->resumed,
+                                      server->maxResumed * sizeof(int));
+        }
+        server->resumed[server->numResumed++] = fd;
+        printf("[chatserver] Resumed socket %d\n", fd);
+    }
+    dest->numPaused = 0;
+}
+
+// Function  : deliverMessage
+// Arguments : Server * of server, char * of the destination client's name,
+//             SharedBuffer * of a message, whose reference it takes over, and
+//             int of the sender's socket, -1 for a message from another shard
+// Does      : 1) looks the client up in the registry
+//             2) forwards the message to the shard serving the client, or, if
+//                that is this one, queues it, closing the client if it fails
+//                or is given up on
+// Returns   : SIG_OK, SIG_MESSAGE_DROPPED if there is no such client or the
+//             slow client policy dropped the message, or SIG_STOP_SERVING
+//             when the sender is the destination and must be closed
+int
+deliverMessage(Server *server, char *name, SharedBuffer *buffer, int sender)
+{
+    int dest_sockfd, shard, status;
+
+    dest_sockfd = clientNameToSockFd(server->clientList, name, &shard);
+    if (dest_sockfd == SIG_CLIENT_NOT_PRESENT)
+    {
+        releaseBuffer(buffer);
+        return SIG_MESSAGE_DROPPED;
+    }
+    if (shard != server->shard)
+    {
+        forwardMessage(server, shard, buffer);
+        return SIG_OK;
+    }
+
+    status = queueMessage(server, dest_sockfd, buffer, sender);
+    if (status == SIG_OK)
+        printf("[chatserver] Sent message to socket %d\n", dest_sockfd);
+    else if (status == SIG_STOP_SERVING && dest_sockfd != sender)
+    {
+        closeClient(server, dest_sockfd);
+        status = SIG_OK;
+    }
+
+    return status;
+}
+
+// Function  : forwardMessage
+// Arguments : Server * of server, int of the shard to forward to, and
+//             SharedBuffer * of a message, whose reference it takes over
+// Does      : pushes the message onto the ring to the shard, or keeps it, in
+//             order, until the ring has room; the shard is woken at the end
+//             of the round. Messages for a shard that has stopped are dropped.
+// Returns   : nothing
+void
+forwardMessage(Server *server, int shard, SharedBuffer *buffer)
+{
+    Shards *shards = server->shards;
+    Backlog *backlog = &server->backlogs[shard];
+
+    if (atomic_load(&shards->servers[shard]->stopped))
+    {
+        releaseBuffer(buffer);
+        return;
+    }
+
+    server->wake[shard] = true;
+    if (backlog->size == 0 &&
+        pushForward(&shards->rings[server->shard * shards->numShards + shard],
+                    buffer))
+        return;
+
+    if (backlog->head + backlog->size == backlog->max)
+    {
+        if (backlog->size < backlog->max / 2)
+        {
+            memmove(backlog->items, backlog->items + backlog->head,
+                    backlog->size * sizeof(SharedBuffer *));
+            backlog->head = 0;
+        }
+        else
+        {
+            backlog->max = backlog->max ? backlog->max * 2 : 64;
+            backlog->items = realloc(backlog->items,
+                                     backlog->max * sizeof(SharedBuffer *));
+        }
+    }
+    backlog->items[backlog->head + backlog->size++] = buffer;
+}
+
+// Function  : pushForward
+// Arguments : ForwardRing * of a ring this shard produces to, and
+//             SharedBuffer * of a message
+// Does      : stores the message in the next slot, then publishes the slot
+//             by advancing the tail
+// Returns   : bool of whether there was room
+bool
+pushForward(ForwardRing *ring, SharedBuffer *buffer)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+        FORWARD_RING_SIZE)
+        return false;
+
+    ring->slots[tail & (FORWARD_RING_SIZE - 1)] = buffer;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+// Function  : popForward
+// Arguments : ForwardRing * of a ring this shard consumes from
+// Does      : takes the message in the first slot, then frees the slot by
+//             advancing the head
+// Returns   : SharedBuffer * of the message, or NULL if the ring is empty
+SharedBuffer *
+popForward(ForwardRing *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    SharedBuffer *buffer;
+
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+        return NULL;
+
+    buffer = ring->slots[head & (FORWARD_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    return buffer;
+}
+
+// Function  : flushForwards
+// Arguments : Server * of server
+// Does      : 1) moves waiting forwards onto their rings while there is room,
+//                dropping those for shards that have stopped
+//             2) wakes each shard forwarded to since the last flush, with one
+//                eventfd write however many messages it was sent
+// Returns   : bool of whether any forwards are still waiting for room
+bool
+flushForwards(Server *server)
 {
-    fd_set *active_fd_set, *read_fd_set;
-    Message **messages; // Mapping from socket descriptors to message buffers
-    ClientList *clientList;
-    int serving_round = 0;
+    Shards *shards = server->shards;
+    ForwardRing *ring;
+    Backlog *backlog;
+    uint64_t one = 1;
+    bool backlogged = false;
     int i;
 
-    // Allocate memory and initialize
-    clientList = malloc(sizeof(ClientList));
-    clientList->size = 0;
-    clientList->head = NULL;
-    active_fd_set = malloc(sizeof(fd_set));
-    read_fd_set = malloc(sizeof(fd_set));
-    FD_ZERO(read_fd_set);
-    FD_ZERO(active_fd_set);
-    FD_SET(sockfd, active_fd_set);
-    messages = malloc(FD_SETSIZE * sizeof(Message *));
-    for (i = 0; i < FD_SETSIZE; i++)
-    {
-        messages[i] = malloc(sizeof(Message));
-        messages[i]->buffer = malloc(MAX_MESSAGE_SIZE);
-        messages[i]->size = 0;
-        messages[i]->last_retrieved = time(NULL);
-    }
-
-    while (serving_round < SERVING_SIZE)
+    for (i = 0; i < shards->numShards; i++)
     {
-        // Block until input arrives on one or more active sockets
-        *read_fd_set = *active_fd_set;
-        if (select(FD_SETSIZE, read_fd_set, NULL, NULL, NULL) < 0)
+        backlog = &server->backlogs[i];
+        ring = &shards->rings[server->shard * shards->numShards + i];
+        while (backlog->size > 0 &&
+               pushForward(ring, backlog->items[backlog->head]))
         {
-            fprintf(stderr, "[chatserver] select() failed\n");
-            exit(EXIT_FAILURE);
+            backlog->head++;
+            backlog->size--;
+            server->wake[i] = true;
         }
-
-        printf("[chatserver]\n[chatserver] Serving round %d\n", serving_round);
-
-        // Service all the sockets with input pending.
-        for (i = 0; i < FD_SETSIZE; ++i)
+        if (backlog->size > 0 && atomic_load(&shards->servers[i]->stopped))
         {
-            if (FD_ISSET(i, read_fd_set))
+            while (backlog->size > 0)
             {
-                if (i == sockfd) // Connection request on original socket.
-                    handleConnectionRequest(sockfd, active_fd_set);
-                else // Data arriving on an already-connected socket.
-                {
-                    if (readFromClient(i, messages) == SIG_STOP_SERVING)
-                    {
-                        close(i);
-                        FD_CLR(i, active_fd_set);
-                        deregisterClient(clientList, i);
-                        printf("[chatserver] Closed connection with socket ");
-                        printf("%d\n", i);
-                    }
-                }
+                releaseBuffer(backlog->items[backlog->head++]);
+                backlog->size--;
             }
         }
+        if (backlog->size == 0)
+            backlog->head = 0;
+        else
+            backlogged = true;
 
-        handleMessages(messages, clientList, read_fd_set, active_fd_set);
+        if (server->wake[i])
+        {
+            server->wake[i] = false;
+            if (write(shards->servers[i]->eventfd, &one, sizeof(one)) < 0)
+                fprintf(stderr, "[chatserver] Failed to wake shard %d\n", i);
+        }
+    }
 
-        organizeMessageBuffers(messages, read_fd_set);
+    return backlogged;
+}
 
-        ++serving_round;
-    }
+// Function  : receiveForwards
+// Arguments : Server * of server
+// Does      : resets the eventfd, then handles every message on the rings
+//             from the other shards; anything pushed after the reset wakes
+//             the shard again
+// Returns   : nothing
+void
+receiveForwards(Server *server)
+{
+    Shards *shards = server->shards;
+    SharedBuffer *buffer;
+    uint64_t count;
+    int i;
 
-    // Close any sockets that are still active
-    for (i = 0; i < FD_SETSIZE; ++i)
-    {
-        free(messages[i]->buffer);
-        free(messages[i]);
+    if (read(server->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "[chatserver] Failed to read eventfd of shard %d\n",
+                server->shard);
 
-        if (FD_ISSET(i, active_fd_set) && i != sockfd)
-            close(i);
+    for (i = 0; i < shards->numShards; i++)
+    {
+        while ((buffer = popForward(&shards->rings[i * shards->numShards +
+                                                   server->shard])))
+            handleForward(server, buffer);
     }
-
-    freeClientList(clientList);
-    free(read_fd_set);
-    free(active_fd_set);
-    free(messages);
 }
 
-// Function  : handleConnectionRequest
-// Arguments : int of socket file descriptor of the server socket, fd_set * for
-//             a set of active file descriptors
-// Does      : this function is called when there is a connection request on
-//             the server socket. It handles the connection request, by adding
-//             the new client socket handle to the active_fd_set, if the
-//             connection request is accepted successfully. If the accept() was
-//             not successful, the function does nothing.
+// Function  : handleForward
+// Arguments : Server * of server and SharedBuffer * of a message from another
+//             shard, whose reference it takes over
+// Does      : 1) reads the type and names back from the message's header
+//             2) publishes a PUBLISH to this shard's members of the channel,
+//                and delivers anything else to its destination client, which
+//                may have moved to yet another shard
+//             3) sends CANNOT_DELIVER_ERROR to the source of a message that
+//                couldn't be delivered, wherever the source is
 // Returns   : nothing
 void
-handleConnectionRequest(int sockfd, fd_set *active_fd_set)
+handleForward(Server *server, SharedBuffer *buffer)
 {
-    struct sockaddr_in client_addr;
-    socklen_t *client_addrlen;
-    int newsockfd;
-
-    client_addrlen = malloc(sizeof(socklen_t));
-    *client_addrlen = sizeof(struct sockaddr_in);
+    unsigned short type;
+    char source[SOURCE_FIELD_SIZE + 1];
+    char destination[DESTINATION_FIELD_SIZE + 1];
+    unsigned int msg_id;
+    Channel *channel;
+    SharedBuffer *reply;
+    int status = SIG_OK;
+
+    memcpy(&type, buffer->data + TYPE_FIELD_START_INDEX, TYPE_FIELD_SIZE);
+    memcpy(source, buffer->data + SOURCE_FIELD_START_INDEX,
+           SOURCE_FIELD_SIZE);
+    memcpy(destination, buffer->data + DESTINATION_FIELD_START_INDEX,
+           DESTINATION_FIELD_SIZE);
+    memcpy(&msg_id, buffer->data + MESSAGE_ID_FIELD_START_INDEX,
+           MESSAGE_ID_FIELD_SIZE);
+    type = ntohs(type); // From network to host byte order
+    msg_id = ntohl(msg_id);
+    source[SOURCE_FIELD_SIZE] = 0;
+    destination[DESTINATION_FIELD_SIZE] = 0;
 
-    newsockfd = accept(sockfd, (struct sockaddr *)&client_addr, client_addrlen);
-    if (newsockfd >= 0)
+    if (type == PUBLISH)
     {
-        printf("[chatserver] Connected with host %s, port %d on socket %d\n",
-               inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port),
-               newsockfd);
-        FD_SET(newsockfd, active_fd_set);
+        channel = findChannel(server, destination);
+        if (channel)
+            status = publishToChannel(server, channel, buffer, -1);
+        else
+            releaseBuffer(buffer);
     }
+    else
+        status = deliverMessage(server, destination, buffer, -1);
 
-    free(client_addrlen);
+    if (status == SIG_MESSAGE_DROPPED && type != CANNOT_DELIVER_ERROR)
+    {
+        reply = makeMessageBuffer(CANNOT_DELIVER_ERROR, SERVER_NAME, source, 0,
+                                  msg_id, NULL);
+        deliverMessage(server, source, reply, -1);
+    }
 }
 
-
 // Function  : readFromClient
-// Arguments : int of socket file descriptor of the client socket, and an array
-//             mapping of socket file handles to message buffers
-// Does      : reads from the client socket, and stores the message in the 
-//             message buffers
-// Returns   : SIG_STOP_SERVING to signal stop serving, SIG_OK otherwise
+// Arguments : int of socket file descriptor of the client socket, and
+//             Message * of its message buffer
+// Does      : reads from the client socket straight into the free part of the
+//             ring buffer, until the socket would block (it is
+//             edge-triggered) or the buffer is full
+// Returns   : SIG_STOP_SERVING to signal stop serving, SIG_READ_MORE when the
+//             buffer filled up before the socket was drained, SIG_OK otherwise
 int
-readFromClient(int sockfd, Message **messages)
+readFromClient(int sockfd, Message *message)
 {
-    void *read_buffer;
+    struct iovec iov[2];
+    size_t tail;
     ssize_t read_size;
 
-    // Making the new socket non-blocking
-    if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0)|O_NONBLOCK)== -1)
+    while (message->size < RING_SIZE)
     {
-        fprintf(stderr, "[chatserver] fcntl() failed\n");
+        // The free part may wrap around the end of the buffer
+        tail = (message->head + message->size) & (RING_SIZE - 1);
+        iov[0].iov_base = message->buffer + tail;
+        iov[0].iov_len = tail >= message->head ? RING_SIZE - tail :
+                                                 RING_SIZE - message->size;
+        iov[1].iov_base = message->buffer;
+        iov[1].iov_len = RING_SIZE - message->size - iov[0].iov_len;
+
+        read_size = readv(sockfd, iov, iov[1].iov_len ? 2 : 1);
+        if (read_size > 0)
+        {
+            message->size += read_size;
+            message->last_retrieved = time(NULL);
+            printf("[chatserver] Read %zd bytes from socket %d\n", read_size,
+                   sockfd);
+        }
+        else if (read_size == 0)
+        {
+            printf("[chatserver] Client at socket %d disconnected\n", sockfd);
+            return SIG_STOP_SERVING;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return SIG_OK;
+        else if (errno != EINTR)
+        {
+            fprintf(stderr, "[chatserver] Failed reading from socket %d\n",
+                    sockfd);
+            return SIG_STOP_SERVING;
+        }
     }
 
-    read_buffer = malloc(MAX_MESSAGE_SIZE);
-
-    while ((read_size = read(sockfd, read_buffer,
-                             MAX_MESSAGE_SIZE - messages[sockfd]->size)) > 0)
-    {
-        memcpy(messages[sockfd]->buffer + messages[sockfd]->size, read_buffer,
-               read_size);
-        messages[sockfd]->size += read_size;
-        messages[sockfd]->last_retrieved = time(NULL);
-
-        printf("[chatserver] Read %zd bytes from socket %d\n", read_size,
-               sockfd);
-    }
+    return SIG_READ_MORE;
+}
 
-    free(read_buffer);
+// Function  : copyFromMessage
+// Arguments : Message * of message buffer, size_t of offset from its first
+//             byte, void * of destination, and size_t of byte count
+// Does      : copies bytes out of the ring buffer, in two pieces when they
+//             wrap around its end
+// Returns   : nothing
+void
+copyFromMessage(Message *message, size_t offset, void *dest, size_t size)
+{
+    size_t start, first;
 
-    if (read_size == 0)
-    {
-        printf("[chatserver] Client at socket %d disconnected\n", sockfd);
-        return SIG_STOP_SERVING;
-    }
-    else
-        return SIG_OK;
+    start = (message->head + offset) & (RING_SIZE - 1);
+    first = size < RING_SIZE - start ? size : RING_SIZE - start;
+    memcpy(dest, message->buffer + start, first);
+    memcpy((char *)dest + first, message->buffer, size - first);
 }
 
 // Function  : handleMessages
-// Arguments : Message **of array mapping of socket file handles to message
-//             buffers, ClientList * of client linked list, fd_set * for a set
-//             of read file descriptors, and fd_set
-//             * of active file descriptors
-// Does      : Dispatches all messages in the Message ** buffer that are
-//             complete (aka not partial)
-// Returns   : nothing
-void
-handleMessages(Message **messages, ClientList *clientList, fd_set *read_fd_set,
-               fd_set *active_fd_set)
+// Arguments : Server * of server and int of client socket file descriptor
+// Does      : Dispatches every complete message in the socket's buffer, in
+//             order, and leaves a trailing partial message for later, or the
+//             rest when the client gets paused. A
+//             message longer than the protocol allows ends the connection, as
+//             the stream can't be framed past it.
+// Returns   : SIG_STOP_SERVING if the client was closed, SIG_OK otherwise
+int
+handleMessages(Server *server, int sockfd)
 {
-    int i;
     unsigned short type;
-    char *source, *destination, *data;
-    Message *message;
+    char header[HEADER_SIZE];
+    char source[SOURCE_FIELD_SIZE + 1];
+    char destination[DESTINATION_FIELD_SIZE + 1];
+    char data[MAX_DATA_SIZE + 1];
+    Connection *conn = server->connections[sockfd];
+    Message *message = &conn->message;
     unsigned int length, msg_id;
 
-    source = malloc(SOURCE_FIELD_SIZE);
-    destination = malloc(DESTINATION_FIELD_SIZE);
-    data = malloc(MAX_DATA_SIZE);
-
-    // Service all the sockets with input
-    for (i = 0; i < FD_SETSIZE; ++i)
+    while (message->size >= HEADER_SIZE && conn->pausedOn < 0)
     {
-        if (FD_ISSET(i, read_fd_set))
+        // Parse the header
+        copyFromMessage(message, 0, header, HEADER_SIZE);
+        memcpy(&type, header + TYPE_FIELD_START_INDEX, TYPE_FIELD_SIZE);
+        memcpy(source, header + SOURCE_FIELD_START_INDEX, SOURCE_FIELD_SIZE);
+        memcpy(destination, header + DESTINATION_FIELD_START_INDEX,
+               DESTINATION_FIELD_SIZE);
+        memcpy(&length, header + LENGTH_FIELD_START_INDEX, LENGTH_FIELD_SIZE);
+        memcpy(&msg_id, header + MESSAGE_ID_FIELD_START_INDEX,
+               MESSAGE_ID_FIELD_SIZE);
+        type = ntohs(type); // From network to host byte order
+        length = ntohl(length); // Likewise
+        msg_id = ntohl(msg_id);
+        source[SOURCE_FIELD_SIZE] = 0;
+        destination[DESTINATION_FIELD_SIZE] = 0;
+
+        if (length > MAX_DATA_SIZE)
         {
-            message = messages[i];
+            fprintf(stderr, "[chatserver] Message of %u bytes from socket %d "
+                    "is too long\n", length, sockfd);
+            closeClient(server, sockfd);
+            return SIG_STOP_SERVING;
+        }
+        if (message->size < HEADER_SIZE + length) // Wait for the rest
+            break;
 
-            if (!isMessagePartial(message))
-            {
-                // Parse the buffer
-                memcpy(&type, message->buffer + TYPE_FIELD_START_INDEX,
-                       TYPE_FIELD_SIZE);
-                memcpy(source, message->buffer + SOURCE_FIELD_START_INDEX,
-                       SOURCE_FIELD_SIZE);
-                memcpy(destination,
-                       message->buffer + DESTINATION_FIELD_START_INDEX,
-                       DESTINATION_FIELD_SIZE);
-                memcpy(&length, message->buffer + LENGTH_FIELD_START_INDEX,
-                       LENGTH_FIELD_SIZE);
-                memcpy(&msg_id, message->buffer + MESSAGE_ID_FIELD_START_INDEX,
-                       MESSAGE_ID_FIELD_SIZE);
-                type = ntohs(type); // From network to host byte order
-                length = ntohl(length); // Likewise
-                msg_id = ntohl(msg_id);
-                if (length > 0)
-                    memcpy(data, message->buffer + DATA_START_INDEX, length);
-                    
-                // Dispatch the message
-                printf("[chatserver] Dispatching message from socket %d\n", i);
-                if (dispatchMessage(type, source, destination, length, msg_id,
-                                    data, clientList, i) == SIG_STOP_SERVING)
-                {
-                    close(i);
-                    FD_CLR(i, active_fd_set);
-                    deregisterClient(clientList, i);
-                    printf("[chatserver] Closed connection with socket ");
-                    printf("%d\n", i);
-                }
-                bzero(messages[i]->buffer, messages[i]->size);
-                messages[i]->size = 0;
-            }
+        copyFromMessage(message, HEADER_SIZE, data, length);
+        data[length] = 0;
+        message->head = (message->head + HEADER_SIZE + length) &
+                        (RING_SIZE - 1);
+        message->size -= HEADER_SIZE + length;
+        if (message->size == 0) // Keep the next read contiguous
+            message->head = 0;
+
+        // Dispatch the message
+        printf("[chatserver] Dispatching message from socket %d\n", sockfd);
+        if (dispatchMessage(type, source, destination, length, msg_id, data,
+                            server, sockfd) == SIG_STOP_SERVING)
+        {
+            closeClient(server, sockfd);
+            return SIG_STOP_SERVING;
         }
     }
 
-    printClientList(clientList);
-
-    free(source);
-    free(destination);
-    free(data);
+    return SIG_OK;
 }
 
 // Function  : isMessagePartial
-// Arguments : Message * of message
-// Does      : tells whether the message is a partial message or not
+// Arguments : Message * of message buffer
+// Does      : tells whether the buffer ends in a partial message, which it
+//             does whenever it holds anything once handleMessages() is done
 // Returns   : bool of whether the message is partial
 bool
 isMessagePartial(Message *message)
 {
+    char length_field[LENGTH_FIELD_SIZE];
     unsigned int length;
 
-    // Checks if this is a message without data
-    if (message->size == HEADER_SIZE)
-    {
-        memcpy(&length, message->buffer + LENGTH_FIELD_START_INDEX,
-               LENGTH_FIELD_SIZE);
-        length = ntohl(length); // From network to host byte order
-        if (length == 0) // This is a message without data
-            return false;
-    }
-    // When there's some data
-    else if (message->size > HEADER_SIZE && message->size <= MAX_MESSAGE_SIZE)
-    {
-        // Check if it has the right amount of data
-        memcpy(&length, message->buffer + LENGTH_FIELD_START_INDEX,
-               LENGTH_FIELD_SIZE);
-        length = ntohl(length); // From network endian to host endian
+    if (message->size == 0)
+        return false;
+    if (message->size < HEADER_SIZE)
+        return true;
 
-        // It has the right amount of data
-        if (length == message->size - HEADER_SIZE)
-            return false;
-    }
+    copyFromMessage(message, LENGTH_FIELD_START_INDEX, length_field,
+                    LENGTH_FIELD_SIZE);
+    memcpy(&length, length_field, LENGTH_FIELD_SIZE);
+    length = ntohl(length); // From network endian to host endian
 
-    // Everything else is considered a partial message
-    return true;
+    return message->size < HEADER_SIZE + length;
 }
 
 // Function  : dispatchMessage
 // Arguments : unsigned short of type, char * of source, char * of destination,
 //             unsigned int of length, unsigned int of message id, void * of
-//             data, ClientList * of client linked list, and int of client
-//             socket file descriptor
-// Does      : dispatches the message according to its field
+//             data, Server * of server, and int of client socket file
+//             descriptor
+// Does      : dispatches the message according to its field, queueing the
+//             replies and relays. A relay the slow client policy drops is
+//             answered with CANNOT_DELIVER_ERROR, and a destination that
+//             fails or is given up on is closed. JOIN, LEAVE and PUBLISH name
+//             a channel in the destination field; a PUBLISH from outside the
+//             channel is answered with CANNOT_DELIVER_ERROR.
 // Returns   : SIG_STOP_SERVING on end of communication and SIG_OK otherwise
 int
 dispatchMessage(unsigned short type, char *source, char *destination,
                 unsigned int length, unsigned int msg_id, void *data,
-                ClientList *clientList, int sockfd)
+                Server *server, int sockfd)
 {
-    void *reply, *clientListBuffer;
-    int dest_sockfd;
-    int return_val;
+    ClientList *clientList = server->clientList;
+    SharedBuffer *reply;
+    Channel *channel;
+    void *clientListBuffer;
+    int return_val, status;
     size_t clientListBufferSize;
 
     printMessage(type, source, destination, length, msg_id, data);
@@ -458,16 +1459,15 @@ dispatchMessage(unsigned short type, char *source, char *destination,
     switch (type)
     {
         case HELLO:
-            if (registerClient(clientList, source, sockfd) ==
+            if (registerClient(clientList, source, sockfd, server->shard) ==
                 SIG_CLIENT_ALREADY_PRESENT)
             {
                 // Send CLIENT_ALREADY_PRESENT_ERROR
                 reply = makeMessageBuffer(CLIENT_ALREADY_PRESENT_ERROR,
                                           destination, source, 0, 0, NULL);
-                write(sockfd, reply, HEADER_SIZE);
+                queueMessage(server, sockfd, reply, sockfd);
                 printf("[chatserver] Sent CLIENT_ALREADY_PRESENT_ERROR ");
                 printf(" to socket %d\n", sockfd);
-                free(reply);
                 return_val = SIG_STOP_SERVING;
             }
             else
@@ -475,22 +1475,23 @@ dispatchMessage(unsigned short type, char *source, char *destination,
                 // Send HELLOACK
                 reply = makeMessageBuffer(HELLO_ACK, destination, source, 0, 0,
                                           NULL);
-                if (write(sockfd, reply, HEADER_SIZE) < 0)
+                if (queueMessage(server, sockfd, reply, sockfd) ==
+                    SIG_STOP_SERVING)
+                {
                     return_val = SIG_STOP_SERVING;
-                free(reply);
+                    break;
+                }
                 
                 // Send CLIENT_LIST
                 clientListBuffer = malloc(MAX_DATA_SIZE);
                 clientListBufferSize = makeClientListBuffer(clientListBuffer,
                                                             clientList);
-                clientListBuffer = realloc(clientListBuffer,
-                                           clientListBufferSize);
                 reply = makeMessageBuffer(CLIENT_LIST, destination, source,
                                           clientListBufferSize, 0,
                                           clientListBuffer);
-                if (write(sockfd, reply, HEADER_SIZE+clientListBufferSize) < 0)
+                if (queueMessage(server, sockfd, reply, sockfd) ==
+                    SIG_STOP_SERVING)
                     return_val = SIG_STOP_SERVING;
-                free(reply);
                 free(clientListBuffer);
             }
             break;
@@ -499,37 +1500,59 @@ dispatchMessage(unsigned short type, char *source, char *destination,
             clientListBuffer = malloc(MAX_DATA_SIZE);
             clientListBufferSize = makeClientListBuffer(clientListBuffer,
                                                         clientList);
-            clientListBuffer = realloc(clientListBuffer, clientListBufferSize);
             reply = makeMessageBuffer(CLIENT_LIST, destination, source,
                                       clientListBufferSize, 0,
                                       clientListBuffer);
-            if (write(sockfd, reply, HEADER_SIZE+clientListBufferSize) < 0)
+            if (queueMessage(server, sockfd, reply, sockfd) ==
+                SIG_STOP_SERVING)
                 return_val = SIG_STOP_SERVING;
-            free(reply);
             free(clientListBuffer);
             break;
         case CHAT:
             // Relay CHAT or send CANNOT_DELIVER_ERROR
-            dest_sockfd = clientNameToSockFd(clientList, destination);
-            if (dest_sockfd == SIG_CLIENT_NOT_PRESENT)
+            reply = makeMessageBuffer(CHAT, source, destination, length,
+                                      msg_id, data);
+            status = deliverMessage(server, destination, reply, sockfd);
+            if (status == SIG_STOP_SERVING)
+                return_val = SIG_STOP_SERVING;
+            if (status == SIG_MESSAGE_DROPPED)
             {
                 reply = makeMessageBuffer(CANNOT_DELIVER_ERROR, SERVER_NAME,
                                           source, 0, msg_id, NULL);
-                if (write(sockfd, reply, HEADER_SIZE) < 0)
+                if (queueMessage(server, sockfd, reply, sockfd) ==
+                    SIG_STOP_SERVING)
                     return_val = SIG_STOP_SERVING;
-                free(reply);
                 printf("[chatserver] Sent CANNOT_DELIVER_ERROR to socket %d\n",
                        sockfd);
             }
-            else
+            break;
+        case JOIN:
+            joinChannel(server, destination, sockfd);
+            break;
+        case LEAVE:
+            channel = findChannel(server, destination);
+            if (channel)
+                leaveChannel(server, channel, sockfd);
+            break;
+        case PUBLISH:
+            // Fan PUBLISH out to the channel or send CANNOT_DELIVER_ERROR
+            channel = findChannel(server, destination);
+            status = SIG_MESSAGE_DROPPED;
+            if (channel)
             {
-                reply = makeMessageBuffer(CHAT, source, destination, length,
+                reply = makeMessageBuffer(PUBLISH, source, destination, length,
                                           msg_id, data);
-                if (write(dest_sockfd, reply, HEADER_SIZE + length) < 0)
+                status = publishToChannel(server, channel, reply, sockfd);
+            }
+            if (status == SIG_MESSAGE_DROPPED)
+            {
+                reply = makeMessageBuffer(CANNOT_DELIVER_ERROR, SERVER_NAME,
+                                          source, 0, msg_id, NULL);
+                if (queueMessage(server, sockfd, reply, sockfd) ==
+                    SIG_STOP_SERVING)
                     return_val = SIG_STOP_SERVING;
-                free(reply);
-                printf("[chatserver] Sent CHAT message to socket %d\n",
-                       dest_sockfd);
+                printf("[chatserver] Sent CANNOT_DELIVER_ERROR to socket %d\n",
+                       sockfd);
             }
             break;
         case EXIT:
@@ -545,26 +1568,33 @@ dispatchMessage(unsigned short type, char *source, char *destination,
 }
 
 // Function  : makeClientListBuffer
-// Arguments : char * of buffer and ClientList * of client linked list
-// Does      : makes the data part of the CLIENT_LIST message
+// Arguments : char * of buffer of MAX_DATA_SIZE bytes and ClientList * of
+//             client registry
+// Does      : makes the data part of the CLIENT_LIST message, with as many
+//             client IDs as fit in one message
 // Returns   : size_t of the total size of null-terminated strings of client
 //             IDs
 size_t
 makeClientListBuffer(void *buffer, ClientList *clientList)
 {
-    size_t buffer_size, clientname_size;
-    ClientListNode *curr;
+    size_t buffer_size, clientname_size, i;
 
     buffer_size = 0;
 
-    curr = clientList->head;
-    while (curr)
+    pthread_rwlock_rdlock(&clientList->lock);
+    for (i = 0; i < clientList->capacity; i++)
     {
-        clientname_size = strlen(curr->name) + 1; // For null terminator
-        memcpy(buffer + buffer_size, curr->name, clientname_size);
+        if (clientList->slots[i].sockfd < 0)
+            continue;
+
+        clientname_size = strlen(clientList->slots[i].name) + 1; // For null
+        if (buffer_size + clientname_size > MAX_DATA_SIZE)       // terminator
+            break;
+        memcpy(buffer + buffer_size, clientList->slots[i].name,
+               clientname_size);
         buffer_size += clientname_size;
-        curr = curr->next;
     }
+    pthread_rwlock_unlock(&clientList->lock);
 
     return buffer_size;
 }
@@ -573,16 +1603,22 @@ makeClientListBuffer(void *buffer, ClientList *clientList)
 // Arguments : unsigned short of type, char * of source, char * of destination,
 //             unsigned int of length, unsigned int of message id, and void * of
 //             data
-// Does      : makes a message that is ready to be sent to the client. Memory
-//             is allocated for the message and needs to be freed after usage.
-// Returns   : void * of message
-void *
+// Does      : makes a message that is ready to be sent to the client, once
+//             for all of its recipients. The name fields are padded with
+//             zeros. The caller holds its only reference, which it hands to
+//             queueMessage() or lets go of with releaseBuffer().
+// Returns   : SharedBuffer * of message
+SharedBuffer *
 makeMessageBuffer(unsigned short type, char *source, char *destination,
                   unsigned int length, unsigned int msg_id, void *data)
 {
-    void *msg_buffer;
+    SharedBuffer *buffer;
+    char *msg_buffer;
 
-    msg_buffer = malloc(length + HEADER_SIZE);
+    buffer = malloc(sizeof(SharedBuffer) + HEADER_SIZE + length);
+    buffer->refs = 1;
+    buffer->size = HEADER_SIZE + length;
+    msg_buffer = buffer->data;
 
     if (length > 0)
         memcpy(msg_buffer + DATA_START_INDEX, data, length);
@@ -590,14 +1626,25 @@ makeMessageBuffer(unsigned short type, char *source, char *destination,
     length = htonl(length); // Likewise
     msg_id = htonl(msg_id);
     memcpy(msg_buffer + TYPE_FIELD_START_INDEX, &type, TYPE_FIELD_SIZE);
-    memcpy(msg_buffer + SOURCE_FIELD_START_INDEX, source, SOURCE_FIELD_SIZE);
-    memcpy(msg_buffer + DESTINATION_FIELD_START_INDEX, destination,
-           DESTINATION_FIELD_SIZE);
+    strncpy(msg_buffer + SOURCE_FIELD_START_INDEX, source, SOURCE_FIELD_SIZE);
+    strncpy(msg_buffer + DESTINATION_FIELD_START_INDEX, destination,
+            DESTINATION_FIELD_SIZE);
     memcpy(msg_buffer + LENGTH_FIELD_START_INDEX, &length, LENGTH_FIELD_SIZE);
     memcpy(msg_buffer + MESSAGE_ID_FIELD_START_INDEX, &msg_id,
            MESSAGE_ID_FIELD_SIZE);
 
-    return msg_buffer;
+    return buffer;
+}
+
+// Function  : releaseBuffer
+// Arguments : SharedBuffer * of message
+// Does      : lets go of a reference to the message, freeing it with the last
+// Returns   : nothing
+void
+releaseBuffer(SharedBuffer *buffer)
+{
+    if (--buffer->refs == 0)
+        free(buffer);
 }
 
 // Function  : printMessage
@@ -622,6 +1669,9 @@ printMessage(unsigned short type, char *source, char *destination,
         case CLIENT_ALREADY_PRESENT_ERROR: break;
             printf("CLIENT_ALREADY_PRESENT_ERROR\n"); break;
         case CANNOT_DELIVER_ERROR: printf("CANNOT_DELIVER_ERROR\n"); break;
+        case JOIN: printf("JOIN\n"); break;
+        case LEAVE: printf("LEAVE\n"); break;
+        case PUBLISH: printf("PUBLISH\n"); break;
         default: printf("THIS_SHOULDNT_HAPPEN\n"); break;
     }
     printf("[chatserver]         Source: %s\n", source);
@@ -632,193 +1682,492 @@ printMessage(unsigned short type, char *source, char *destination,
         printf("[chatserver]         Data: (start after newline)\n%s\n", data);
 }
 
+// Function  : createClientList
+// Arguments : nothing
+// Does      : allocates an empty client registry
+// Returns   : ClientList * of client registry
+ClientList *
+createClientList()
+{
+    ClientList *clientList;
+    size_t i;
+
+    clientList = malloc(sizeof(ClientList));
+    clientList->capacity = REGISTRY_MIN_CAPACITY;
+    clientList->size = 0;
+    clientList->slots = malloc(clientList->capacity * sizeof(ClientSlot));
+    for (i = 0; i < clientList->capacity; i++)
+        clientList->slots[i].sockfd = -1;
+    clientList->fdSlots = NULL;
+    clientList->maxFds = 0;
+    pthread_rwlock_init(&clientList->lock, NULL);
+
+    return clientList;
+}
+
+// Function  : hashClientName
+// Arguments : char * of client name, at most SOURCE_FIELD_SIZE bytes
+// Does      : hashes the name with 32-bit FNV-1a
+// Returns   : unsigned of hash
+unsigned
+hashClientName(char *name)
+{
+    unsigned hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < SOURCE_FIELD_SIZE && name[i]; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+
+    return hash;
+}
+
+// Function  : findClientSlot
+// Arguments : ClientList * of client registry, char * of client name, and
+//             unsigned of its hash
+// Does      : probes from the name's home slot until it finds the name or an
+//             empty slot
+// Returns   : size_t of the slot holding the name, or of the empty slot where
+//             it would go
+size_t
+findClientSlot(ClientList *clientList, char *name, unsigned hash)
+{
+    size_t mask = clientList->capacity - 1;
+    size_t i;
+
+    for (i = hash & mask; clientList->slots[i].sockfd >= 0; i = (i + 1) & mask)
+    {
+        if (clientList->slots[i].hash == hash &&
+            strncmp(clientList->slots[i].name, name, SOURCE_FIELD_SIZE) == 0)
+            break;
+    }
+
+    return i;
+}
+
+// Function  : growClientList
+// Arguments : ClientList * of client registry
+// Does      : doubles the hash table and reinserts every client
+// Returns   : nothing
+void
+growClientList(ClientList *clientList)
+{
+    ClientSlot *old_slots = clientList->slots;
+    size_t old_capacity = clientList->capacity;
+    size_t i, j;
+
+    clientList->capacity *= 2;
+    clientList->slots = malloc(clientList->capacity * sizeof(ClientSlot));
+    for (i = 0; i < clientList->capacity; i++)
+        clientList->slots[i].sockfd = -1;
+
+    for (i = 0; i < old_capacity; i++)
+    {
+        if (old_slots[i].sockfd < 0)
+            continue;
+        j = findClientSlot(clientList, old_slots[i].name, old_slots[i].hash);
+        clientList->slots[j] = old_slots[i];
+        clientList->fdSlots[old_slots[i].sockfd] = j;
+    }
+
+    free(old_slots);
+}
+
 // Function  : registerClient
-// Arguments : ClientList * of client linked list, char * of client name, and
-//             an int of client socket file descriptor
-// Does      : registers the client information to the client linked list
+// Arguments : ClientList * of client registry, char * of client name, an
+//             int of client socket file descriptor, and int of the shard
+//             serving it
+// Does      : registers the client information to the client registry,
+//             checking for the name and taking it under one lock, so two
+//             shards can't both take it
 // Returns   : SIG_CLIENT_ALREADY_PRESENT on error when the client already
-//             exists, SIG_OK otherwise
+//             exists (or the socket already has a client), SIG_OK otherwise
 int
-registerClient(ClientList *clientList, char *name, int sockfd)
+registerClient(ClientList *clientList, char *name, int sockfd, int shard)
 {
-    ClientListNode* curr;
-    
-    if (clientList->head == NULL)
-    {
-        clientList->head = malloc(sizeof(ClientListNode));
-        clientList->head->next = NULL;
-        clientList->head->name = strdup(name);
-        clientList->head->sockfd = sockfd;
+    unsigned hash;
+    size_t i;
+    int newMaxFds;
 
-    }
-    else
+    pthread_rwlock_wrlock(&clientList->lock);
+
+    if (sockfd < clientList->maxFds && clientList->fdSlots[sockfd] >= 0)
     {
-        curr = clientList->head;
-        while (curr)
-        {
-            if (strcmp(curr->name, name) == 0) // If the client already exists
-            {
-                printf("[chatserver] Client %s already exists\n", name);
-                return SIG_CLIENT_ALREADY_PRESENT;
-            }
+        pthread_rwlock_unlock(&clientList->lock);
+        printf("[chatserver] Socket %d already has a client\n", sockfd);
+        return SIG_CLIENT_ALREADY_PRESENT;
+    }
 
-            if (curr->next)
-                curr = curr->next;
-            else
-                break;
-        }
+    hash = hashClientName(name);
+    i = findClientSlot(clientList, name, hash);
+    if (clientList->slots[i].sockfd >= 0) // If the client already exists
+    {
+        pthread_rwlock_unlock(&clientList->lock);
+        printf("[chatserver] Client %.*s already exists\n", SOURCE_FIELD_SIZE,
+               name);
+        return SIG_CLIENT_ALREADY_PRESENT;
+    }
 
-        curr->next = malloc(sizeof(ClientListNode));
-        curr->next->next = NULL;
-        curr->next->name = strdup(name);
-        curr->next->sockfd = sockfd;
+    // Grow the socket mapping to cover the descriptor
+    if (sockfd >= clientList->maxFds)
+    {
+        newMaxFds = clientList->maxFds ? clientList->maxFds : 64;
+        while (newMaxFds <= sockfd)
+            newMaxFds *= 2;
+        clientList->fdSlots = realloc(clientList->fdSlots,
+                                      newMaxFds * sizeof(int));
+        memset(clientList->fdSlots + clientList->maxFds, -1,
+               (newMaxFds - clientList->maxFds) * sizeof(int));
+        clientList->maxFds = newMaxFds;
     }
 
+    strncpy(clientList->slots[i].name, name, SOURCE_FIELD_SIZE);
+    clientList->slots[i].name[SOURCE_FIELD_SIZE] = 0;
+    clientList->slots[i].hash = hash;
+    clientList->slots[i].sockfd = sockfd;
+    clientList->slots[i].shard = shard;
+    clientList->fdSlots[sockfd] = i;
     ++clientList->size;
 
-    printf("[chatserver] Registered client %s with socket %d\n", name, sockfd);
+    if (clientList->size * 2 > clientList->capacity)
+        growClientList(clientList);
+
+    pthread_rwlock_unlock(&clientList->lock);
+
+    printf("[chatserver] Registered client %.*s with socket %d\n",
+           SOURCE_FIELD_SIZE, name, sockfd);
 
     return SIG_OK;
 }
 
 // Function  : deregisterClient
-// Arguments : ClientList * of client linked list and an int of client socket
+// Arguments : ClientList * of client registry and an int of client socket
 //             file descriptor
-// Does      : deregisters the client information from the client linked list
+// Does      : deregisters the client information from the client registry,
+//             shifting back later slots of the probe run so lookups never
+//             need tombstones
 // Returns   : nothing
 void
 deregisterClient(ClientList *clientList, int sockfd)
 {
-    ClientListNode *curr, *prev;
-    char *name;
+    size_t mask, i, j, home;
+
+    pthread_rwlock_wrlock(&clientList->lock);
 
-    curr = clientList->head;
-    while (curr)
+    if (sockfd >= clientList->maxFds || clientList->fdSlots[sockfd] < 0)
     {
-        if (curr->sockfd == sockfd)
-        {
-            if (curr == clientList->head)
-            {
-                clientList->head = curr->next;
-                prev = curr;
-                curr = curr->next;
-                name = strdup(prev->name);
-                free(prev->name);
-                free(prev);
-            }
-            else
-            {
-                prev->next = curr->next;
-                name = strdup(curr->name);
-                free(curr->name);
-                free(curr);
-                curr = prev->next;
-            }
+        pthread_rwlock_unlock(&clientList->lock);
+        return;
+    }
 
-            --clientList->size;
+    mask = clientList->capacity - 1;
 
-            printf("[chatserver] Deregistered client %s with socket %d\n",
-                   name, sockfd);
-            free(name);
-        }
-        else
-        {
-            prev = curr;
-            curr = curr->next;
-        }
+    i = clientList->fdSlots[sockfd];
+    clientList->fdSlots[sockfd] = -1;
+    --clientList->size;
+    printf("[chatserver] Deregistered client %s with socket %d\n",
+           clientList->slots[i].name, sockfd);
+
+    // Move up each later entry whose home slot isn't between the hole and it
+    for (j = (i + 1) & mask; clientList->slots[j].sockfd >= 0;
+         j = (j + 1) & mask)
+    {
+        home = clientList->slots[j].hash & mask;
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+
+        clientList->slots[i] = clientList->slots[j];
+        clientList->fdSlots[clientList->slots[i].sockfd] = i;
+        i = j;
     }
+    clientList->slots[i].sockfd = -1;
+
+    pthread_rwlock_unlock(&clientList->lock);
 }
 
 // Function  : freeClientList
-// Arguments : ClientList * of client linked list
-// Does      : frees up allocated memory for the client linked list
+// Arguments : ClientList * of client registry
+// Does      : frees up allocated memory for the client registry
 // Returns   : nothing
 void
 freeClientList(ClientList *clientList)
 {
-    ClientListNode *curr, *prev;
-
-    curr = clientList->head;
-    while (curr)
-    {
-        prev = curr;
-        curr = curr->next;
-        free(prev->name);
-        free(prev);
-    }
-
+    pthread_rwlock_destroy(&clientList->lock);
+    free(clientList->slots);
+    free(clientList->fdSlots);
     free(clientList);
 }
 
 // Function  : printClientList
-// Arguments : ClientList * of client linked list
-// Does      : prints the client names and socket numbers for clients
+// Arguments : ClientList * of client registry
+// Does      : prints the client names and socket numbers for clients, or just
+//             their number when there are more than PRINT_LIST_MAX
 // Returns   : nothing
 void
 printClientList(ClientList *clientList)
 {
-    ClientListNode *curr;
+    size_t i;
 
     printf("[chatserver] Client list:\n");
 
+    pthread_rwlock_rdlock(&clientList->lock);
+
     if (clientList->size == 0)
         printf("[chatserver]         empty\n");
-
-    curr = clientList->head;
-    while (curr)
+    else if (clientList->size > PRINT_LIST_MAX)
+        printf("[chatserver]         %zu clients\n", clientList->size);
+    else
     {
-        printf("[chatserver]         %s (socket %d)\n", curr->name,
-               curr->sockfd);
-        curr = curr->next;
+        for (i = 0; i < clientList->capacity; i++)
+        {
+            if (clientList->slots[i].sockfd >= 0)
+                printf("[chatserver]         %s (socket %d)\n",
+                       clientList->slots[i].name,
+                       clientList->slots[i].sockfd);
+        }
     }
+
+    pthread_rwlock_unlock(&clientList->lock);
 }
 
-// Function  : printClientList
-// Arguments : ClientList * of client linked list
-// Does      : prints the client names and socket numbers for clients
+// Function  : clientNameToSockFd
+// Arguments : ClientList * of client registry, char * of client name, and
+//             int * to store the shard serving the client in
+// Does      : looks the client up by name
 // Returns   : int of sockfd, SIG_CLIENT_NOT_PRESENT when no such client is
 //             found
 int
-clientNameToSockFd(ClientList *clientList, char *clientName)
+clientNameToSockFd(ClientList *clientList, char *clientName, int *shard)
 {
-    ClientListNode *curr;
+    size_t i;
+    int sockfd;
 
-    curr = clientList->head;
-    while (curr)
-    {
-        if (strcmp(curr->name, clientName) == 0)
-            return curr->sockfd;
-        curr = curr->next;
-    }
+    pthread_rwlock_rdlock(&clientList->lock);
+    i = findClientSlot(clientList, clientName, hashClientName(clientName));
+    sockfd = clientList->slots[i].sockfd;
+    *shard = clientList->slots[i].shard;
+    pthread_rwlock_unlock(&clientList->lock);
+
+    if (sockfd < 0)
+        return SIG_CLIENT_NOT_PRESENT;
 
-    return SIG_CLIENT_NOT_PRESENT;
+    return sockfd;
 }
 
 // Function  : organizeMessageBuffers
-// Arguments : Message ** of messages, fd_set * of read fd set
-// Does      : Iterates through the messages and gets rid of stale partial
+// Arguments : Server * of server, and int * and int of the sockets served in
+//             this serving round
+// Does      : Iterates through their messages and gets rid of stale partial
 //             messages
 // Returns   : nothing
 void
-organizeMessageBuffers(Message **messages, fd_set *read_fd_set)
+organizeMessageBuffers(Server *server, int *ready_fds, int num_ready)
 {
-    int i;
+    Message *message;
+    int i, j;
 
-    for (i = 0; i < FD_SETSIZE; ++i)
+    for (j = 0; j < num_ready; ++j)
     {
-        if (FD_ISSET(i, read_fd_set))
+        i = ready_fds[j];
+        if (server->connections[i] && server->connections[i]->pausedOn < 0)
         {
-            if (isMessagePartial(messages[i]))
+            message = &server->connections[i]->message;
+            if (isMessagePartial(message))
             {
-                if (messages[i]->last_retrieved + PARTIAL_MESSAGE_MAX_AGE <
-                    time(NULL) && messages[i]->size > 0)
+                if (message->last_retrieved + PARTIAL_MESSAGE_MAX_AGE <
+                    time(NULL) && message->size > 0)
                 {
-                    bzero(messages[i]->buffer, messages[i]->size);
-                    messages[i]->size = 0;
+                    message->head = 0;
+                    message->size = 0;
                     printf("[chatserver] Removed stale partial message for ");
                     printf("socket %d\n", i);
                 }
             }
         }
     }
-}
\ No newline at end of file
+}
+// Function  : findChannel
+// Arguments : Server * of server and char * of channel name
+// Does      : looks the name up in its hash chain
+// Returns   : Channel * of the channel, or NULL if nobody has joined it
+Channel *
+findChannel(Server *server, char *name)
+{
+    unsigned hash = hashClientName(name);
+    Channel *channel;
+
+    for (channel = server->channels[hash & (CHANNEL_BUCKETS - 1)]; channel;
+         channel = channel->next)
+    {
+        if (channel->hash == hash && strcmp(channel->name, name) == 0)
+            return channel;
+    }
+
+    return NULL;
+}
+
+// Function  : joinChannel
+// Arguments : Server * of server, char * of channel name, and int of client
+//             socket file descriptor
+// Does      : 1) creates the channel if nobody has joined it yet
+//             2) adds the client to its members, and the channel to the
+//                client's, unless it is a member already
+// Returns   : nothing
+void
+joinChannel(Server *server, char *name, int sockfd)
+{
+    Connection *conn = server->connections[sockfd];
+    Channel *channel, **bucket;
+    int i;
+
+    channel = findChannel(server, name);
+    if (!channel)
+    {
+        channel = calloc(1, sizeof(Channel));
+        strcpy(channel->name, name);
+        channel->hash = hashClientName(name);
+        bucket = &server->channels[channel->hash & (CHANNEL_BUCKETS - 1)];
+        channel->next = *bucket;
+        *bucket = channel;
+    }
+
+    for (i = 0; i < conn->numJoined; i++)
+    {
+        if (conn->joined[i] == channel)
+            return;
+    }
+
+    if (channel->numMembers == channel->maxMembers)
+    {
+        channel->maxMembers = channel->maxMembers ? channel->maxMembers * 2 : 4;
+        channel->members = realloc(channel->members,
+                                   channel->maxMembers * sizeof(int));
+    }
+    channel->members[channel->numMembers++] = sockfd;
+
+    if (conn->numJoined == conn->maxJoined)
+    {
+        conn->maxJoined = conn->maxJoined ? conn->maxJoined * 2 : 4;
+        conn->joined = realloc(conn->joined,
+                               conn->maxJoined * sizeof(Channel *));
+    }
+    conn->joined[conn->numJoined++] = channel;
+
+    printf("[chatserver] Socket %d joined channel %s, %d members\n", sockfd,
+           name, channel->numMembers);
+}
+
+// Function  : leaveChannel
+// Arguments : Server * of server, Channel * of channel, and int of client
+//             socket file descriptor
+// Does      : 1) takes the client out of the channel's members and the
+//                channel out of the client's, if it is a member
+//             2) frees the channel once it has no members left
+// Returns   : nothing
+void
+leaveChannel(Server *server, Channel *channel, int sockfd)
+{
+    Connection *conn = server->connections[sockfd];
+    Channel **link;
+    int i;
+
+    for (i = 0; i < conn->numJoined; i++)
+    {
+        if (conn->joined[i] == channel)
+            break;
+    }
+    if (i == conn->numJoined)
+        return;
+    conn->joined[i] = conn->joined[--conn->numJoined];
+
+    for (i = 0; i < channel->numMembers; i++)
+    {
+        if (channel->members[i] == sockfd)
+        {
+            channel->members[i] = channel->members[--channel->numMembers];
+            break;
+        }
+    }
+
+    printf("[chatserver] Socket %d left channel %s, %d members\n", sockfd,
+           channel->name, channel->numMembers);
+
+    if (channel->numMembers > 0)
+        return;
+
+    link = &server->channels[channel->hash & (CHANNEL_BUCKETS - 1)];
+    while (*link != channel)
+        link = &(*link)->next;
+    *link = channel->next;
+    free(channel->members);
+    free(channel);
+}
+
+// Function  : publishToChannel
+// Arguments : Server * of server, Channel * of channel, SharedBuffer * of the
+//             message, whose reference is let go of, and int of the
+//             publisher's socket, -1 for a message from another shard
+// Does      : 1) checks that a publisher on this shard is a member, and
+//                forwards its message to every other shard, to publish to
+//                their members of the channel
+//             2) queues the one message to every member here but the
+//                publisher, each queue taking a reference rather than a copy
+//             3) closes members that fail or are given up on; as they leave
+//                by swapping the last member into their place, the members
+//                are walked from the end, and the walk stops if the channel
+//                goes away with its last member
+// Returns   : SIG_OK, or SIG_MESSAGE_DROPPED if the publisher is not a member
+//             or the slow client policy dropped the message for any member
+//             here
+int
+publishToChannel(Server *server, Channel *channel, SharedBuffer *buffer,
+                 int sockfd)
+{
+    int i, member, status, members;
+    int return_val = SIG_OK;
+
+    if (sockfd >= 0)
+    {
+        for (i = 0; i < channel->numMembers && channel->members[i] != sockfd;
+             i++)
+            ;
+        if (i == channel->numMembers)
+        {
+            releaseBuffer(buffer);
+            return SIG_MESSAGE_DROPPED;
+        }
+
+        for (i = 0; i < server->shards->numShards; i++)
+        {
+            if (i == server->shard)
+                continue;
+            buffer->refs++;
+            forwardMessage(server, i, buffer);
+        }
+    }
+
+    printf("[chatserver] Publishing to channel %s, %d members\n",
+           channel->name, channel->numMembers);
+
+    for (i = channel->numMembers - 1; i >= 0; i--)
+    {
+        member = channel->members[i];
+        if (member == sockfd)
+            continue;
+
+        buffer->refs++;
+        status = queueMessage(server, member, buffer, sockfd);
+        if (status == SIG_MESSAGE_DROPPED)
+            return_val = SIG_MESSAGE_DROPPED;
+        else if (status == SIG_STOP_SERVING)
+        {
+            members = channel->numMembers;
+            closeClient(server, member);
+            if (members == 1)
+                break;
+        }
+    }
+
+    releaseBuffer(buffer);
+
+    return return_val;
+}
@@ -0,0 +1,262 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Overload protection. Every accepted client passes admitClient() before it
+// gets a Connection. Clients that waited in the accept queue longer than
+// config->queueDelayTarget, or that arrive while config->maxConnections are
+// being served, get a canned 503 at once; a client address over its own
+// concurrency limit or out of token-bucket credit gets a 429. Turning clients
+// away this cheaply keeps latency flat for the ones that are admitted instead
+// of letting everyone queue until they time out.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "httpproxy.h"
+
+#define OVERLOADED "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n" \
+                   "Content-Length: 21\r\nConnection: close\r\n\r\n"        \
+                   "Proxy is overloaded\r\n"
+#define TOO_MANY "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\n"     \
+                 "Content-Length: 19\r\nConnection: close\r\n\r\n"          \
+                 "Too many requests\r\n"
+
+static ClientBucket *findClient(Proxy *proxy, unsigned char *addr);
+static void refillClient(Proxy *proxy, ClientBucket *bucket, long long now);
+static void rejectClient(Proxy *proxy, int fd, const char *response,
+                         const char *reason);
+
+// Function  : admitClient
+// Arguments : Proxy * of proxy, int of a just accepted client descriptor,
+//             ClientBucket ** to fill in with the client's admission state,
+//             and long long * to fill in with when the handshake completed
+//             (us, monotonic; 0 if not measured)
+// Does      : 1) sheds the client with a 503 if it spent longer than the
+//                queue-delay target in the accept queue, measured by the
+//                kernel as the time since the handshake's last ACK
+//             2) sheds it with a 503 if maxConnections clients are being
+//                served already
+//             3) turns it away with a 429 if its address has
+//                clientConnections in flight or no tokens in its bucket
+//             4) otherwise counts it as being served
+// Returns   : 0 if admitted, -1 if the client has been answered and closed
+int
+admitClient(Proxy *proxy, int fd, ClientBucket **bucket, long long *queued)
+{
+    Config *config = proxy->config;
+    struct tcp_info info;
+    struct sockaddr_storage peer;
+    struct sockaddr_in *peer4;
+    struct sockaddr_in6 *peer6;
+    socklen_t length;
+    unsigned char addr[16];
+
+    *bucket = NULL;
+    *queued = 0;
+
+    // Traces report the accept-queue wait too
+    length = sizeof(info);
+    if ((config->queueDelayTarget > 0 || proxy->traceFd >= 0) &&
+        getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0)
+        *queued = nowUs() - info.tcpi_last_ack_recv * 1000LL;
+    else
+        info.tcpi_last_ack_recv = 0;
+
+    if (config->queueDelayTarget > 0 &&
+        info.tcpi_last_ack_recv > config->queueDelayTarget)
+    {
+        rejectClient(proxy, fd, OVERLOADED, "queue delay over target");
+        return -1;
+    }
+
+    if (config->maxConnections > 0 &&
+        proxy->numClients >= config->maxConnections)
+    {
+        rejectClient(proxy, fd, OVERLOADED, "connection limit reached");
+        return -1;
+    }
+
+    if (config->clientRate > 0 || config->clientConnections > 0)
+    {
+        // Key IPv4 clients by their IPv4-mapped IPv6 address
+        length = sizeof(peer);
+        if (getpeername(fd, (struct sockaddr *)&peer, &length) == 0)
+        {
+            memset(addr, 0, sizeof(addr));
+            if (peer.ss_family == AF_INET6)
+            {
+                peer6 = (struct sockaddr_in6 *)&peer;
+                memcpy(addr, &peer6->sin6_addr, 16);
+            }
+            else
+            {
+                peer4 = (struct sockaddr_in *)&peer;
+                addr[10] = addr[11] = 0xff;
+                memcpy(addr + 12, &peer4->sin_addr, 4);
+            }
+            *bucket = findClient(proxy, addr);
+        }
+    }
+
+    if (*bucket)
+    {
+        if (config->clientConnections > 0 &&
+            (*bucket)->active >= config->clientConnections)
+        {
+            rejectClient(proxy, fd, TOO_MANY, "client connection limit");
+            *bucket = NULL;
+            return -1;
+        }
+
+        if (config->clientRate > 0)
+        {
+            refillClient(proxy, *bucket, nowMs());
+            if ((*bucket)->tokens < 1)
+            {
+                rejectClient(proxy, fd, TOO_MANY, "client rate limit");
+                *bucket = NULL;
+                return -1;
+            }
+            (*bucket)->tokens -= 1;
+        }
+
+        (*bucket)->active++;
+    }
+
+    proxy->numClients++;
+
+    return 0;
+}
+
+// Function  : releaseClient
+// Arguments : Proxy * of proxy, and ClientBucket * of the closing client's
+//             admission state, or NULL
+// Does      : stops counting the client as being served
+// Returns   : nothing
+void
+releaseClient(Proxy *proxy, ClientBucket *bucket)
+{
+    proxy->numClients--;
+    if (bucket) bucket->active--;
+}
+
+// Function  : deleteClients
+// Arguments : Proxy * of proxy
+// Does      : frees the admission state of every client address
+// Returns   : nothing
+void
+deleteClients(Proxy *proxy)
+{
+    ClientBucket *bucket, *next;
+    unsigned i;
+
+    if (!proxy->clients) return;
+
+    for (i = 0; i < CLIENT_HASH_SIZE; i++)
+    {
+        for (bucket = proxy->clients[i]; bucket; bucket = next)
+        {
+            next = bucket->next;
+            free(bucket);
+        }
+    }
+    free(proxy->clients);
+}
+
+// Function  : findClient
+// Arguments : Proxy * of proxy, and unsigned char * of a 16-byte address
+// Does      : 1) finds the address's bucket, creating a full one if needed
+//             2) when the table is full, first drops buckets of addresses
+//                with nothing in flight and a full bucket, which are
+//                indistinguishable from new ones
+// Returns   : ClientBucket * of the bucket, or NULL if the table is full of
+//             addresses that are still active
+static ClientBucket *
+findClient(Proxy *proxy, unsigned char *addr)
+{
+    ClientBucket *bucket, **link;
+    long long now = nowMs();
+    unsigned hash, i;
+
+    if (!proxy->clients)
+        proxy->clients = calloc(CLIENT_HASH_SIZE, sizeof(ClientBucket *));
+
+    // FNV-1a over the address
+    hash = 2166136261u;
+    for (i = 0; i < 16; i++) hash = (hash ^ addr[i]) * 16777619u;
+    hash %= CLIENT_HASH_SIZE;
+
+    for (bucket = proxy->clients[hash]; bucket; bucket = bucket->next)
+        if (memcmp(bucket->addr, addr, 16) == 0) return bucket;
+
+    for (i = 0; proxy->numBuckets >= MAX_CLIENT_BUCKETS &&
+                i < CLIENT_HASH_SIZE; i++)
+    {
+        link = &proxy->clients[i];
+        while (*link)
+        {
+            bucket = *link;
+            refillClient(proxy, bucket, now);
+            if (bucket->active > 0 ||
+                (proxy->config->clientRate > 0 &&
+                 bucket->tokens < proxy->config->clientBurst))
+            {
+                link = &bucket->next;
+                continue;
+            }
+            *link = bucket->next;
+            free(bucket);
+            proxy->numBuckets--;
+        }
+    }
+    if (proxy->numBuckets >= MAX_CLIENT_BUCKETS) return NULL;
+
+    bucket = calloc(1, sizeof(ClientBucket));
+    memcpy(bucket->addr, addr, 16);
+    bucket->tokens = proxy->config->clientBurst;
+    bucket->refilled = now;
+    bucket->next = proxy->clients[hash];
+    proxy->clients[hash] = bucket;
+    proxy->numBuckets++;
+
+    return bucket;
+}
+
+// Function  : refillClient
+// Arguments : Proxy * of proxy, ClientBucket * of bucket, and long long of
+//             the current time in ms
+// Does      : adds the tokens earned since the last refill, up to the burst
+// Returns   : nothing
+static void
+refillClient(Proxy *proxy, ClientBucket *bucket, long long now)
+{
+    bucket->tokens += (now - bucket->refilled) * proxy->config->clientRate /
+                      1000;
+    if (bucket->tokens > proxy->config->clientBurst)
+        bucket->tokens = proxy->config->clientBurst;
+    bucket->refilled = now;
+}
+
+// Function  : rejectClient
+// Arguments : Proxy * of proxy, int of client descriptor, const char * of the
+//             canned response, and const char * of the reason to log
+// Does      : sends the response if the socket takes it without blocking and
+//             closes the connection, without reading the request
+// Returns   : nothing
+static void
+rejectClient(Proxy *proxy, int fd, const char *response, const char *reason)
+{
+    proxy->shed++;
+    fprintf(stderr, "[httpproxy] Turned away a client: %s (%lu so far)\n",
+            reason, proxy->shed);
+
+    send(fd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
@@ -0,0 +1,510 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Load generator for httpproxy. Requests URLs on the stand-in origin through
+// the proxy, picking them with Zipfian popularity; given several proxies (a
+// cluster), it takes them in turn. Closed-loop mode keeps a fixed number of
+// requests in flight; open-loop mode issues requests on a Poisson schedule and
+// measures latency from the scheduled start, so a slow proxy cannot hide its
+// queueing delay (no coordinated omission).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_PROXIES 64
+
+typedef struct
+{
+    struct sockaddr_in proxies[MAX_PROXIES];
+    unsigned numProxies;
+    struct sockaddr_in origin;
+    char originName[64];   // host:port as written into the URLs
+    unsigned objects;      // number of distinct URLs
+    double zipfExponent;   // popularity skew, 0 for uniform
+    unsigned connections;  // closed-loop concurrency / open-loop workers
+    double rate;           // open-loop requests per second, 0 = closed-loop
+    double duration;       // seconds
+    long timeoutMs;        // per-request socket timeout
+} LoadConfig;
+
+typedef struct
+{
+    pthread_t thread;
+    unsigned long long rng;
+    unsigned *latencies;   // microseconds
+    size_t numLatencies, capacity;
+    unsigned long errors;
+    unsigned long bytes;
+} Worker;
+
+void parseArguments(int argc, char **argv, LoadConfig *config);
+int parseAddress(const char *str, struct sockaddr_in *addr);
+void buildZipfTable(unsigned objects, double exponent);
+unsigned pickObject(Worker *worker);
+double nextRandom(Worker *worker);
+void *closedLoop(void *arg);
+void *openLoop(void *arg);
+int sendRequest(unsigned object, long *bytes);
+unsigned long queryOrigin(const char *path);
+void recordLatency(Worker *worker, double usec);
+double nowUsec();
+int compareUnsigned(const void *a, const void *b);
+
+#define DEFAULT_PROXY "127.0.0.1:18081"
+#define DEFAULT_ORIGIN "127.0.0.1:18080"
+#define READ_BUFFER_SIZE 65536
+
+static LoadConfig config;
+static double *zipfCdf;
+static double startUsec, endUsec;
+static double *arrivals;        // open-loop schedule, usec offsets
+static size_t numArrivals;
+static size_t nextArrival;      // updated with __atomic builtins
+static unsigned nextProxy;      // updated with __atomic builtins
+
+int
+main(int argc, char **argv)
+{
+    Worker *workers;
+    unsigned *all;
+    size_t total = 0, offset = 0;
+    unsigned long errors = 0, bytes = 0, originServed;
+    double elapsed, hitRatio;
+    unsigned i;
+
+    parseArguments(argc, argv, &config);
+    signal(SIGPIPE, SIG_IGN);
+    buildZipfTable(config.objects, config.zipfExponent);
+
+    workers = calloc(config.connections, sizeof(Worker));
+    for (i = 0; i < config.connections; i++)
+        workers[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1) ^ (unsigned)getpid();
+
+    // Poisson arrivals for open-loop mode
+    if (config.rate > 0)
+    {
+        Worker seed = { .rng = 0xD1B54A32D192ED03ULL };
+        double t = 0;
+
+        numArrivals = (size_t)(config.rate * config.duration) + 1;
+        arrivals = malloc(numArrivals * sizeof(double));
+        for (size_t k = 0; k < numArrivals; k++)
+        {
+            t += -log(1.0 - nextRandom(&seed)) / config.rate * 1e6;
+            arrivals[k] = t;
+        }
+    }
+
+    queryOrigin("/__reset");
+    startUsec = nowUsec();
+    endUsec = startUsec + config.duration * 1e6;
+
+    for (i = 0; i < config.connections; i++)
+        pthread_create(&workers[i].thread, NULL,
+                       config.rate > 0 ? openLoop : closedLoop, &workers[i]);
+    for (i = 0; i < config.connections; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].numLatencies;
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+    }
+    elapsed = (nowUsec() - startUsec) / 1e6;
+    originServed = queryOrigin("/__stats");
+
+    all = malloc((total ? total : 1) * sizeof(unsigned));
+    for (i = 0; i < config.connections; i++)
+    {
+        memcpy(all + offset, workers[i].latencies,
+               workers[i].numLatencies * sizeof(unsigned));
+        offset += workers[i].numLatencies;
+        free(workers[i].latencies);
+    }
+    qsort(all, total, sizeof(unsigned), compareUnsigned);
+
+    hitRatio = total ? 1.0 - (double)originServed / (double)total : 0;
+    if (hitRatio < 0) hitRatio = 0;
+
+    printf("[loadgen] mode=%s proxies=%u objects=%u zipf=%.2f "
+           "connections=%u", config.rate > 0 ? "open" : "closed",
+           config.numProxies, config.objects, config.zipfExponent,
+           config.connections);
+    if (config.rate > 0) printf(" offered_rps=%.0f", config.rate);
+    printf("\n");
+    printf("[loadgen] requests=%zu errors=%lu elapsed=%.2fs rps=%.1f "
+           "MB/s=%.2f\n", total, errors, elapsed, total / elapsed,
+           bytes / elapsed / 1e6);
+    printf("[loadgen] hit_ratio=%.3f origin_requests=%lu\n", hitRatio,
+           originServed);
+    if (total)
+        printf("[loadgen] latency_us p50=%u p99=%u p999=%u max=%u\n",
+               all[total / 2], all[(size_t)(total * 0.99)],
+               all[(size_t)(total * 0.999)], all[total - 1]);
+
+    free(all);
+    free(workers);
+    free(zipfCdf);
+    free(arrivals);
+
+    return errors && !total ? EXIT_FAILURE : 0;
+}
+
+// Function  : parseArguments
+// Arguments : int of argc, char ** of argv, and LoadConfig * to fill in
+// Does      : 1) applies defaults
+//             2) overrides them with -x proxies (comma-separated), -o
+//                origin, -n objects,
+//                -z zipf exponent, -c connections, -r rate, -d duration and
+//                -T timeout (ms)
+// Returns   : nothing
+void
+parseArguments(int argc, char **argv, LoadConfig *config)
+{
+    const char *proxy = DEFAULT_PROXY, *origin = DEFAULT_ORIGIN;
+    char *list, *entry, *rest;
+    int opt;
+
+    config->objects = 1000;
+    config->zipfExponent = 0.99;
+    config->connections = 8;
+    config->rate = 0;
+    config->duration = 10;
+    config->timeoutMs = 5000;
+
+    while ((opt = getopt(argc, argv, "x:o:n:z:c:r:d:T:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'x': proxy = optarg; break;
+            case 'o': origin = optarg; break;
+            case 'n': config->objects = strtoul(optarg, NULL, 10); break;
+            case 'z': config->zipfExponent = strtod(optarg, NULL); break;
+            case 'c': config->connections = strtoul(optarg, NULL, 10); break;
+            case 'r': config->rate = strtod(optarg, NULL); break;
+            case 'd': config->duration = strtod(optarg, NULL); break;
+            case 'T': config->timeoutMs = strtol(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "[loadgen] Usage: %s [-x proxy host:port,...] "
+                        "[-o origin host:port] [-n objects] [-z zipf] "
+                        "[-c connections] [-r rate] [-d seconds] "
+                        "[-T timeout ms]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    config->numProxies = 0;
+    list = strdup(proxy);
+    for (entry = strtok_r(list, ",", &rest); entry;
+         entry = strtok_r(NULL, ",", &rest))
+    {
+        if (config->numProxies == MAX_PROXIES ||
+            parseAddress(entry, &config->proxies[config->numProxies]) < 0)
+            break;
+        config->numProxies++;
+    }
+    if (entry || config->numProxies == 0 ||
+        parseAddress(origin, &config->origin) < 0)
+    {
+        fprintf(stderr, "[loadgen] Addresses must be numeric IPv4 host:port, "
+                "at most %d proxies\n", MAX_PROXIES);
+        exit(EXIT_FAILURE);
+    }
+    free(list);
+    snprintf(config->originName, sizeof(config->originName), "%s", origin);
+    if (config->objects == 0) config->objects = 1;
+    if (config->connections == 0) config->connections = 1;
+}
+
+// Function  : parseAddress
+// Arguments : const char * of "a.b.c.d:port" and sockaddr_in * to fill in
+// Does      : converts a numeric host:port into a socket address
+// Returns   : 0 on success, -1 on malformed input
+int
+parseAddress(const char *str, struct sockaddr_in *addr)
+{
+    char host[64];
+    const char *colon;
+
+    colon = strrchr(str, ':');
+    if (!colon || colon - str >= (long)sizeof(host)) return -1;
+    memcpy(host, str, colon - str);
+    host[colon - str] = 0;
+
+    bzero((char *)addr, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(strtoul(colon + 1, NULL, 10));
+
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+// Function  : buildZipfTable
+// Arguments : unsigned of number of objects, double of exponent
+// Does      : builds the cumulative distribution where object k (1-based) has
+//             weight 1 / k^exponent
+// Returns   : nothing
+void
+buildZipfTable(unsigned objects, double exponent)
+{
+    double sum = 0;
+    unsigned k;
+
+    zipfCdf = malloc(objects * sizeof(double));
+    for (k = 0; k < objects; k++)
+    {
+        sum += 1.0 / pow((double)(k + 1), exponent);
+        zipfCdf[k] = sum;
+    }
+    for (k = 0; k < objects; k++) zipfCdf[k] /= sum;
+}
+
+// Function  : pickObject
+// Arguments : Worker * of the calling worker
+// Does      : samples an object index from the Zipf table by binary search
+// Returns   : unsigned of object index
+unsigned
+pickObject(Worker *worker)
+{
+    double u = nextRandom(worker);
+    unsigned lo = 0, hi = config.objects - 1, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (zipfCdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+// Function  : nextRandom
+// Arguments : Worker * owning the generator state
+// Does      : advances a xorshift64* generator
+// Returns   : double uniformly distributed in [0, 1)
+double
+nextRandom(Worker *worker)
+{
+    unsigned long long x = worker->rng;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    worker->rng = x;
+
+    return (double)((x * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+// Function  : closedLoop
+// Arguments : void * of Worker
+// Does      : issues requests back to back until the run ends
+// Returns   : NULL
+void *
+closedLoop(void *arg)
+{
+    Worker *worker = arg;
+    double begin;
+    long bytes;
+
+    while ((begin = nowUsec()) < endUsec)
+    {
+        if (sendRequest(pickObject(worker), &bytes) == 0)
+        {
+            recordLatency(worker, nowUsec() - begin);
+            worker->bytes += bytes;
+        }
+        else
+            worker->errors++;
+    }
+
+    return NULL;
+}
+
+// Function  : openLoop
+// Arguments : void * of Worker
+// Does      : claims the next slot of the Poisson schedule, waits for its
+//             start time and issues the request; latency counts from the
+//             scheduled start
+// Returns   : NULL
+void *
+openLoop(void *arg)
+{
+    Worker *worker = arg;
+    size_t slot;
+    double scheduled, wait;
+    long bytes;
+
+    for (;;)
+    {
+        slot = __atomic_fetch_add(&nextArrival, 1, __ATOMIC_RELAXED);
+        if (slot >= numArrivals) break;
+        scheduled = startUsec + arrivals[slot];
+        if (scheduled >= endUsec) break;
+
+        wait = scheduled - nowUsec();
+        if (wait > 0) usleep((useconds_t)wait);
+
+        if (sendRequest(pickObject(worker), &bytes) == 0)
+        {
+            recordLatency(worker, nowUsec() - scheduled);
+            worker->bytes += bytes;
+        }
+        else
+            worker->errors++;
+    }
+
+    return NULL;
+}
+
+// Function  : sendRequest
+// Arguments : unsigned of object index, and long * to receive the response
+//             size
+// Does      : 1) connects to the next proxy in turn
+//             2) sends an absolute-form GET for the object on the origin
+//             3) reads the response until the proxy closes the connection
+// Returns   : 0 on a complete "HTTP/1.x 200" response, -1 otherwise
+int
+sendRequest(unsigned object, long *bytes)
+{
+    char request[256], buffer[READ_BUFFER_SIZE];
+    char status[16] = { 0 };
+    struct timeval tv;
+    int sockfd, length, one = 1;
+    ssize_t read_size;
+    long total = 0;
+    struct sockaddr_in *proxy;
+
+    proxy = &config.proxies[__atomic_fetch_add(&nextProxy, 1, __ATOMIC_RELAXED)
+                            % config.numProxies];
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) return -1;
+    tv.tv_sec = config.timeoutMs / 1000;
+    tv.tv_usec = (config.timeoutMs % 1000) * 1000;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(sockfd, (struct sockaddr *)proxy, sizeof(*proxy)) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    length = snprintf(request, sizeof(request),
+                      "GET http://%s/obj/%u HTTP/1.1\r\n"
+                      "Host: %s\r\n\r\n",
+                      config.originName, object, config.originName);
+    if (write(sockfd, request, length) != length)
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    while ((read_size = read(sockfd, buffer, sizeof(buffer))) > 0)
+    {
+        if (total < (long)sizeof(status) - 1)
+            memcpy(status + total, buffer,
+                   read_size < (long)sizeof(status) - 1 - total ?
+                   read_size : (long)sizeof(status) - 1 - total);
+        total += read_size;
+    }
+    close(sockfd);
+
+    *bytes = total;
+    if (read_size < 0 || strncmp(status, "HTTP/1.", 7) != 0 ||
+        strncmp(status + 8, " 200", 4) != 0)
+        return -1;
+
+    return 0;
+}
+
+// Function  : queryOrigin
+// Arguments : const char * of a stats path on the origin
+// Does      : asks the origin directly (bypassing the proxy) for its counter
+// Returns   : unsigned long of the counter, 0 if the origin did not answer
+unsigned long
+queryOrigin(const char *path)
+{
+    char request[128], response[512];
+    ssize_t size = 0, read_size;
+    char *body;
+    int sockfd, length;
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) return 0;
+    if (connect(sockfd, (struct sockaddr *)&config.origin,
+                sizeof(config.origin)) < 0)
+    {
+        fprintf(stderr, "[loadgen] Origin not reachable for %s\n", path);
+        close(sockfd);
+        return 0;
+    }
+
+    length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\n"
+                      "Host: %s\r\n\r\n", path, config.originName);
+    write(sockfd, request, length);
+    while (size < (ssize_t)sizeof(response) - 1 &&
+           (read_size = read(sockfd, response + size,
+                             sizeof(response) - 1 - size)) > 0)
+        size += read_size;
+    response[size] = 0;
+    close(sockfd);
+
+    body = strstr(response, "\r\n\r\n");
+
+    return body ? strtoul(body + 4, NULL, 10) : 0;
+}
+
+// Function  : recordLatency
+// Arguments : Worker * of the caller and double of latency in microseconds
+// Does      : appends the sample to the worker's private array
+// Returns   : nothing
+void
+recordLatency(Worker *worker, double usec)
+{
+    if (worker->numLatencies == worker->capacity)
+    {
+        worker->capacity = worker->capacity ? worker->capacity * 2 : 4096;
+        worker->latencies = realloc(worker->latencies,
+                                    worker->capacity * sizeof(unsigned));
+    }
+    worker->latencies[worker->numLatencies++] = (unsigned)usec;
+}
+
+// Function  : nowUsec
+// Arguments : nothing
+// Does      : reads the monotonic clock
+// Returns   : double of microseconds
+double
+nowUsec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Function  : compareUnsigned
+// Arguments : two const void * to unsigned values
+// Does      : qsort() comparator
+// Returns   : int of ordering
+int
+compareUnsigned(const void *a, const void *b)
+{
+    unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+
+    return (x > y) - (x < y);
+}
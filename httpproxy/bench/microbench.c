@@ -0,0 +1,677 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Microbenchmarks for the cache primitives and HTTP message handling in
+// httpproxy. Each case is timed over repeated batches and reports ns/op,
+// heap allocations/op and, where the kernel allows perf counters, last-level
+// cache misses/op. Results are written as one JSON document so two runs can
+// be diffed or compared by a script.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../httpproxy.h"
+
+typedef struct
+{
+    const char *name;
+    unsigned cacheSize;        // 0 when the case does not use a cache
+    const char *distribution;  // key popularity, or "-"
+    size_t responseBytes;      // size of the HTTP message handled
+    unsigned long iterations;
+    double nsPerOp;
+    double allocsPerOp;
+    double missesPerOp;        // negative when perf counters are unavailable
+} Result;
+
+typedef struct
+{
+    struct timespec start;
+    unsigned long allocations;
+    long long misses;
+} Sample;
+
+void parseOptions(int argc, char **argv);
+void *malloc(size_t size);
+void *calloc(size_t count, size_t size);
+void *realloc(void *ptr, size_t size);
+void openPerfCounter();
+void startSample(Sample *sample);
+void stopSample(Sample *sample, double *ns, unsigned long *allocations,
+                long long *misses);
+void report(Result *result, double ns, unsigned long allocations,
+            long long misses);
+char **makeKeys(unsigned count);
+void freeKeys(char **keys, unsigned count);
+unsigned *makeSchedule(unsigned count, unsigned universe,
+                       const char *distribution);
+char *makeResponse(size_t bodySize, size_t *size);
+void fillCache(Cache *cache, char **keys, unsigned count, char *response,
+               ssize_t responseSize);
+void benchHashKey(unsigned cacheSize, const char *distribution);
+void benchGetFromCache(unsigned cacheSize, const char *distribution, int hit);
+void benchPutIntoCache(unsigned cacheSize);
+void benchRemoveCacheBlock(unsigned cacheSize);
+void benchAddAgeField(size_t bodySize);
+void benchParseRequest();
+int timeLeft(struct timespec *begin);
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+#define SCHEDULE_SIZE 65536
+#define BATCH_SIZE 64
+#define DEFAULT_BUDGET_MS 200
+#define SAMPLE_BODY_SIZE 2048
+
+static unsigned long allocationCount;
+static int perfFd = -1;
+static long budgetMs = DEFAULT_BUDGET_MS;
+static FILE *jsonOut;
+static int firstResult = 1;
+static unsigned rngState = 12345;
+
+static const unsigned cacheSizes[] = { 10, 100, 1000, 10000 };
+static const char *distributions[] = { "uniform", "zipf" };
+
+int
+main(int argc, char **argv)
+{
+    unsigned i, j;
+
+    parseOptions(argc, argv);
+    openPerfCounter();
+
+    // The cache logs every operation; keep that out of the JSON stream but
+    // still pay for it, since the proxy does
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        fprintf(stderr, "[microbench] Failed to silence stdout\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(jsonOut, "{\n  \"perf_counters\": %s,\n  \"budget_ms\": %ld,\n"
+            "  \"results\": [", perfFd >= 0 ? "true" : "false", budgetMs);
+
+    for (i = 0; i < sizeof(cacheSizes) / sizeof(cacheSizes[0]); i++)
+    {
+        for (j = 0; j < sizeof(distributions) / sizeof(distributions[0]); j++)
+        {
+            benchHashKey(cacheSizes[i], distributions[j]);
+            benchGetFromCache(cacheSizes[i], distributions[j], 1);
+        }
+        benchGetFromCache(cacheSizes[i], "uniform", 0);
+        benchPutIntoCache(cacheSizes[i]);
+        benchRemoveCacheBlock(cacheSizes[i]);
+    }
+    benchAddAgeField(SAMPLE_BODY_SIZE);
+    benchAddAgeField(65536);
+    benchAddAgeField(1048576);
+    benchParseRequest();
+
+    fprintf(jsonOut, "\n  ]\n}\n");
+    fclose(jsonOut);
+    if (perfFd >= 0) close(perfFd);
+
+    return 0;
+}
+
+// Function  : parseOptions
+// Arguments : int of argc and char ** of argv
+// Does      : handles -t budget per case (ms) and -o JSON output file
+// Returns   : nothing
+void
+parseOptions(int argc, char **argv)
+{
+    const char *output = NULL;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "t:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': budgetMs = strtol(optarg, NULL, 10); break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "[microbench] Usage: %s [-t ms per case] "
+                        "[-o output.json]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (output)
+        jsonOut = fopen(output, "w");
+    else if ((fd = dup(STDOUT_FILENO)) >= 0)
+        jsonOut = fdopen(fd, "w");
+    if (!jsonOut)
+    {
+        fprintf(stderr, "[microbench] Cannot open JSON output\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function  : malloc, calloc, realloc
+// Arguments : as the C library's
+// Does      : counts heap allocations, including those made inside libc
+//             (strdup), then defers to the C library allocator
+// Returns   : as the C library's
+void *
+malloc(size_t size)
+{
+    allocationCount++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t count, size_t size)
+{
+    allocationCount++;
+    return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    allocationCount++;
+    return __libc_realloc(ptr, size);
+}
+
+// Function  : openPerfCounter
+// Arguments : nothing
+// Does      : opens a user-space cache-miss counter for this process; leaves
+//             perfFd at -1 if perf events are not permitted or supported
+// Returns   : nothing
+void
+openPerfCounter()
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    perfFd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perfFd < 0)
+        fprintf(stderr, "[microbench] perf counters unavailable, "
+                "cache misses will be reported as null\n");
+}
+
+// Function  : startSample
+// Arguments : Sample * to record the starting point in
+// Does      : snapshots the clock and allocation count, and starts the cache
+//             miss counter
+// Returns   : nothing
+void
+startSample(Sample *sample)
+{
+    sample->allocations = allocationCount;
+    if (perfFd >= 0)
+    {
+        ioctl(perfFd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(perfFd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &sample->start);
+}
+
+// Function  : stopSample
+// Arguments : Sample * from startSample(), and the running totals of elapsed
+//             ns, allocations and cache misses to add this sample to
+// Does      : stops the counters and accumulates the deltas
+// Returns   : nothing
+void
+stopSample(Sample *sample, double *ns, unsigned long *allocations,
+           long long *misses)
+{
+    struct timespec end;
+    long long count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (perfFd >= 0)
+    {
+        ioctl(perfFd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perfFd, &count, sizeof(count)) != sizeof(count)) count = 0;
+    }
+
+    *ns += (end.tv_sec - sample->start.tv_sec) * 1e9 +
+           (end.tv_nsec - sample->start.tv_nsec);
+    *allocations += allocationCount - sample->allocations;
+    *misses += count;
+}
+
+// Function  : report
+// Arguments : Result * describing the case, and its accumulated totals
+// Does      : writes the case as one JSON object
+// Returns   : nothing
+void
+report(Result *result, double ns, unsigned long allocations, long long misses)
+{
+    double ops = result->iterations ? (double)result->iterations : 1;
+
+    result->nsPerOp = ns / ops;
+    result->allocsPerOp = allocations / ops;
+    result->missesPerOp = perfFd >= 0 ? misses / ops : -1;
+
+    fprintf(jsonOut, "%s\n    {\"name\": \"%s\", \"cache_size\": %u, "
+            "\"distribution\": \"%s\", \"response_bytes\": %zu, "
+            "\"iterations\": %lu, \"ns_per_op\": %.1f, "
+            "\"allocs_per_op\": %.2f, \"cache_misses_per_op\": ",
+            firstResult ? "" : ",", result->name, result->cacheSize,
+            result->distribution, result->responseBytes, result->iterations,
+            result->nsPerOp, result->allocsPerOp);
+    if (result->missesPerOp >= 0)
+        fprintf(jsonOut, "%.2f}", result->missesPerOp);
+    else
+        fprintf(jsonOut, "null}");
+    fflush(jsonOut);
+    firstResult = 0;
+
+    if (result->cacheSize)
+        fprintf(stderr, "[microbench] %-18s size=%-6u %-8s %12.1f ns/op\n",
+                result->name, result->cacheSize, result->distribution,
+                result->nsPerOp);
+    else
+        fprintf(stderr, "[microbench] %-18s bytes=%-14zu %12.1f ns/op\n",
+                result->name, result->responseBytes, result->nsPerOp);
+}
+
+// Function  : makeKeys
+// Arguments : unsigned of count
+// Does      : builds count distinct absolute URLs shaped like real traffic
+// Returns   : char ** of keys
+char **
+makeKeys(unsigned count)
+{
+    char **keys;
+    char buffer[MAX_URL_LENGTH];
+    unsigned i;
+
+    keys = malloc(count * sizeof(char *));
+    for (i = 0; i < count; i++)
+    {
+        snprintf(buffer, sizeof(buffer),
+                 "http://www.example%u.com/static/assets/img/%u.png", i % 7, i);
+        keys[i] = strdup(buffer);
+    }
+
+    return keys;
+}
+
+// Function  : freeKeys
+// Arguments : char ** of keys and unsigned of count
+// Does      : frees keys from makeKeys()
+// Returns   : nothing
+void
+freeKeys(char **keys, unsigned count)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++) free(keys[i]);
+    free(keys);
+}
+
+// Function  : makeSchedule
+// Arguments : unsigned of schedule length, unsigned of key universe, and
+//             const char * of distribution ("uniform" or "zipf")
+// Does      : precomputes which key each operation touches, so sampling
+//             costs stay out of the timed region
+// Returns   : unsigned * of key indices
+unsigned *
+makeSchedule(unsigned count, unsigned universe, const char *distribution)
+{
+    unsigned *schedule;
+    double *cdf, sum = 0, u;
+    unsigned i, lo, hi, mid;
+
+    schedule = malloc(count * sizeof(unsigned));
+
+    if (strcmp(distribution, "zipf") != 0)
+    {
+        for (i = 0; i < count; i++) schedule[i] = rand_r(&rngState) % universe;
+        return schedule;
+    }
+
+    cdf = malloc(universe * sizeof(double));
+    for (i = 0; i < universe; i++)
+    {
+        sum += 1.0 / pow(i + 1.0, 0.99);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < count; i++)
+    {
+        u = (double)rand_r(&rngState) / ((double)RAND_MAX + 1) * sum;
+        lo = 0;
+        hi = universe - 1;
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1;
+            else hi = mid;
+        }
+        schedule[i] = lo;
+    }
+    free(cdf);
+
+    return schedule;
+}
+
+// Function  : makeResponse
+// Arguments : size_t of body size and size_t * to receive the total size
+// Does      : builds a null-terminated origin response with a max-age
+// Returns   : char * of response
+char *
+makeResponse(size_t bodySize, size_t *size)
+{
+    char *response;
+    int header;
+
+    response = malloc(bodySize + 256);
+    header = sprintf(response, "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: image/png\r\n"
+                     "Cache-Control: max-age=3600\r\n"
+                     "Content-Length: %zu\r\n\r\n", bodySize);
+    memset(response + header, 'x', bodySize);
+    response[header + bodySize] = 0;
+    *size = header + bodySize;
+
+    return response;
+}
+
+// Function  : fillCache
+// Arguments : Cache * of cache, char ** of keys, unsigned of count, and the
+//             response to store under each key
+// Does      : inserts the first count keys
+// Returns   : nothing
+void
+fillCache(Cache *cache, char **keys, unsigned count, char *response,
+          ssize_t responseSize)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++)
+        putIntoCache(cache, keys[i], NULL, response, responseSize);
+}
+
+// Function  : benchHashKey
+// Arguments : unsigned of cache size and const char * of distribution
+// Does      : times hashKey() over the cache's key population
+// Returns   : nothing
+void
+benchHashKey(unsigned cacheSize, const char *distribution)
+{
+    Result result = { "hashKey", cacheSize, distribution, 0, 0 };
+    char **keys = makeKeys(cacheSize);
+    unsigned *schedule = makeSchedule(SCHEDULE_SIZE, cacheSize, distribution);
+    unsigned long allocations = 0, k = 0;
+    long long misses = 0;
+    volatile unsigned sink = 0;
+    struct timespec begin;
+    double ns = 0;
+    Sample sample;
+    unsigned i;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (timeLeft(&begin))
+    {
+        startSample(&sample);
+        for (i = 0; i < BATCH_SIZE * 16; i++, k++)
+            sink += hashKey(keys[schedule[k % SCHEDULE_SIZE]],
+                            cacheSize + cacheSize / 4 + 1);
+        stopSample(&sample, &ns, &allocations, &misses);
+        result.iterations += BATCH_SIZE * 16;
+    }
+    report(&result, ns, allocations, misses);
+
+    free(schedule);
+    freeKeys(keys, cacheSize);
+}
+
+// Function  : benchGetFromCache
+// Arguments : unsigned of cache size, const char * of distribution, and int
+//             of whether lookups should hit
+// Does      : times getFromCache() on a full cache, either for cached keys
+//             picked by the distribution or for keys that are never cached
+// Returns   : nothing
+void
+benchGetFromCache(unsigned cacheSize, const char *distribution, int hit)
+{
+    Result result = { hit ? "getFromCache" : "getFromCache_miss", cacheSize,
+                      distribution, 0, 0 };
+    char **keys = makeKeys(cacheSize * 2);
+    unsigned *schedule = makeSchedule(SCHEDULE_SIZE, cacheSize, distribution);
+    unsigned long allocations = 0, k = 0;
+    long long misses = 0;
+    size_t responseSize;
+    char *response = makeResponse(SAMPLE_BODY_SIZE, &responseSize);
+    char *out = malloc(responseSize + 256);
+    Cache *cache = createCache(cacheSize);
+    struct timespec begin;
+    double ns = 0;
+    Sample sample;
+    unsigned i;
+
+    result.responseBytes = responseSize;
+    fillCache(cache, keys, cacheSize, response, responseSize);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (timeLeft(&begin))
+    {
+        startSample(&sample);
+        for (i = 0; i < BATCH_SIZE; i++, k++)
+            getFromCache(cache, keys[schedule[k % SCHEDULE_SIZE] +
+                                     (hit ? 0 : cacheSize)], NULL, out);
+        stopSample(&sample, &ns, &allocations, &misses);
+        result.iterations += BATCH_SIZE;
+    }
+    report(&result, ns, allocations, misses);
+
+    deleteCache(cache);
+    free(out);
+    free(response);
+    free(schedule);
+    freeKeys(keys, cacheSize * 2);
+}
+
+// Function  : benchPutIntoCache
+// Arguments : unsigned of cache size
+// Does      : times putIntoCache() of new keys into a full cache, so every
+//             insert also evicts the least recently used block
+// Returns   : nothing
+void
+benchPutIntoCache(unsigned cacheSize)
+{
+    Result result = { "putIntoCache", cacheSize, "-", 0, 0 };
+    unsigned universe = cacheSize * 4 > SCHEDULE_SIZE ? cacheSize * 4 :
+                        SCHEDULE_SIZE;
+    char **keys = makeKeys(universe);
+    unsigned long allocations = 0, k = 0;
+    long long misses = 0;
+    size_t responseSize;
+    char *response = makeResponse(SAMPLE_BODY_SIZE, &responseSize);
+    Cache *cache = createCache(cacheSize);
+    struct timespec begin;
+    double ns = 0;
+    Sample sample;
+    unsigned i;
+
+    result.responseBytes = responseSize;
+    fillCache(cache, keys, cacheSize, response, responseSize);
+    k = cacheSize;
+
+    // Keys cycle through a universe at least 4x the capacity, so a key has
+    // always been evicted before it is inserted again
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (timeLeft(&begin))
+    {
+        startSample(&sample);
+        for (i = 0; i < BATCH_SIZE; i++, k++)
+            putIntoCache(cache, keys[k % universe], NULL, response,
+                         responseSize);
+        stopSample(&sample, &ns, &allocations, &misses);
+        result.iterations += BATCH_SIZE;
+    }
+    report(&result, ns, allocations, misses);
+
+    deleteCache(cache);
+    free(response);
+    freeKeys(keys, universe);
+}
+
+// Function  : benchRemoveCacheBlock
+// Arguments : unsigned of cache size
+// Does      : fills the cache (untimed), then times removing every block in
+//             random order
+// Returns   : nothing
+void
+benchRemoveCacheBlock(unsigned cacheSize)
+{
+    Result result = { "removeCacheBlock", cacheSize, "uniform", 0, 0 };
+    char **keys = makeKeys(cacheSize);
+    CacheBlock **blocks = malloc(cacheSize * sizeof(CacheBlock *));
+    unsigned long allocations = 0;
+    long long misses = 0;
+    size_t responseSize;
+    char *response = makeResponse(SAMPLE_BODY_SIZE, &responseSize);
+    Cache *cache = createCache(cacheSize);
+    CacheBlock *curr, *swap;
+    struct timespec begin;
+    double ns = 0;
+    Sample sample;
+    unsigned i, j;
+
+    result.responseBytes = responseSize;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (timeLeft(&begin))
+    {
+        fillCache(cache, keys, cacheSize, response, responseSize);
+        for (curr = cache->mru, i = 0; curr; curr = curr->lessRU, i++)
+            blocks[i] = curr;
+        for (i = cacheSize - 1; i > 0; i--)
+        {
+            j = rand_r(&rngState) % (i + 1);
+            swap = blocks[i];
+            blocks[i] = blocks[j];
+            blocks[j] = swap;
+        }
+
+        startSample(&sample);
+        for (i = 0; i < cacheSize; i++) removeCacheBlock(cache, blocks[i]);
+        stopSample(&sample, &ns, &allocations, &misses);
+        result.iterations += cacheSize;
+    }
+    report(&result, ns, allocations, misses);
+
+    deleteCache(cache);
+    free(response);
+    free(blocks);
+    freeKeys(keys, cacheSize);
+}
+
+// Function  : benchAddAgeField
+// Arguments : size_t of response body size
+// Does      : times addAgeField() on a fresh copy of a cached response, the
+//             way getFromCache() uses it
+// Returns   : nothing
+void
+benchAddAgeField(size_t bodySize)
+{
+    Result result = { "addAgeField", 0, "-", 0, 0 };
+    unsigned long allocations = 0;
+    long long misses = 0;
+    size_t responseSize;
+    char *response = makeResponse(bodySize, &responseSize);
+    char *out = malloc(responseSize + 256);
+    struct timespec begin;
+    double ns = 0;
+    Sample sample;
+    unsigned i;
+
+    result.responseBytes = responseSize;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (timeLeft(&begin))
+    {
+        startSample(&sample);
+        for (i = 0; i < BATCH_SIZE; i++)
+        {
+            memcpy(out, response, responseSize);
+            addAgeField(out, responseSize, 42);
+        }
+        stopSample(&sample, &ns, &allocations, &misses);
+        result.iterations += BATCH_SIZE;
+    }
+    report(&result, ns, allocations, misses);
+
+    free(out);
+    free(response);
+}
+
+// Function  : benchParseRequest
+// Arguments : nothing
+// Does      : times parseRequest() on a typical browser GET
+// Returns   : nothing
+void
+benchParseRequest()
+{
+    Result result = { "parseRequest", 0, "-", 0, 0 };
+    char request[] =
+        "GET http://www.example.com/static/assets/img/logo.png HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101"
+        " Firefox/120.0\r\n"
+        "Accept: image/avif,image/webp,*/*\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Connection: keep-alive\r\n"
+        "Referer: http://www.example.com/\r\n"
+        "Cookie: session=0123456789abcdef; theme=dark\r\n"
+        "Cache-Control: max-age=0\r\n\r\n";
+    unsigned long allocations = 0;
+    long long misses = 0;
+    char *method, *key, *host;
+    struct timespec begin;
+    double ns = 0;
+    Sample sample;
+    unsigned i;
+
+    result.responseBytes = sizeof(request) - 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while (timeLeft(&begin))
+    {
+        startSample(&sample);
+        for (i = 0; i < BATCH_SIZE; i++)
+            free(parseRequest(request, &method, &key, &host));
+        stopSample(&sample, &ns, &allocations, &misses);
+        result.iterations += BATCH_SIZE;
+    }
+    report(&result, ns, allocations, misses);
+}
+
+// Function  : timeLeft
+// Arguments : struct timespec * of when the case started
+// Does      : checks the case against its time budget
+// Returns   : int, nonzero while the case should keep running
+int
+timeLeft(struct timespec *begin)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - begin->tv_sec) * 1000 +
+           (now.tv_nsec - begin->tv_nsec) / 1000000 < budgetMs;
+}
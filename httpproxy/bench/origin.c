@@ -0,0 +1,303 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// A stand-in origin server for benchmarking httpproxy offline. Every path is
+// a valid object; its size is derived from the path so repeated requests for
+// the same URL get byte-identical responses. Connections are served one per
+// thread and closed after the response, like the origins httpproxy expects.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+typedef struct
+{
+    unsigned port;
+    long minSize;     // smallest object body in bytes
+    long maxSize;     // largest object body in bytes
+    long maxAge;      // Cache-Control max-age, negative to omit the header
+    long latencyMs;   // artificial delay before each response
+    long jitterMs;    // uniform random extra delay on top of latencyMs
+    char *vary;       // Vary field value to send, NULL to omit the header
+} OriginConfig;
+
+void parseArguments(int argc, char **argv, OriginConfig *config);
+void *serveConnection(void *arg);
+long objectSize(const char *path);
+unsigned long hashPath(const char *path);
+void sleepMs(long ms);
+
+#define BACKLOG_SIZE 1024
+#define MAX_REQUEST_SIZE 8192
+#define STATS_PATH "/__stats"
+#define RESET_PATH "/__reset"
+
+static OriginConfig config;
+static unsigned long servedObjects; // updated with __atomic builtins
+static char *body; // shared filler for all object bodies
+
+int
+main(int argc, char **argv)
+{
+    int sockfd, client_sockfd, one = 1;
+    struct sockaddr_in addr;
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    parseArguments(argc, argv, &config);
+    signal(SIGPIPE, SIG_IGN);
+
+    body = malloc(config.maxSize);
+    memset(body, 'x', config.maxSize);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0)
+    {
+        fprintf(stderr, "[origin] Failed to create socket\n");
+        exit(EXIT_FAILURE);
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    bzero((char *) &addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(config.port);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sockfd, BACKLOG_SIZE) < 0)
+    {
+        fprintf(stderr, "[origin] Failed to listen on port %u\n", config.port);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (;;)
+    {
+        client_sockfd = accept(sockfd, NULL, NULL);
+        if (client_sockfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "[origin] accept() failed, errno %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        setsockopt(client_sockfd, IPPROTO_TCP, TCP_NODELAY, &one,
+                   sizeof(one));
+        if (pthread_create(&thread, &attr, serveConnection,
+                           (void *)(long)client_sockfd) != 0)
+            close(client_sockfd);
+    }
+
+    return 0;
+}
+
+// Function  : parseArguments
+// Arguments : int of argc, char ** of argv, and OriginConfig * to fill in
+// Does      : 1) applies defaults
+//             2) overrides them with -p port, -s size, -S max size,
+//                -m max-age, -l latency (ms), -j jitter (ms) and -v Vary
+//                field value
+// Returns   : nothing
+void
+parseArguments(int argc, char **argv, OriginConfig *config)
+{
+    int opt;
+
+    config->port = 18080;
+    config->minSize = 4096;
+    config->maxSize = 0;
+    config->maxAge = 3600;
+    config->latencyMs = 0;
+    config->jitterMs = 0;
+    config->vary = NULL;
+
+    while ((opt = getopt(argc, argv, "p:s:S:m:l:j:v:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': config->port = strtoul(optarg, NULL, 10); break;
+            case 's': config->minSize = strtol(optarg, NULL, 10); break;
+            case 'S': config->maxSize = strtol(optarg, NULL, 10); break;
+            case 'm': config->maxAge = strtol(optarg, NULL, 10); break;
+            case 'l': config->latencyMs = strtol(optarg, NULL, 10); break;
+            case 'j': config->jitterMs = strtol(optarg, NULL, 10); break;
+            case 'v': config->vary = optarg; break;
+            default:
+                fprintf(stderr, "[origin] Usage: %s [-p port] [-s size] "
+                        "[-S max size] [-m max-age|-1] [-l latency ms] "
+                        "[-j jitter ms] [-v vary]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config->minSize < 0) config->minSize = 0;
+    if (config->maxSize < config->minSize) config->maxSize = config->minSize;
+    if (config->maxSize == 0) config->maxSize = 1;
+}
+
+// Function  : serveConnection
+// Arguments : void * carrying the client socket file descriptor
+// Does      : 1) reads one request (absolute or origin-form target)
+//             2) answers the stats endpoints, or waits out the artificial
+//                latency and sends the object
+//             3) closes the connection
+// Returns   : NULL
+void *
+serveConnection(void *arg)
+{
+    int sockfd = (int)(long)arg;
+    char request[MAX_REQUEST_SIZE + 1];
+    char header[512];
+    char *path, *end;
+    ssize_t request_size = 0, read_size;
+    long size, delay;
+    int header_size;
+    unsigned seed;
+
+    // Read until the end of the request header
+    while (request_size < MAX_REQUEST_SIZE &&
+           (read_size = read(sockfd, request + request_size,
+                             MAX_REQUEST_SIZE - request_size)) > 0)
+    {
+        request_size += read_size;
+        request[request_size] = 0;
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+    request[request_size] = 0;
+
+    // Request target, with any scheme and authority stripped
+    path = strchr(request, ' ');
+    if (!path)
+    {
+        close(sockfd);
+        return NULL;
+    }
+    path++;
+    if (strncmp(path, "http://", 7) == 0)
+    {
+        path = strchr(path + 7, '/');
+        if (!path) path = "/";
+    }
+    end = path + strcspn(path, " \r\n");
+    *end = 0;
+
+    if (strcmp(path, STATS_PATH) == 0 || strcmp(path, RESET_PATH) == 0)
+    {
+        char stats[64];
+        unsigned long served;
+
+        if (strcmp(path, RESET_PATH) == 0)
+            served = __atomic_exchange_n(&servedObjects, 0, __ATOMIC_RELAXED);
+        else
+            served = __atomic_load_n(&servedObjects, __ATOMIC_RELAXED);
+        size = snprintf(stats, sizeof(stats), "%lu\n", served);
+        header_size = snprintf(header, sizeof(header),
+                               "HTTP/1.1 200 OK\r\n"
+                               "Cache-Control: max-age=0\r\n"
+                               "Content-Length: %ld\r\n"
+                               "Connection: close\r\n\r\n", size);
+        write(sockfd, header, header_size);
+        write(sockfd, stats, size);
+        close(sockfd);
+        return NULL;
+    }
+
+    __atomic_add_fetch(&servedObjects, 1, __ATOMIC_RELAXED);
+
+    delay = config.latencyMs;
+    if (config.jitterMs > 0)
+    {
+        seed = (unsigned)time(NULL) ^ (unsigned)sockfd ^
+               (unsigned)hashPath(path);
+        delay += rand_r(&seed) % (config.jitterMs + 1);
+    }
+    if (delay > 0) sleepMs(delay);
+
+    size = objectSize(path);
+    header_size = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n");
+    if (config.maxAge >= 0)
+        header_size += snprintf(header + header_size,
+                                sizeof(header) - header_size,
+                                "Cache-Control: max-age=%ld\r\n",
+                                config.maxAge);
+    if (config.vary)
+        header_size += snprintf(header + header_size,
+                                sizeof(header) - header_size,
+                                "Vary: %s\r\n", config.vary);
+    header_size += snprintf(header + header_size, sizeof(header) - header_size,
+                            "Content-Length: %ld\r\n"
+                            "Connection: close\r\n\r\n", size);
+
+    if (write(sockfd, header, header_size) == header_size)
+    {
+        ssize_t offset = 0, write_size;
+
+        while (offset < size &&
+               (write_size = write(sockfd, body + offset, size - offset)) > 0)
+            offset += write_size;
+    }
+
+    close(sockfd);
+    return NULL;
+}
+
+// Function  : objectSize
+// Arguments : const char * of path
+// Does      : picks a body size in [minSize, maxSize] that is stable per path,
+//             spread log-uniformly so small objects dominate like real sites
+// Returns   : long of body size in bytes
+long
+objectSize(const char *path)
+{
+    double ratio, fraction;
+
+    if (config.maxSize == config.minSize || config.minSize == 0)
+        return config.minSize ? config.minSize : config.maxSize;
+
+    ratio = (double)config.maxSize / (double)config.minSize;
+    fraction = (double)(hashPath(path) % 10000) / 10000.0;
+
+    return (long)(config.minSize * pow(ratio, fraction));
+}
+
+// Function  : hashPath
+// Arguments : const char * of path
+// Does      : FNV-1a hash of the path
+// Returns   : unsigned long of hash
+unsigned long
+hashPath(const char *path)
+{
+    unsigned long hashval = 14695981039346656037UL;
+
+    for (; *path; path++)
+    {
+        hashval ^= (unsigned char)*path;
+        hashval *= 1099511628211UL;
+    }
+
+    return hashval;
+}
+
+// Function  : sleepMs
+// Arguments : long of milliseconds
+// Does      : sleeps for the given time, resuming after signals
+// Returns   : nothing
+void
+sleepMs(long ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
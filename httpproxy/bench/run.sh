@@ -0,0 +1,178 @@
+#!/bin/bash
+#
+# Runs httpproxy against the stand-in origin and reports throughput, hit ratio,
+# origin fetches and latency percentiles for a closed-loop and an open-loop
+# run. With CLUSTER=n, n proxies share one cache with --cluster, and two more
+# runs bracket them: the same proxies without --cluster, to compare origin load
+# and hit ratio against, and the cluster with one peer down, to exercise the
+# fallback to the origin. Everything stays on the loopback interface. Knobs are
+# taken from the environment:
+#
+#    ORIGIN_PORT, PROXY_PORT  - ports to use (18080, 18081); a cluster takes
+#                               PROXY_PORT and the ports after it
+#    CLUSTER                  - proxies to run (1)
+#    PEER_FAULT               - how the cluster loses a peer: kill it, or stop
+#                               it so it hangs past --peer-timeout (kill)
+#    OBJECTS, ZIPF            - URL population and popularity skew (1000, 0.99)
+#    SIZE, MAX_SIZE           - object body size range in bytes (4096, 65536)
+#    MAX_AGE                  - origin Cache-Control max-age, -1 to omit (3600)
+#    LATENCY, JITTER          - origin delay per response in ms (2, 0)
+#    CONNECTIONS              - closed-loop concurrency (8)
+#    RATE, WORKERS            - open-loop offered load and worker count (200, 64)
+#    DURATION                 - seconds per run (10)
+#    PROXY_ARGS               - extra httpproxy options, e.g. "-b io_uring"
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+ORIGIN_PORT=${ORIGIN_PORT:-18080}
+PROXY_PORT=${PROXY_PORT:-18081}
+OBJECTS=${OBJECTS:-1000}
+ZIPF=${ZIPF:-0.99}
+SIZE=${SIZE:-4096}
+MAX_SIZE=${MAX_SIZE:-65536}
+MAX_AGE=${MAX_AGE:-3600}
+LATENCY=${LATENCY:-2}
+JITTER=${JITTER:-0}
+CONNECTIONS=${CONNECTIONS:-8}
+RATE=${RATE:-200}
+WORKERS=${WORKERS:-64}
+PROXY_ARGS=${PROXY_ARGS:-}
+DURATION=${DURATION:-10}
+CLUSTER=${CLUSTER:-1}
+PEER_FAULT=${PEER_FAULT:-kill}
+
+PORTS=""
+NODES=""
+for i in $(seq 0 $((CLUSTER - 1))); do
+    PORTS="$PORTS $((PROXY_PORT + i))"
+    NODES="$NODES${NODES:+,}127.0.0.1:$((PROXY_PORT + i))"
+done
+
+waitForPort()
+{
+    i=0
+    # Look for the listener rather than connecting to it, so the proxy
+    # never sees a probe connection
+    hex=$(printf ':%04X 0+:0000 0A' "$1")
+    while ! grep -Eqs "$hex" /proc/net/tcp /proc/net/tcp6; do
+        i=$((i + 1))
+        if [ $i -gt 50 ]; then
+            echo "[bench] Port $1 never came up" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+waitForPortClosed()
+{
+    i=0
+    # An io_uring proxy's listener outlives the process until the kernel
+    # has torn the ring down
+    hex=$(printf ':%04X 0+:0000 0A' "$1")
+    while grep -Eqs "$hex" /proc/net/tcp /proc/net/tcp6; do
+        i=$((i + 1))
+        if [ $i -gt 50 ]; then
+            echo "[bench] Port $1 never closed" >&2
+            exit 1
+        fi
+        sleep 0.1
+    done
+}
+
+# Starts a proxy on each port, as one cluster unless $1 is "independent"
+startProxies()
+{
+    PROXY_PIDS=""
+    for port in $PORTS; do
+        if [ "$CLUSTER" -gt 1 ] && [ "$1" != independent ]; then
+            # shellcheck disable=SC2086 # PROXY_ARGS is a list of options
+            ./httpproxy $PROXY_ARGS -C "$NODES" -I "127.0.0.1:$port" "$port" \
+                > /dev/null &
+        else
+            # shellcheck disable=SC2086
+            ./httpproxy $PROXY_ARGS "$port" > /dev/null &
+        fi
+        PROXY_PIDS="$PROXY_PIDS $!"
+    done
+    for port in $PORTS; do waitForPort "$port"; done
+}
+
+stopProxies()
+{
+    # shellcheck disable=SC2086 # PROXY_PIDS is a list
+    kill $PROXY_PIDS 2>/dev/null
+    # A stopped peer only acts on the signal once it runs again
+    # shellcheck disable=SC2086
+    kill -CONT $PROXY_PIDS 2>/dev/null
+    for pid in $PROXY_PIDS; do wait "$pid" 2>/dev/null; done
+    for port in $PORTS; do waitForPortClosed "$port"; done
+    PROXY_PIDS=""
+}
+
+cleanup()
+{
+    status=$?
+    # shellcheck disable=SC2086 # PROXY_PIDS is a list
+    kill $PROXY_PIDS "$ORIGIN_PID" 2>/dev/null
+    # shellcheck disable=SC2086
+    kill -CONT $PROXY_PIDS 2>/dev/null
+    wait 2>/dev/null
+    exit $status
+}
+trap cleanup EXIT INT TERM
+
+./bench/origin -p "$ORIGIN_PORT" -s "$SIZE" -S "$MAX_SIZE" -m "$MAX_AGE" \
+               -l "$LATENCY" -j "$JITTER" &
+ORIGIN_PID=$!
+
+LOADGEN="./bench/loadgen -o 127.0.0.1:$ORIGIN_PORT -n $OBJECTS -z $ZIPF \
+         -d $DURATION"
+waitForPort "$ORIGIN_PORT"
+
+RUNS="closed open"
+if [ "$CLUSTER" -gt 1 ]; then
+    RUNS="independent closed open failover"
+fi
+
+# Each run starts from cold proxies so the runs are comparable
+for MODE in $RUNS; do
+    startProxies "$MODE"
+    TARGETS=$(echo "$PORTS" | sed 's/ \([0-9]*\)/,127.0.0.1:\1/g; s/^,//')
+
+    case $MODE in
+        independent)
+            echo "[bench] closed-loop run over $CLUSTER independent" \
+                 "proxies, ${DURATION}s" ;;
+        failover)
+            # The last proxy stays in every --cluster list, so the others
+            # keep forwarding its share of URLs to it until they see it fail
+            DOWN=${PROXY_PIDS##* }
+            if [ "$PEER_FAULT" = stop ]; then
+                kill -STOP "$DOWN"
+            else
+                kill "$DOWN"
+                wait "$DOWN" 2>/dev/null
+            fi
+            TARGETS=${TARGETS%,*}
+            echo "[bench] closed-loop run over a $CLUSTER-proxy cluster with" \
+                 "port $((PROXY_PORT + CLUSTER - 1)) down (${PEER_FAULT})," \
+                 "${DURATION}s" ;;
+        *)
+            if [ "$CLUSTER" -gt 1 ]; then
+                echo "[bench] $MODE-loop run over a $CLUSTER-proxy cluster," \
+                     "${DURATION}s"
+            else
+                echo "[bench] $MODE-loop run, ${DURATION}s"
+            fi ;;
+    esac
+
+    if [ "$MODE" = open ]; then
+        $LOADGEN -x "$TARGETS" -c "$WORKERS" -r "$RATE" || exit 1
+    else
+        $LOADGEN -x "$TARGETS" -c "$CONNECTIONS" || exit 1
+    fi
+
+    stopProxies
+done
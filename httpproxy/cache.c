@@ -0,0 +1,516 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+
+#define _GNU_SOURCE // memmem()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "httpproxy.h"
+
+// Function  : createCache
+// Arguments : unsigned of capacity, the maximum number of blocks
+// Does      : 1) initializes and allocates a cache for the proxy, with about
+//                1.3 hash buckets per block
+//             2) returns the pointer to the cache
+// Returns   : Cache * of cache
+Cache *
+createCache(unsigned capacity)
+{
+    Cache *cache;
+    unsigned i;
+
+    cache = (Cache *)malloc(sizeof(Cache));
+    cache->lru = NULL;
+    cache->mru = NULL;
+    cache->capacity = capacity;
+    cache->hashSize = capacity + capacity / 4 + 1; // 13 buckets for 10 blocks
+    cache->hashMap = (CacheBlock **)malloc(cache->hashSize *
+                                           sizeof(CacheBlock *));
+    cache->numBlocks = 0;
+    cache->bytes = 0;
+    cache->maxBytes = cache->byteLimit = DEFAULT_CACHE_BYTES;
+    cache->errorTtl = DEFAULT_ERROR_TTL;
+    cache->numFailures = 0;
+
+    for (i = 0; i < cache->hashSize; i++) cache->hashMap[i] = NULL;
+    cache->trie = calloc(1, sizeof(TrieNode));
+    cache->hosts = calloc(cache->hashSize, sizeof(HostList *));
+    for (i = 0; i < FAILURE_HASH_SIZE; i++) cache->failures[i] = NULL;
+
+    return cache;
+}
+
+// Function  : deleteCache
+// Arguments : Cache * of cache
+// Does      : 1) deallocates memory in cache
+// Returns   : nothing
+void
+deleteCache(Cache *cache)
+{
+    CacheBlock *curr, *prev;
+    HostFailure *failure, *next;
+    unsigned i;
+
+    curr = cache->mru;
+    while (curr)
+    {
+        prev = curr;
+        curr = curr->lessRU;
+        free(prev->key);
+        free(prev->value);
+        free(prev->vary);
+        free(prev->variant);
+        free(prev);
+    }
+
+    for (i = 0; i < FAILURE_HASH_SIZE; i++)
+    {
+        for (failure = cache->failures[i]; failure; failure = next)
+        {
+            next = failure->next;
+            free(failure->target);
+            free(failure);
+        }
+    }
+
+    deleteIndex(cache);
+    free(cache->hashMap);
+    free(cache);
+}
+
+// Function  : putIntoCache
+// Arguments : Cache * of cache, char * of key, char * of the request that
+//             fetched the response (or NULL), char * of response, and ssize_t
+//             of response_size
+// Does      : 1) Hashes the key
+//             2) Replaces the variant this request selects, if cached
+//             3) Puts the key-response pair in an appropriate place in cache,
+//                with the Vary field and the request's variant of it
+//             4) Responses with "Vary: *" are not cached
+//             5) 404 and 410 responses are kept for at most cache->errorTtl
+//                seconds, and not at all when it is 0
+// Returns   : nothing
+void
+putIntoCache(Cache *cache, char *key, char *request, char *response,
+             ssize_t response_size)
+{
+    CacheBlock *newBlock, *currBlock;
+    char *cacheControl, *token, *end, *vary;
+    size_t varyLength, cacheControlLength;
+    long maxAge = DEFAULT_MAXAGE;
+    int status;
+
+    vary = findKnownHeader(response, HEADER_VARY, &varyLength);
+    if (vary && varyLength == 1 && *vary == '*')
+    {
+        printf("[httpproxy] Not caching key %s with Vary: *\n", key);
+        return;
+    }
+
+    // Find max age among the directives, which are case-insensitive
+    cacheControl = findKnownHeader(response, HEADER_CACHE_CONTROL,
+                                   &cacheControlLength);
+    if (cacheControl)
+    {
+        end = cacheControl + cacheControlLength;
+        for (token = cacheControl; token < end; token++)
+        {
+            token += strspn(token, " \t,");
+            if (end - token > 8 && strncasecmp(token, "max-age=", 8) == 0)
+            {
+                maxAge = strtol(token + 8, NULL, 10);
+                break;
+            }
+            token += strcspn(token, ",\r\n");
+        }
+    }
+
+    // Broken links are remembered, but only briefly
+    status = responseStatus(response);
+    if (status == 404 || status == 410)
+    {
+        if (maxAge > cache->errorTtl) maxAge = cache->errorTtl;
+        if (maxAge <= 0)
+        {
+            printf("[httpproxy] Not caching key %s with status %d\n", key,
+                   status);
+            return;
+        }
+    }
+
+    if ((size_t)response_size > cache->byteLimit)
+    {
+        printf("[httpproxy] Not caching key %s over the cache's byte limit\n",
+               key);
+        return;
+    }
+
+    printf("[httpproxy] Caching key %s into cache\n", key);
+
+    currBlock = findCacheBlock(cache, key, request);
+    if (currBlock) removeCacheBlock(cache, currBlock);
+
+    newBlock = malloc(sizeof(*newBlock));
+    newBlock->key = malloc(strlen(key) + 1);
+    memcpy(newBlock->key, key, strlen(key) + 1);
+    newBlock->value = malloc(response_size);
+    memcpy(newBlock->value, response, response_size);
+    newBlock->size = response_size;
+    newBlock->production = time(NULL);
+    newBlock->expiration = newBlock->production + (time_t)maxAge;
+    newBlock->vary = NULL;
+    newBlock->variant = NULL;
+    if (vary)
+    {
+        newBlock->vary = strndup(vary, varyLength);
+        newBlock->variant = buildVariant(request, newBlock->vary);
+    }
+
+    linkCacheBlock(cache, newBlock);
+}
+
+// Function  : linkCacheBlock
+// Arguments : Cache * of cache, and CacheBlock * of a filled in block
+// Does      : 1) makes room if the cache is full, or the block would take it
+//                over its byte limit, purging stale blocks and then LRU ones;
+//                past a lowered limit, only as much as the block takes, and
+//                trimCache() evicts the rest in batches
+//             2) links the block in as the MRU, into its hash chain and into
+//                the purge indexes
+// Returns   : nothing
+void
+linkCacheBlock(Cache *cache, CacheBlock *newBlock)
+{
+    CacheBlock *currBlock;
+    size_t before = cache->bytes;
+    unsigned hash;
+
+    if (cache->numBlocks == cache->capacity ||
+        cache->bytes + newBlock->size > cache->byteLimit)
+    {
+        organizeCache(cache);
+        while (cache->lru && // If none (or not enough) were stale
+               (cache->numBlocks == cache->capacity ||
+                (cache->bytes + newBlock->size > cache->byteLimit &&
+                 cache->bytes + newBlock->size > before)))
+            removeCacheBlock(cache, cache->lru);
+    }
+
+    // Recent usage linked list operations
+    newBlock->moreRU = NULL; // New block is always the MRU
+    newBlock->lessRU = cache->mru;
+    if (!cache->lru) cache->lru = newBlock;
+    if (cache->mru) cache->mru->moreRU = newBlock;
+    cache->mru = newBlock;
+
+    // Hash map operations
+    hash = hashKey(newBlock->key, cache->hashSize);
+    currBlock = cache->hashMap[hash];
+    if (currBlock) // If there's something already in hash at position hash
+    {
+        while (currBlock->hmNext) currBlock = currBlock->hmNext;
+        currBlock->hmNext = newBlock;
+        newBlock->hmPrev = currBlock;
+    }
+    else // If there's nothing at hashed yet
+    {
+        cache->hashMap[hash] = newBlock;
+        newBlock->hmPrev = NULL;
+    }
+    newBlock->hmNext = NULL; // New block always at the end of a hash chaining
+
+    // Trie and host list, for purging
+    indexCacheBlock(cache, newBlock);
+
+    cache->numBlocks++;
+    cache->bytes += newBlock->size;
+}
+
+// Function  : getFromCache
+// Arguments : Cache * of cache, char * of key, char * of request (or NULL),
+//             and char * of response
+// Does      : 1) Searches HTTP response in cache for the given key and the
+//                variant the request selects
+//             2) If found, inserts "Age" field to the HTTP header
+//             2) returns/fills in the response with the corresponding response
+// Returns   : ssize_t of response size
+ssize_t
+getFromCache(Cache *cache, char *key, char *request, char *response)
+{
+    CacheBlock *curr;
+    time_t age;
+    ssize_t response_size;
+
+    organizeCache(cache);
+
+    curr = findCacheBlock(cache, key, request);
+    if (!curr) return 0;
+
+    response_size = curr->size;
+    memcpy(response, curr->value, response_size);
+    age = time(NULL) - curr->production;
+
+    // Add age field
+    response_size = addAgeField(response, response_size, age);
+
+    printf("[httpproxy] Retrieving cache with key %s\n", key);
+
+    // Update recent usage linked list
+    if (curr != cache->mru)
+    {
+        if (curr == cache->lru)cache->lru = curr->moreRU;
+        if (curr->moreRU) curr->moreRU->lessRU = curr->lessRU;
+        if (curr->lessRU) curr->lessRU->moreRU = curr->moreRU;
+        curr->moreRU = NULL;
+        curr->lessRU = cache->mru;
+        cache->mru->moreRU = curr;
+        cache->mru = curr;
+    }
+
+    return response_size;
+}
+
+// Function  : findCacheBlock
+// Arguments : Cache * of cache, char * of key, and char * of request (or NULL)
+// Does      : walks the key's hash chain for the block whose variant the
+//             request selects; blocks without Vary match any request
+// Returns   : CacheBlock * of the block, or NULL
+CacheBlock *
+findCacheBlock(Cache *cache, char *key, char *request)
+{
+    CacheBlock *curr;
+    char *variant;
+    int match;
+
+    for (curr = cache->hashMap[hashKey(key, cache->hashSize)]; curr;
+         curr = curr->hmNext)
+    {
+        if (strcmp(key, curr->key) != 0) continue;
+        if (!curr->vary) return curr;
+
+        variant = buildVariant(request, curr->vary);
+        match = strcmp(variant, curr->variant) == 0;
+        free(variant);
+        if (match) return curr;
+    }
+
+    return NULL;
+}
+
+// Function  : organizeCache
+// Arguments : Cache * of cache
+// Does      : 1) removes stale cache block
+// Returns   : nothing
+void
+organizeCache(Cache *cache)
+{
+    CacheBlock *curr, *next;
+
+    printf("[httpproxy] Organizing cache...\n");
+
+    curr = cache->mru;
+    while (curr)
+    {
+        next = curr->lessRU;
+
+        if (curr->expiration < time(NULL)) // if stale
+        {
+            removeCacheBlock(cache, curr);
+        }
+
+        curr = next;
+    }
+}
+
+// Function  : removeCacheBlock
+// Arguments : Cache * of cache, CacheBlock * of block that needs to be deleted
+// Does      : 1) This function is called when space needs to be cleared up
+//             2) removes any stale cache block
+//             3) if it's still full, remove the LRU block
+// Returns   : nothing
+void
+removeCacheBlock(Cache *cache, CacheBlock *block)
+{
+    unsigned hash;
+
+    printf("[httpproxy] Removing stale cache with key %s\n", block->key);
+
+    // Recent usage linked list operation: remove
+    if (block == cache->mru) cache->mru = block->lessRU;
+    if (block == cache->lru) cache->lru = block->moreRU;
+    if (block->moreRU) block->moreRU->lessRU = block->lessRU;
+    if (block->lessRU) block->lessRU->moreRU = block->moreRU;
+
+    // Hash map chaining operation: remove
+    hash = hashKey(block->key, cache->hashSize);
+    if (block == cache->hashMap[hash]) cache->hashMap[hash] = block->hmNext;
+    if (block->hmPrev) block->hmPrev->hmNext = block->hmNext;
+    if (block->hmNext) block->hmNext->hmPrev = block->hmPrev;
+
+    unindexCacheBlock(cache, block);
+
+    free(block->key);
+    free(block->value);
+    free(block->vary);
+    free(block->variant);
+    cache->bytes -= block->size;
+    free(block);
+    cache->numBlocks--;
+
+    printf("[httpproxy] Done removing cache block\n");
+}
+
+// Function  : trimCache
+// Arguments : Cache * of cache, and unsigned of most blocks to remove
+// Does      : removes LRU blocks while the cache is over its byte limit
+// Returns   : unsigned of number of blocks removed
+unsigned
+trimCache(Cache *cache, unsigned maxBlocks)
+{
+    unsigned count = 0;
+
+    while (cache->lru && cache->bytes > cache->byteLimit && count < maxBlocks)
+    {
+        removeCacheBlock(cache, cache->lru);
+        count++;
+    }
+
+    return count;
+}
+
+// Function  : printCache
+// Arguments : Cache * of cache, char * of key, and char * of response
+// Does      : 1) Searches the cache for the key
+//             2) returns/fills in the response with the corresponding response
+// Returns   : nothing
+void
+printCache(Cache *cache)
+{
+    CacheBlock *curr, *prev;
+    unsigned counter = 0;
+
+    curr = cache->mru;
+    while (curr)
+    {
+        prev = curr;
+        curr = curr->lessRU;
+        printf("[httpproxy] Cache Block %d\n", counter);
+        printf("[httpproxy]         Key: %s\n", prev->key);
+        printf("[httpproxy]         Size: %ld\n", prev->size);
+        printf("[httpproxy]         Production: %d\n", prev->production);
+        printf("[httpproxy]         Expiration: %d\n", prev->expiration);
+        counter++;
+
+        if (counter > cache->capacity)
+        {
+            printf("[httpproxy] Cache size violated!\n");
+            break;
+        }
+    }
+}
+
+// Function  : putHostFailure
+// Arguments : Cache * of cache, char * of the host:port target, const char *
+//             of the error message to answer with, and long of ttl in seconds
+// Does      : 1) remembers that the target could not be resolved or reached,
+//                so requests for it fail fast instead of repeating the lookup
+//                and connects
+//             2) does nothing when ttl is 0, or when the table is full of
+//                entries that are still fresh
+// Returns   : nothing
+void
+putHostFailure(Cache *cache, char *target, const char *message, long ttl)
+{
+    HostFailure *failure, **link;
+    time_t now = time(NULL);
+    unsigned i;
+
+    if (ttl <= 0) return;
+
+    failure = getHostFailure(cache, target);
+    if (!failure)
+    {
+        // Make room by dropping whatever has expired
+        for (i = 0; cache->numFailures >= MAX_HOST_FAILURES &&
+                    i < FAILURE_HASH_SIZE; i++)
+        {
+            link = &cache->failures[i];
+            while (*link)
+            {
+                failure = *link;
+                if (failure->expiration > now)
+                {
+                    link = &failure->next;
+                    continue;
+                }
+                *link = failure->next;
+                free(failure->target);
+                free(failure);
+                cache->numFailures--;
+            }
+        }
+        if (cache->numFailures >= MAX_HOST_FAILURES) return;
+
+        i = hashKey(target, FAILURE_HASH_SIZE);
+        failure = malloc(sizeof(*failure));
+        failure->target = strdup(target);
+        failure->next = cache->failures[i];
+        cache->failures[i] = failure;
+        cache->numFailures++;
+    }
+
+    failure->message = message;
+    failure->expiration = now + (time_t)ttl;
+    printf("[httpproxy] Remembering failure of %s for %lds\n", target, ttl);
+}
+
+// Function  : getHostFailure
+// Arguments : Cache * of cache, and char * of the host:port target
+// Does      : 1) walks the target's bucket, dropping expired entries
+//             2) returns the entry for the target, if one is still fresh
+// Returns   : HostFailure * of the entry, or NULL
+HostFailure *
+getHostFailure(Cache *cache, char *target)
+{
+    HostFailure *failure, **link;
+    time_t now = time(NULL);
+
+    link = &cache->failures[hashKey(target, FAILURE_HASH_SIZE)];
+    while (*link)
+    {
+        failure = *link;
+        if (failure->expiration <= now)
+        {
+            *link = failure->next;
+            free(failure->target);
+            free(failure);
+            cache->numFailures--;
+            continue;
+        }
+        if (strcmp(failure->target, target) == 0) return failure;
+        link = &failure->next;
+    }
+
+    return NULL;
+}
+
+// Function  : hashKey
+// Arguments : char * of a string key, and unsigned of number of buckets
+// Does      : 1) hashes the string key into an integer index
+// Returns   : unsigned of hashed value
+// Reference : The C Programming Language (Kernighan & Ritchie), Section 6.6
+unsigned
+hashKey(char *key, unsigned hashSize)
+{
+    unsigned hashval;
+
+    for (hashval = 0; *key != '\0'; key++)
+        hashval = *key + 31 * hashval;
+
+    return hashval % hashSize;
+}
@@ -0,0 +1,214 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Peer cache cluster. Every node is given the same member list
+// (--cluster) and its own name in it (--node). Each cache key is owned by one
+// member, chosen by rendezvous hashing, so every node agrees on the owner and
+// only the keys of a member that joins or leaves move. On a local miss for a
+// key owned elsewhere, the request goes to the owner, marked with PEER_HEADER
+// so the owner serves it from its cache or the origin and never forwards it
+// again. Peer responses are not cached locally, so the cluster holds one copy
+// of each object and its capacity grows with the number of nodes.
+//
+// A peer gets config->peerTimeout to connect and to start answering. If it
+// fails, times out or sheds the request (503 or 429), it is skipped for
+// PEER_RETRY_INTERVAL seconds and the request goes to the origin directly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "httpproxy.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static uint64_t scoreNode(char *node, char *key);
+
+// Function  : loadCluster
+// Arguments : Config * of configuration, and char * of a comma-separated
+//             list of <host>:<port> members
+// Does      : 1) splits the list, spelling each member the way
+//                Connection.target does so every node hashes the same names
+//             2) checks that config->self names one of them
+// Returns   : 0 on success, -1 if a member is malformed or self is missing
+int
+loadCluster(Config *config, char *list)
+{
+    char hostname[MAX_HOST_LENGTH], node[MAX_HOST_LENGTH];
+    char *copy, *member, *savePtr;
+    long port;
+    unsigned i;
+    int found = 0;
+
+    copy = strdup(list);
+    for (member = strtok_r(copy, ",", &savePtr); member;
+         member = strtok_r(NULL, ",", &savePtr))
+    {
+        if (splitHostPort(member, hostname, sizeof(hostname), &port,
+                          DEFAULT_PORT) < 0)
+        {
+            fprintf(stderr, "[httpproxy] Malformed cluster member %s\n",
+                    member);
+            free(copy);
+            return -1;
+        }
+        snprintf(node, sizeof(node), strchr(hostname, ':') ? "[%s]:%ld" :
+                 "%s:%ld", hostname, port);
+
+        config->nodes = realloc(config->nodes,
+                                (config->numNodes + 1) * sizeof(char *));
+        config->nodes[config->numNodes++] = strdup(node);
+    }
+    free(copy);
+
+    // Likewise for this node's own name
+    if (config->self &&
+        splitHostPort(config->self, hostname, sizeof(hostname), &port,
+                      DEFAULT_PORT) == 0)
+    {
+        snprintf(node, sizeof(node), strchr(hostname, ':') ? "[%s]:%ld" :
+                 "%s:%ld", hostname, port);
+        for (i = 0; i < config->numNodes && !found; i++)
+        {
+            if (strcmp(config->nodes[i], node) != 0) continue;
+            config->self = config->nodes[i];
+            found = 1;
+        }
+    }
+    if (!found)
+    {
+        fprintf(stderr, "[httpproxy] --node must name a member of the "
+                "cluster\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Function  : choosePeer
+// Arguments : Proxy * of proxy, and char * of a cache key
+// Does      : ranks the members by rendezvous score for the key, skipping
+//             peers that failed recently
+// Returns   : char * of the peer that owns the key, or NULL if this node
+//             does (or clustering is off)
+char *
+choosePeer(Proxy *proxy, char *key)
+{
+    Config *config = proxy->config;
+    char *owner = NULL;
+    uint64_t score, best = 0;
+    unsigned i;
+
+    for (i = 0; i < config->numNodes; i++)
+    {
+        if (config->nodes[i] != config->self &&
+            getHostFailure(proxy->cache, config->nodes[i]))
+            continue;
+
+        score = scoreNode(config->nodes[i], key);
+        if (!owner || score > best)
+        {
+            owner = config->nodes[i];
+            best = score;
+        }
+    }
+
+    return owner == config->self ? NULL : owner;
+}
+
+// Function  : forwardToPeer
+// Arguments : Proxy * of proxy, Connection * of connection, and char * of
+//             the peer that owns its key
+// Does      : marks the request as coming from a peer and sends it there in
+//             place of the origin
+// Returns   : nothing
+void
+forwardToPeer(Proxy *proxy, Connection *conn, char *peer)
+{
+    char *line;
+    size_t headerLength;
+
+    // Insert "<PEER_HEADER>: <self>" right after the request line
+    headerLength = strlen(PEER_HEADER) + 2 + strlen(proxy->config->self) + 2;
+    conn->request = realloc(conn->request,
+                            conn->requestSize + headerLength + 1);
+    line = strstr(conn->request, "\r\n") + 2;
+    memmove(line + headerLength, line,
+            conn->request + conn->requestSize - line + 1);
+    memcpy(line, PEER_HEADER ": ", strlen(PEER_HEADER) + 2);
+    memcpy(line + strlen(PEER_HEADER) + 2, proxy->config->self,
+           strlen(proxy->config->self));
+    memcpy(line + headerLength - 2, "\r\n", 2);
+    conn->requestSize += headerLength;
+
+    printf("[httpproxy] Asking peer %s for %s\n", peer, conn->cacheKey);
+    conn->peer = peer;
+    queryServer(proxy, conn, peer, DEFAULT_PORT);
+}
+
+// Function  : peerFailed
+// Arguments : Proxy * of proxy, and Connection * of a connection whose peer
+//             could not answer
+// Does      : 1) skips the peer for PEER_RETRY_INTERVAL seconds
+//             2) takes the marker back out of the request and sends it to
+//                the origin instead
+// Returns   : nothing
+void
+peerFailed(Proxy *proxy, Connection *conn)
+{
+    int mark;
+
+    fprintf(stderr, "[httpproxy] Peer %s failed for %s, going to the origin\n",
+            conn->peer, conn->cacheKey);
+
+    // Refreshing an existing entry would keep the peer out for good
+    if (!getHostFailure(proxy->cache, conn->peer))
+        putHostFailure(proxy->cache, conn->peer, CONNECTION_FAIL,
+                       PEER_RETRY_INTERVAL);
+
+    closeUpstream(proxy, conn);
+    free(conn->addresses);
+    free(conn->attemptFds);
+    conn->addresses = NULL;
+    conn->attemptFds = NULL;
+    conn->numAddresses = conn->nextAddress = conn->numAttempts = 0;
+    conn->nextAttemptAt = 0;
+    conn->connectDeadline = conn->firstByteDeadline = conn->totalDeadline = 0;
+    conn->requestSent = 0;
+    conn->responseSize = 0;
+    conn->peer = NULL;
+
+    // Traces show the origin's phases; the peer's time counts as lookup
+    for (mark = MARK_RESOLVED; mark <= MARK_RESPONSE_READ; mark++)
+        conn->marks[mark] = 0;
+
+    removeHeader(conn->request, &conn->requestSize, PEER_HEADER);
+    queryServer(proxy, conn, conn->host, DEFAULT_PORT);
+}
+
+// Function  : scoreNode
+// Arguments : char * of a member, and char * of a cache key
+// Does      : hashes the member and key together with 64-bit FNV-1a, then
+//             mixes the bits (the splitmix64 finalizer) so that similar keys
+//             spread evenly
+// Returns   : uint64_t of the member's score for the key
+static uint64_t
+scoreNode(char *node, char *key)
+{
+    uint64_t hash = FNV_OFFSET;
+
+    for (; *node; node++) hash = (hash ^ (unsigned char)*node) * FNV_PRIME;
+    hash = (hash ^ '/') * FNV_PRIME;
+    for (; *key; key++) hash = (hash ^ (unsigned char)*key) * FNV_PRIME;
+
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+
+    return hash;
+}
@@ -0,0 +1,379 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Zero-downtime restarts. A proxy started with --handoff <path> listens on
+// that Unix socket. The next proxy started with the same path connects to it
+// first and, instead of binding the port itself:
+//   1) receives the listening socket with SCM_RIGHTS, so clients keep being
+//      queued by the kernel throughout the restart
+//   2) optionally receives a snapshot of the cache, so it starts warm
+// The old process then stops accepting, finishes the connections it has
+// within config->drainTimeout, and exits. The transfer is done with blocking
+// I/O on a local socket; the old process's clients wait for it, but only
+// while the cache is copied.
+
+#define _GNU_SOURCE // accept4()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "httpproxy.h"
+
+#define HANDOFF_IO_TIMEOUT 5 // seconds a blocked handoff read or write waits
+
+// One cached block in a snapshot, followed by its key, value, vary and
+// variant bytes. A record with keyLength 0 ends the snapshot.
+typedef struct
+{
+    uint32_t keyLength, varyLength, variantLength;
+    int64_t size, production, expiration;
+} SnapshotRecord;
+
+static int fillAddress(char *path, struct sockaddr_un *addr);
+static int writeAll(int fd, void *buffer, size_t size);
+static int readAll(int fd, void *buffer, size_t size);
+static void writeSnapshot(Cache *cache, int fd);
+static unsigned readSnapshot(Cache *cache, int fd);
+
+// Function  : receiveHandoff
+// Arguments : char * of the handoff socket path, Cache * of cache, and int of
+//             whether to take the cache over too
+// Does      : 1) connects to a running proxy's handoff socket
+//             2) asks for the listener, and the cache if wanted
+//             3) receives the listening socket, then the cache snapshot
+// Returns   : int of the listening socket, or -1 if no proxy is running
+//             there or the handoff failed, in which case the caller opens
+//             its own
+int
+receiveHandoff(char *path, Cache *cache, int wantCache)
+{
+    struct sockaddr_un addr;
+    struct timeval timeout = { HANDOFF_IO_TIMEOUT, 0 };
+    struct msghdr message;
+    struct cmsghdr *control;
+    struct iovec iov;
+    char controlBuffer[CMSG_SPACE(sizeof(int))];
+    char request = wantCache ? 'C' : 'L';
+    uint32_t port;
+    int sockfd, listenFd = -1;
+    unsigned restored;
+
+    if (fillAddress(path, &addr) < 0) return -1;
+
+    sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return -1;
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (writeAll(sockfd, &request, 1) < 0)
+    {
+        fprintf(stderr, "[httpproxy] Failed to ask %s for a handoff\n", path);
+        close(sockfd);
+        return -1;
+    }
+
+    // The port rides along as the data the descriptor is attached to
+    bzero((char *) &message, sizeof(message));
+    iov.iov_base = &port;
+    iov.iov_len = sizeof(port);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = controlBuffer;
+    message.msg_controllen = sizeof(controlBuffer);
+    if (recvmsg(sockfd, &message, MSG_CMSG_CLOEXEC) == sizeof(port))
+    {
+        control = CMSG_FIRSTHDR(&message);
+        if (control && control->cmsg_level == SOL_SOCKET &&
+            control->cmsg_type == SCM_RIGHTS)
+            memcpy(&listenFd, CMSG_DATA(control), sizeof(int));
+    }
+    if (listenFd < 0)
+    {
+        fprintf(stderr, "[httpproxy] No listener came from %s\n", path);
+        close(sockfd);
+        return -1;
+    }
+    printf("[httpproxy] Took over the listener on port %u from %s\n", port,
+           path);
+
+    if (wantCache)
+    {
+        restored = readSnapshot(cache, sockfd);
+        printf("[httpproxy] Took over %u cache blocks\n", restored);
+    }
+
+    close(sockfd);
+
+    return listenFd;
+}
+
+// Function  : openControl
+// Arguments : char * of the handoff socket path
+// Does      : binds a non-blocking Unix socket at the path, replacing the
+//             one a previous process left, and listens on it
+// Returns   : int of the socket, or -1 on failure
+int
+openControl(char *path)
+{
+    struct sockaddr_un addr;
+    int sockfd;
+
+    if (fillAddress(path, &addr) < 0) return -1;
+
+    sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) return -1;
+
+    unlink(path);
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(sockfd, 1) < 0)
+    {
+        fprintf(stderr, "[httpproxy] Failed to open handoff socket %s, "
+                "errno %d\n", path, errno);
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+// Function  : serveHandoff
+// Arguments : Proxy * of proxy
+// Does      : when a new process connects to the handoff socket:
+//             1) sends it the listening socket, then the cache if asked
+//             2) stops accepting and closes the listener and the handoff
+//                socket, leaving the new process the only one accepting
+//             3) starts draining: queued prewarms are dropped, and the event
+//                loop ends once the open connections finish or the drain
+//                timeout passes
+// Returns   : nothing
+void
+serveHandoff(Proxy *proxy)
+{
+    struct timeval timeout = { HANDOFF_IO_TIMEOUT, 0 };
+    struct msghdr message;
+    struct cmsghdr *control;
+    struct iovec iov;
+    char controlBuffer[CMSG_SPACE(sizeof(int))];
+    char request;
+    uint32_t port = proxy->config->port;
+    int sockfd;
+
+    sockfd = accept4(proxy->controlFd, NULL, NULL, SOCK_CLOEXEC);
+    if (sockfd < 0) return;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (readAll(sockfd, &request, 1) < 0)
+    {
+        close(sockfd);
+        return;
+    }
+
+    bzero((char *) &message, sizeof(message));
+    bzero(controlBuffer, sizeof(controlBuffer));
+    iov.iov_base = &port;
+    iov.iov_len = sizeof(port);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = controlBuffer;
+    message.msg_controllen = sizeof(controlBuffer);
+    control = CMSG_FIRSTHDR(&message);
+    control->cmsg_level = SOL_SOCKET;
+    control->cmsg_type = SCM_RIGHTS;
+    control->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control), &proxy->listenFd, sizeof(int));
+    if (sendmsg(sockfd, &message, MSG_NOSIGNAL) != sizeof(port))
+    {
+        fprintf(stderr, "[httpproxy] Failed to hand the listener over, "
+                "errno %d\n", errno);
+        close(sockfd);
+        return;
+    }
+
+    if (request == 'C') writeSnapshot(proxy->cache, sockfd);
+    close(sockfd);
+
+    // The new process accepts from here on
+    if (proxy->uring)
+        stopUringAccept(proxy->uring);
+    else
+        unwatchFd(proxy, proxy->listenFd);
+    unwatchFd(proxy, proxy->controlFd);
+    close(proxy->listenFd);
+    proxy->listenFd = -1;
+    close(proxy->controlFd);
+    proxy->controlFd = -1;
+
+    for (; proxy->nextPrewarm < proxy->numPrewarm; proxy->nextPrewarm++)
+        free(proxy->prewarmUrls[proxy->nextPrewarm]);
+    proxy->nextPrewarm = proxy->numPrewarm = 0;
+
+    proxy->draining = 1;
+    proxy->drainDeadline = nowMs() + proxy->config->drainTimeout * 1000;
+    printf("[httpproxy] Handed the listener over; draining %u connections\n",
+           proxy->numClients + proxy->activePrewarm);
+}
+
+// Function  : fillAddress
+// Arguments : char * of a socket path, and struct sockaddr_un * to fill in
+// Does      : copies the path into the address
+// Returns   : 0 on success, -1 if the path is too long
+static int
+fillAddress(char *path, struct sockaddr_un *addr)
+{
+    bzero((char *) addr, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "[httpproxy] Handoff socket path %s is too long\n",
+                path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+
+    return 0;
+}
+
+// Function  : writeAll, readAll
+// Arguments : int of a blocking socket, void * of buffer, and size_t of size
+// Does      : writes or reads exactly size bytes, retrying short transfers
+// Returns   : 0 on success, -1 on error, timeout or end of file
+static int
+writeAll(int fd, void *buffer, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0)
+    {
+        n = send(fd, buffer, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buffer = (char *)buffer + n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static int
+readAll(int fd, void *buffer, size_t size)
+{
+    ssize_t n;
+
+    while (size > 0)
+    {
+        n = recv(fd, buffer, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buffer = (char *)buffer + n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+// Function  : writeSnapshot
+// Arguments : Cache * of cache, and int of a blocking socket
+// Does      : writes every fresh block from the LRU to the MRU, so that
+//             adding them in order rebuilds the same recency order
+// Returns   : nothing
+static void
+writeSnapshot(Cache *cache, int fd)
+{
+    SnapshotRecord record;
+    CacheBlock *curr;
+
+    organizeCache(cache);
+
+    for (curr = cache->lru; curr; curr = curr->moreRU)
+    {
+        record.keyLength = strlen(curr->key);
+        record.varyLength = curr->vary ? strlen(curr->vary) : 0;
+        record.variantLength = curr->variant ? strlen(curr->variant) : 0;
+        record.size = curr->size;
+        record.production = curr->production;
+        record.expiration = curr->expiration;
+        if (writeAll(fd, &record, sizeof(record)) < 0 ||
+            writeAll(fd, curr->key, record.keyLength) < 0 ||
+            writeAll(fd, curr->value, curr->size) < 0 ||
+            writeAll(fd, curr->vary, record.varyLength) < 0 ||
+            writeAll(fd, curr->variant, record.variantLength) < 0)
+        {
+            fprintf(stderr, "[httpproxy] Failed to send the cache snapshot\n");
+            return;
+        }
+    }
+
+    bzero((char *) &record, sizeof(record));
+    writeAll(fd, &record, sizeof(record));
+}
+
+// Function  : readSnapshot
+// Arguments : Cache * of cache, and int of a blocking socket
+// Does      : adds the blocks of a snapshot to the cache, keeping their
+//             production and expiration times; stops at the end record, or
+//             at the first malformed or truncated one
+// Returns   : unsigned of number of blocks added
+static unsigned
+readSnapshot(Cache *cache, int fd)
+{
+    SnapshotRecord record;
+    CacheBlock *block;
+    unsigned restored = 0;
+
+    while (readAll(fd, &record, sizeof(record)) == 0 && record.keyLength)
+    {
+        if (record.keyLength > MAX_REQUEST_SIZE || record.size <= 0 ||
+            record.size > MAX_CONTENT_SIZE - RESPONSE_SLACK ||
+            record.varyLength > MAX_REQUEST_SIZE ||
+            record.variantLength > MAX_REQUEST_SIZE ||
+            (!record.varyLength && record.variantLength))
+        {
+            fprintf(stderr, "[httpproxy] Malformed cache snapshot\n");
+            break;
+        }
+
+        block = calloc(1, sizeof(CacheBlock));
+        block->key = calloc(record.keyLength + 1, 1);
+        block->value = malloc(record.size);
+        block->size = record.size;
+        block->production = (time_t)record.production;
+        block->expiration = (time_t)record.expiration;
+        if (record.varyLength)
+        {
+            block->vary = calloc(record.varyLength + 1, 1);
+            block->variant = calloc(record.variantLength + 1, 1);
+        }
+        if (readAll(fd, block->key, record.keyLength) < 0 ||
+            readAll(fd, block->value, record.size) < 0 ||
+            readAll(fd, block->vary, record.varyLength) < 0 ||
+            readAll(fd, block->variant, record.variantLength) < 0)
+        {
+            fprintf(stderr, "[httpproxy] Truncated cache snapshot\n");
+            free(block->key);
+            free(block->value);
+            free(block->vary);
+            free(block->variant);
+            free(block);
+            break;
+        }
+
+        linkCacheBlock(cache, block);
+        restored++;
+    }
+
+    return restored;
+}
@@ -0,0 +1,567 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+
+#define _GNU_SOURCE // strptime(), timegm()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "httpproxy.h"
+
+// Perfect hash of the known field names: no two share both their length and
+// their (lowercased) first letter, so one switch on the pair finds the only
+// candidate, and one comparison confirms it
+#define HEADER_KEY(length, first) ((length) << 8 | (first))
+
+static time_t parseHttpDate(const char *value, size_t length);
+
+static const char *headerNames[NUM_HEADERS] =
+{
+    [HEADER_AGE] = "Age",
+    [HEADER_CACHE_CONTROL] = "Cache-Control",
+    [HEADER_CONNECTION] = "Connection",
+    [HEADER_CONTENT_LENGTH] = "Content-Length",
+    [HEADER_DATE] = "Date",
+    [HEADER_ETAG] = "ETag",
+    [HEADER_EXPIRES] = "Expires",
+    [HEADER_HOST] = "Host",
+    [HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+    [HEADER_IF_NONE_MATCH] = "If-None-Match",
+    [HEADER_KEEP_ALIVE] = "Keep-Alive",
+    [HEADER_LAST_MODIFIED] = "Last-Modified",
+    [HEADER_PEER] = PEER_HEADER,
+    [HEADER_PROXY_CONNECTION] = "Proxy-Connection",
+    [HEADER_TE] = "TE",
+    [HEADER_TRAILER] = "Trailer",
+    [HEADER_TRANSFER_ENCODING] = "Transfer-Encoding",
+    [HEADER_UPGRADE] = "Upgrade",
+    [HEADER_VARY] = "Vary",
+};
+
+// Function  : classifyHeader
+// Arguments : const char * of a field name, not necessarily terminated, and
+//             size_t of its length
+// Does      : looks the name up case-insensitively among the known fields
+// Returns   : HeaderId of the field, or HEADER_UNKNOWN
+HeaderId
+classifyHeader(const char *name, size_t length)
+{
+    HeaderId id;
+
+    if (length == 0 || length > 0xff) return HEADER_UNKNOWN;
+
+    switch (HEADER_KEY(length, tolower((unsigned char)name[0])))
+    {
+        case HEADER_KEY(2, 't'): id = HEADER_TE; break;
+        case HEADER_KEY(3, 'a'): id = HEADER_AGE; break;
+        case HEADER_KEY(4, 'd'): id = HEADER_DATE; break;
+        case HEADER_KEY(4, 'e'): id = HEADER_ETAG; break;
+        case HEADER_KEY(4, 'h'): id = HEADER_HOST; break;
+        case HEADER_KEY(4, 'v'): id = HEADER_VARY; break;
+        case HEADER_KEY(7, 'e'): id = HEADER_EXPIRES; break;
+        case HEADER_KEY(7, 't'): id = HEADER_TRAILER; break;
+        case HEADER_KEY(7, 'u'): id = HEADER_UPGRADE; break;
+        case HEADER_KEY(10, 'c'): id = HEADER_CONNECTION; break;
+        case HEADER_KEY(10, 'k'): id = HEADER_KEEP_ALIVE; break;
+        case HEADER_KEY(13, 'c'): id = HEADER_CACHE_CONTROL; break;
+        case HEADER_KEY(13, 'i'): id = HEADER_IF_NONE_MATCH; break;
+        case HEADER_KEY(13, 'l'): id = HEADER_LAST_MODIFIED; break;
+        case HEADER_KEY(14, 'c'): id = HEADER_CONTENT_LENGTH; break;
+        case HEADER_KEY(16, 'p'): id = HEADER_PROXY_CONNECTION; break;
+        case HEADER_KEY(16, 'x'): id = HEADER_PEER; break;
+        case HEADER_KEY(17, 'i'): id = HEADER_IF_MODIFIED_SINCE; break;
+        case HEADER_KEY(17, 't'): id = HEADER_TRANSFER_ENCODING; break;
+        default: return HEADER_UNKNOWN;
+    }
+
+    return strncasecmp(name, headerNames[id], length) == 0 ? id :
+           HEADER_UNKNOWN;
+}
+
+// Function  : parseRequest
+// Arguments : char * of request, and char ** of method, key and host to fill
+//             in
+// Does      : 1) copies the request, since strtok_r manipulates the string
+//             2) points method and key at the first two tokens of the request
+//                line, and host at the Host field value (matched in any case)
+//                within the copy, or NULL if they are absent
+// Returns   : char * of the copy, which the caller frees after using the
+//             fields
+char *
+parseRequest(char *request, char **method, char **key, char **host)
+{
+    char *line, *str;
+    char *line_saveptr, *request_saveptr, *host_saveptr;
+    char line_delim[3] = "\r\n";
+    char token_delim[2] = " ";
+    size_t nameLength;
+
+    *method = NULL;
+    *key = NULL;
+    *host = NULL;
+
+    str = strdup(request);
+
+    // Request line, e.g. "GET http://host/path HTTP/1.1"
+    line = strtok_r(str, line_delim, &line_saveptr);
+    if (line)
+    {
+        *method = strtok_r(line, token_delim, &request_saveptr);
+        *key = strtok_r(NULL, token_delim, &request_saveptr);
+    }
+
+    for (line = strtok_r(NULL, line_delim, &line_saveptr); line;
+         line = strtok_r(NULL, line_delim, &line_saveptr))
+    {
+        nameLength = strcspn(line, ":");
+        if (line[nameLength] == ':' &&
+            classifyHeader(line, nameLength) == HEADER_HOST)
+            *host = strtok_r(line + nameLength + 1, " \t", &host_saveptr);
+    }
+
+    return str;
+}
+
+// Function  : splitHostPort
+// Arguments : char * of "<hostname>[:<port>]" or "[<IPv6 address>][:<port>]",
+//             char * and size_t of the buffer for the hostname, long * of
+//             port, and long of the port to assume when none is given
+// Does      : 1) copies the hostname part, without IPv6 brackets, into
+//                hostname
+//             2) parses the port, falling back to defaultPort
+// Returns   : 0 on success, -1 if the hostname is empty or does not fit
+int
+splitHostPort(char *hostport, char *hostname, size_t size, long *port,
+              long defaultPort)
+{
+    char *start, *end, *colon, *rest;
+    size_t length;
+
+    start = hostport;
+    if (*hostport == '[')
+    {
+        start = hostport + 1;
+        end = strchr(start, ']');
+        if (!end) return -1;
+        colon = end[1] == ':' ? end + 1 : NULL;
+        if (end[1] && !colon) return -1;
+    }
+    else
+    {
+        colon = strchr(hostport, ':');
+        end = colon ? colon : hostport + strlen(hostport);
+    }
+
+    length = end - start;
+    if (length == 0 || length >= size) return -1;
+
+    memcpy(hostname, start, length);
+    hostname[length] = 0;
+
+    *port = defaultPort;
+    if (colon && colon[1])
+    {
+        *port = strtol(colon + 1, &rest, 10);
+        if (*port <= 0 || *port > 65535) return -1;
+    }
+
+    return 0;
+}
+
+// Function  : normalizeKey
+// Arguments : char * of the GET request target, and char * of the Host header
+//             value
+// Does      : builds the cache key "http://<host>[:<port>]<path>" so that
+//             cosmetic differences do not split one object across entries:
+//             1) origin-form targets ("/path") are qualified with the Host
+//             2) scheme and host are lowercased and the default port dropped
+//             3) escapes of unreserved characters are decoded and the other
+//                escapes use uppercase hex (RFC 3986, section 6.2.2)
+//             4) an empty path becomes "/" and the fragment is dropped
+// Returns   : char * of the key, which the caller frees, or NULL if the
+//             target is neither absolute http:// nor origin-form
+char *
+normalizeKey(char *target, char *host)
+{
+    char *authority, *path, *key, *out;
+    size_t authorityLength, i;
+    int value;
+
+    if (strncasecmp(target, "http://", 7) == 0)
+    {
+        authority = target + 7;
+        authorityLength = strcspn(authority, "/?#");
+        path = authority + authorityLength;
+    }
+    else if (*target == '/' && host)
+    {
+        authority = host;
+        authorityLength = strlen(host);
+        path = target;
+    }
+    else
+        return NULL;
+
+    if (authorityLength == 0) return NULL;
+
+    key = malloc(7 + authorityLength + strlen(path) + 2);
+    memcpy(key, "http://", 7);
+    out = key + 7;
+
+    for (i = 0; i < authorityLength; i++)
+        *out++ = tolower((unsigned char)authority[i]);
+    if (out - key > 10 && strncmp(out - 3, ":80", 3) == 0) out -= 3;
+    else if (out[-1] == ':') out--;
+
+    if (*path != '/') *out++ = '/';
+    for (; *path && *path != '#'; path++)
+    {
+        if (*path == '%' && isxdigit((unsigned char)path[1]) &&
+            isxdigit((unsigned char)path[2]))
+        {
+            sscanf(path + 1, "%2x", &value);
+            if (isalnum(value) || (value != 0 && strchr("-._~", value)))
+                *out++ = value;
+            else
+            {
+                *out++ = '%';
+                *out++ = toupper((unsigned char)path[1]);
+                *out++ = toupper((unsigned char)path[2]);
+            }
+            path += 2;
+        }
+        else
+            *out++ = *path;
+    }
+    *out = 0;
+
+    return key;
+}
+
+// Function  : findHeader
+// Arguments : char * of an HTTP message, const char * of field name, and
+//             size_t * of value length to fill in
+// Does      : looks the field up case-insensitively within the header
+//             section, skipping the whitespace around its value; known fields
+//             are left to findKnownHeader()
+// Returns   : char * of the start of the value, or NULL if absent
+char *
+findHeader(char *message, const char *name, size_t *length)
+{
+    size_t nameLength = strlen(name);
+    char *line, *value;
+    HeaderId id;
+
+    if (!message) return NULL;
+
+    id = classifyHeader(name, nameLength);
+    if (id != HEADER_UNKNOWN) return findKnownHeader(message, id, length);
+
+    // line points at the CRLF ending the previous line
+    for (line = strstr(message, "\r\n"); line && line[2] && line[2] != '\r';
+         line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, name, nameLength) != 0 ||
+            line[2 + nameLength] != ':')
+            continue;
+
+        value = line + 2 + nameLength + 1;
+        while (*value == ' ' || *value == '\t') value++;
+        *length = strcspn(value, "\r\n");
+        while (*length && (value[*length - 1] == ' ' ||
+                           value[*length - 1] == '\t'))
+            (*length)--;
+        return value;
+    }
+
+    return NULL;
+}
+
+// Function  : findKnownHeader
+// Arguments : char * of an HTTP message, HeaderId of the field, and size_t *
+//             of value length to fill in
+// Does      : classifies each field name of the header section until one is
+//             the field, skipping the whitespace around its value
+// Returns   : char * of the start of the value, or NULL if absent
+char *
+findKnownHeader(char *message, HeaderId id, size_t *length)
+{
+    size_t nameLength;
+    char *line, *value;
+
+    if (!message) return NULL;
+
+    // line points at the CRLF ending the previous line
+    for (line = strstr(message, "\r\n"); line && line[2] && line[2] != '\r';
+         line = strstr(line + 2, "\r\n"))
+    {
+        nameLength = strcspn(line + 2, ":\r\n");
+        if (line[2 + nameLength] != ':' ||
+            classifyHeader(line + 2, nameLength) != id)
+            continue;
+
+        value = line + 2 + nameLength + 1;
+        while (*value == ' ' || *value == '\t') value++;
+        *length = strcspn(value, "\r\n");
+        while (*length && (value[*length - 1] == ' ' ||
+                           value[*length - 1] == '\t'))
+            (*length)--;
+        return value;
+    }
+
+    return NULL;
+}
+
+// Function  : buildVariant
+// Arguments : char * of request (or NULL), and char * of the response's Vary
+//             field value
+// Does      : collects the request's values of the fields Vary names, as one
+//             "name:value" line each, so two requests select the same variant
+//             exactly when their strings are equal
+// Returns   : char * of the variant string, which the caller frees
+char *
+buildVariant(char *request, char *vary)
+{
+    char name[MAX_HOST_LENGTH];
+    char *variant, *value;
+    size_t size = 0, capacity = 64, nameLength, valueLength, i;
+
+    variant = malloc(capacity);
+    while (*vary)
+    {
+        vary += strspn(vary, " \t,");
+        nameLength = strcspn(vary, " \t,");
+        if (nameLength == 0) break;
+        if (nameLength >= sizeof(name)) nameLength = sizeof(name) - 1;
+
+        for (i = 0; i < nameLength; i++)
+            name[i] = tolower((unsigned char)vary[i]);
+        name[nameLength] = 0;
+        vary += strcspn(vary, ",");
+
+        value = findHeader(request, name, &valueLength);
+        if (!value) valueLength = 0;
+
+        if (size + nameLength + valueLength + 3 > capacity)
+        {
+            capacity = 2 * (size + nameLength + valueLength + 3);
+            variant = realloc(variant, capacity);
+        }
+        size += sprintf(variant + size, "%s:%.*s\n", name, (int)valueLength,
+                        value ? value : "");
+    }
+    variant[size] = 0;
+
+    return variant;
+}
+
+// Function  : removeHeader
+// Arguments : char * of an HTTP message, ssize_t * of its size, and const
+//             char * of field name
+// Does      : cuts the first field with that name out of the header section,
+//             shifting the rest of the message down
+// Returns   : int of 1 if a field was removed, 0 if there was none
+int
+removeHeader(char *message, ssize_t *size, const char *name)
+{
+    char *value, *line, *end;
+    size_t length;
+
+    value = findHeader(message, name, &length);
+    if (!value) return 0;
+
+    for (line = value; line > message && line[-1] != '\n'; line--);
+    end = strstr(value, "\r\n");
+    if (!end) return 0;
+    end += 2;
+
+    memmove(line, end, message + *size - end);
+    *size -= end - line;
+    message[*size] = 0;
+
+    return 1;
+}
+
+// Function  : requestClose
+// Arguments : char * of an HTTP request in a buffer of MAX_REQUEST_SIZE + 1
+//             bytes, and ssize_t * of its size
+// Does      : replaces the request's Connection, Keep-Alive and
+//             Proxy-Connection fields with "Connection: close", right after
+//             the request line, so the server ends its response by closing
+// Returns   : int of 0, or -1 if the field doesn't fit
+int
+requestClose(char *request, ssize_t *size)
+{
+    static const char field[] = "Connection: close\r\n";
+    char *line;
+
+    while (removeHeader(request, size, "Connection"));
+    while (removeHeader(request, size, "Keep-Alive"));
+    while (removeHeader(request, size, "Proxy-Connection"));
+
+    line = strstr(request, "\r\n");
+    if (!line || *size + (ssize_t)sizeof(field) - 1 > MAX_REQUEST_SIZE)
+        return -1;
+    line += 2;
+
+    memmove(line + sizeof(field) - 1, line, request + *size - line + 1);
+    memcpy(line, field, sizeof(field) - 1);
+    *size += sizeof(field) - 1;
+
+    return 0;
+}
+
+// Function  : responseStatus
+// Arguments : char * of response
+// Does      : reads the status code from the status line, "HTTP/1.1 404 ..."
+// Returns   : int of the status code, or 0 if the status line is malformed
+int
+responseStatus(char *response)
+{
+    char *code;
+
+    if (strncmp(response, "HTTP/", 5) != 0) return 0;
+    code = strchr(response, ' ');
+    if (!code || !isdigit((unsigned char)code[1])) return 0;
+
+    return (int)strtol(code + 1, NULL, 10);
+}
+
+// Function  : notModified
+// Arguments : char * of the client's If-None-Match value (or NULL), char * of
+//             its If-Modified-Since value (or NULL), and char * of a complete
+//             response
+// Does      : evaluates the conditions against the response's validators
+//             (RFC 9110, section 13.2.2): If-None-Match by weak comparison
+//             with ETag, or else If-Modified-Since against Last-Modified
+// Returns   : int of 1 if the client's copy is current and a 304 will do
+int
+notModified(char *ifNoneMatch, char *ifModifiedSince, char *response)
+{
+    char *etag, *tag, *end;
+    size_t etagLength, length, weak;
+    time_t since, modified;
+
+    if (responseStatus(response) != 200) return 0;
+
+    if (ifNoneMatch)
+    {
+        etag = findKnownHeader(response, HEADER_ETAG, &etagLength);
+        if (!etag) return 0;
+        if (etagLength > 2 && strncmp(etag, "W/", 2) == 0)
+        {
+            etag += 2;
+            etagLength -= 2;
+        }
+
+        for (tag = ifNoneMatch; *tag; tag += weak + length)
+        {
+            tag += strspn(tag, " \t,");
+            if (*tag == '*') return 1;
+
+            // Entity tags are quoted and may hold commas
+            weak = strncmp(tag, "W/", 2) == 0 ? 2 : 0;
+            end = tag[weak] == '"' ? strchr(tag + weak + 1, '"') : NULL;
+            length = end ? (size_t)(end + 1 - (tag + weak)) :
+                     strcspn(tag + weak, ", \t");
+            if (length == etagLength &&
+                strncmp(tag + weak, etag, length) == 0)
+                return 1;
+        }
+        return 0;
+    }
+
+    if (ifModifiedSince)
+    {
+        tag = findKnownHeader(response, HEADER_LAST_MODIFIED, &length);
+        if (!tag) return 0;
+        modified = parseHttpDate(tag, length);
+        since = parseHttpDate(ifModifiedSince, strlen(ifModifiedSince));
+        return modified > 0 && since > 0 && modified <= since;
+    }
+
+    return 0;
+}
+
+// Function  : headerOnly
+// Arguments : char * of response, ssize_t of its size, and const char * of
+//             the status to put in its status line (e.g. "304 Not Modified"),
+//             or NULL to keep it
+// Does      : drops the body, keeping the status line and header section
+// Returns   : ssize_t of the new size
+ssize_t
+headerOnly(char *response, ssize_t size, const char *status)
+{
+    char *end, *code, *line;
+    size_t length;
+
+    end = strstr(response, "\r\n\r\n");
+    if (!end) return size;
+    size = end + 4 - response;
+
+    code = strchr(response, ' ');
+    line = strstr(response, "\r\n");
+    if (status && code && code < line)
+    {
+        code++;
+        length = strlen(status);
+        memmove(code + length, line, response + size - line);
+        memcpy(code, status, length);
+        size += (ssize_t)length - (line - code);
+    }
+    response[size] = 0;
+
+    return size;
+}
+
+// Function  : parseHttpDate
+// Arguments : const char * of an HTTP-date value, and size_t of its length
+// Does      : parses the preferred format, "Sun, 06 Nov 1994 08:49:37 GMT"
+// Returns   : time_t of the date, or 0 if malformed
+static time_t
+parseHttpDate(const char *value, size_t length)
+{
+    char date[64], *rest;
+    struct tm tm;
+
+    if (length >= sizeof(date)) return 0;
+    memcpy(date, value, length);
+    date[length] = 0;
+
+    memset(&tm, 0, sizeof(tm));
+    rest = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!rest || *rest) return 0;
+
+    return timegm(&tm);
+}
+
+// Function  : addAgeField
+// Arguments : char * of response, ssize_t of response_size, and time_t of age
+// Does      : 1) drops any Age field the response already has
+//             2) adds the age field right after the status line
+// Returns   : ssize_t of new response_size
+ssize_t
+addAgeField(char *response, ssize_t response_size, time_t age)
+{
+    char field[32], *line;
+    size_t length;
+
+    printf("[httpproxy] Adding age field\n");
+
+    removeHeader(response, &response_size, "Age");
+
+    line = strstr(response, "\r\n");
+    if (!line) return response_size;
+    line += 2;
+
+    length = sprintf(field, "Age: %ld\r\n", (long)age);
+    memmove(line + length, line, response + response_size - line);
+    memcpy(line, field, length);
+
+    return response_size + length;
+}
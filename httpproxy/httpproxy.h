@@ -0,0 +1,570 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Types, constants and prototypes shared by the httpproxy translation units:
+// main.c (startup), proxy.c (event loop and connection state machine),
+// uring.c (the optional io_uring backend), cache.c (the LRU cache), index.c
+// (the key trie and per-host lists used to purge it), http.c (HTTP message
+// handling), admission.c (overload protection), handoff.c (passing the
+// listener and cache to a new process), cluster.c (sharing the cache with
+// peer proxies), prewarm.c (fetching URLs into the cache ahead of traffic),
+// trace.c (per-request timing records), worker.c (worker processes placed on
+// CPUs and NUMA nodes), pressure.c (cache sizing under memory pressure) and
+// stream.c (streaming responses of unknown length).
+
+#ifndef HTTPPROXY_H
+#define HTTPPROXY_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#define MAX_URL_LENGTH 100
+#define MAX_CONTENT_SIZE 10000000 // 10MB
+#define MAX_REQUEST_SIZE 65536
+#define MAX_HOST_LENGTH 256
+#define RESPONSE_SLACK 256 // room left in response buffers for the Age field
+#define CACHE_SIZE 10
+#define DEFAULT_CACHE_BYTES (CACHE_SIZE * (size_t)MAX_CONTENT_SIZE)
+#define MIN_CACHE_BYTES MAX_CONTENT_SIZE // room for one object, even squeezed
+#define DEFAULT_PRESSURE_STALL 100 // ms of memory stalls per second
+#define PRESSURE_EVICT_BATCH 8     // blocks evicted per event loop iteration
+#define PRESSURE_CALM 30           // seconds without pressure before growing
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_MAX_CONNECTIONS 4096
+#define DEFAULT_CLIENT_BURST 20
+#define DEFAULT_QUEUE_DELAY_TARGET 200 // ms a client may wait to be accepted
+#define CLIENT_HASH_SIZE 1024
+#define MAX_CLIENT_BUCKETS 65536
+#define CONNECTION_FAIL "Failed to connect to the host\n"
+#define NO_SUCH_HOST "No such host indicated by the hostname\n"
+#define GATEWAY_TIMEOUT "504 Gateway Timeout"
+#define DEFAULT_PORT 80
+#define DEFAULT_TUNNEL_PORT 443
+#define DEFAULT_TUNNEL_IDLE_TIMEOUT 300 // seconds
+#define DEFAULT_ATTEMPT_DELAY 250 // ms between Happy Eyeballs connects
+#define DEFAULT_CONNECT_TIMEOUT 10000 // ms to establish the origin connection
+#define DEFAULT_FIRST_BYTE_TIMEOUT 30000 // ms from request sent to response
+#define DEFAULT_REQUEST_TIMEOUT 120000 // ms for the whole origin exchange
+#define DEFAULT_HEADER_TIMEOUT 10000 // ms for a client to send its header
+#define DEFAULT_SEND_TIMEOUT 30000 // ms a client may take no response bytes
+#define DEFAULT_PREWARM_CONCURRENCY 4
+#define MAX_PREWARM_QUEUE 10000 // URLs waiting to be prewarmed
+#define PREWARM_PATH "/__prewarm"
+#define PURGE_PATH "/__purge"
+#define ADMIN_HEADER "X-Httpproxy-Admin-Token"
+#define DEFAULT_DRAIN_TIMEOUT 30 // seconds an old process serves after handoff
+#define DEFAULT_PEER_TIMEOUT 2000 // ms for a peer to connect and to answer
+#define PEER_RETRY_INTERVAL 5 // seconds to skip a peer that failed
+#define PEER_HEADER "X-Httpproxy-Peer"
+#define DEFAULT_TRACE_SAMPLE 0.01 // fraction of requests traced
+#define DEFAULT_TRACE_THRESHOLD 1000 // ms; slower requests are always traced
+#define STREAM_READ_SIZE 65536 // bytes read from the origin at a time
+#define STREAM_HIGH_WATER 262144 // bytes queued for a client before pausing
+#define MAX_SERVING_SIZE 1000000
+#define DEFAULT_MAXAGE 3600
+#define DEFAULT_DNS_FAILURE_TTL 30 // seconds to remember a failed lookup
+#define DEFAULT_CONNECT_FAILURE_TTL 5 // seconds to remember a refused host
+#define DEFAULT_ERROR_TTL 60 // most seconds to cache a 404 or 410 response
+#define FAILURE_HASH_SIZE 64
+#define MAX_HOST_FAILURES 1024
+#define MAX_EVENTS 256
+#define RELAY_PIPE_SIZE 65536
+#define NO_TIMER ((unsigned)-1)
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 256 // provided receive buffers, a power of two
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+
+typedef struct CacheBlock
+{
+    char *key;
+    char *value;
+    ssize_t size;
+    time_t production;
+    time_t expiration;
+    char *vary;     // the response's Vary field value, NULL if absent
+    char *variant;  // buildVariant() of the request that fetched it
+    struct CacheBlock *moreRU, *lessRU; // For recent usage doubly linked list
+    struct CacheBlock *hmPrev, *hmNext; // For hashmap chaining
+    struct TrieNode *node;              // For the key trie
+    struct CacheBlock *trieNext;        //   (variants under one node)
+    struct HostList *hostList;          // For the per-host doubly linked list
+    struct CacheBlock *hostPrev, *hostNext;
+} CacheBlock;
+
+// Radix trie over cache keys. A node's key is the concatenation of the labels
+// from the root down to it, so every key under a prefix is in one subtree.
+typedef struct TrieNode
+{
+    char *label;
+    size_t labelLength;
+    struct TrieNode *parent;
+    struct TrieNode *children, *sibling; // children differ in first character
+    CacheBlock *blocks;                  // variants cached under this key
+} TrieNode;
+
+// Blocks cached for one hostname, whatever the port
+typedef struct HostList
+{
+    char *host;
+    CacheBlock *blocks;
+    struct HostList *next; // For hashmap chaining
+} HostList;
+
+// An origin that recently could not be resolved or connected to
+typedef struct HostFailure
+{
+    char *target;         // host:port, as in Connection.target
+    const char *message;  // NO_SUCH_HOST or CONNECTION_FAIL
+    time_t expiration;
+    struct HostFailure *next;
+} HostFailure;
+
+typedef struct
+{
+    CacheBlock *mru;
+    CacheBlock *lru;
+    CacheBlock **hashMap; // each hashMap[index] points to the head of chaining
+    unsigned numBlocks;
+    unsigned capacity;    // maximum number of blocks
+    size_t bytes;         // size of the responses held
+    size_t maxBytes;      // ceiling on bytes
+    size_t byteLimit;     // current limit on bytes, lowered under memory
+                          //   pressure
+    unsigned hashSize;    // number of hashMap (and hosts) buckets
+    TrieNode *trie;       // root of the key trie, with an empty label
+    HostList **hosts;     // per-host lists, hashed by hostname
+    long errorTtl;        // most seconds to keep 404 and 410 responses
+    HostFailure *failures[FAILURE_HASH_SIZE]; // negative entries by target
+    unsigned numFailures;
+} Cache;
+
+typedef struct
+{
+    unsigned port;
+    long tunnelIdleTimeout; // seconds a CONNECT tunnel may sit without traffic
+    long attemptDelay;      // ms before racing the next origin address
+    long connectTimeout;    // ms to connect to the origin
+    long firstByteTimeout;  // ms from request sent to first response byte
+    long requestTimeout;    // ms from connecting to the complete response
+    long headerTimeout;     // ms from accepting to the client's whole header
+    long sendTimeout;       // ms the client may go without taking any of
+                            //   the response
+    char *prewarmFile;      // manifest of URLs to prewarm, NULL for none
+    unsigned prewarmConcurrency; // prewarm fetches in flight at once
+    char *adminToken;       // opens the admin endpoints to clients beyond
+                            //   loopback that send it, NULL for none
+    int ioUring;            // try the io_uring backend instead of epoll
+    long dnsFailureTtl;     // seconds to answer a failed lookup from memory
+    long connectFailureTtl; // seconds to answer a refused host from memory
+    long errorTtl;          // most seconds to cache 404 and 410 responses
+    int backlog;            // listen() backlog
+    unsigned maxConnections;    // clients served at once, 0 for no limit
+    unsigned clientConnections; // per client address, 0 for no limit
+    double clientRate;      // connections per second per client address,
+    double clientBurst;     //   0 for no limit, and the bucket size
+    long queueDelayTarget;  // ms in the accept queue before shedding, 0 off
+    char *handoffPath;      // Unix socket for listener handoff, NULL for none
+    int handoffCache;       // also take the running process's cache over
+    long drainTimeout;      // seconds to finish old connections after handoff
+    char **nodes;           // cluster members as host:port, NULL for none
+    unsigned numNodes;
+    char *self;             // this node's entry in nodes
+    long peerTimeout;       // ms for a peer to connect, and to answer
+    unsigned cacheBlocks;   // most responses cached
+    size_t cacheBytes;      // most bytes cached, when memory allows
+    long pressureStall;     // ms per second of memory stalls that count as
+                            //   pressure, 0 to ignore pressure
+    char *tracePath;        // trace file, or unix:<path> of a datagram
+                            //   socket; NULL when not tracing
+    double traceSample;     // fraction of requests traced
+    long traceThreshold;    // ms; slower requests are traced as well
+    unsigned workers;       // processes serving the port
+    int *cpus;              // CPUs to pin workers to, in order; NULL for
+    unsigned numCpus;       //   the ones the proxy may run on
+    int adminFd;            // receives admin requests from the other
+                            //   workers, -1 with a single worker
+    int *workerFds;         // per worker, sends it admin requests; -1 for
+                            //   this one
+} Config;
+
+typedef enum
+{
+    READING_REQUEST,  // waiting for the client's request header
+    CONNECTING,       // non-blocking connect() to the origin in progress
+    WRITING_REQUEST,  // forwarding the request to the origin
+    READING_RESPONSE, // collecting the origin's response until it closes
+    WRITING_RESPONSE, // sending the response (or an error) to the client
+    STREAMING_RESPONSE, // passing on a response of unknown length as it
+                        //   arrives
+    TUNNELING         // relaying bytes both ways for CONNECT
+} ConnectionState;
+
+// Header fields the proxy acts on, as classifyHeader() tells them apart
+typedef enum
+{
+    HEADER_UNKNOWN,
+    HEADER_AGE,
+    HEADER_CACHE_CONTROL,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_DATE,
+    HEADER_ETAG,
+    HEADER_EXPIRES,
+    HEADER_HOST,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_KEEP_ALIVE,
+    HEADER_LAST_MODIFIED,
+    HEADER_PEER,            // PEER_HEADER
+    HEADER_PROXY_CONNECTION,
+    HEADER_TE,
+    HEADER_TRAILER,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_VARY,
+    NUM_HEADERS
+} HeaderId;
+
+// Boundaries in a request's life, timed in Connection.marks for traces
+typedef enum
+{
+    MARK_QUEUED,        // handshake completed, as the kernel reports it
+    MARK_ACCEPTED,
+    MARK_REQUEST_READ,  // the whole request header has arrived
+    MARK_PARSED,
+    MARK_CACHE_CHECKED,
+    MARK_RESOLVED,      // origin addresses known
+    MARK_CONNECTED,
+    MARK_REQUEST_SENT,
+    MARK_FIRST_BYTE,    // first response byte from upstream
+    MARK_RESPONSE_READ,
+    MARK_WRITING,       // started writing to the client
+    MARK_RESPONSE_SENT,
+    NUM_MARKS
+} TraceMark;
+
+// Where decodeStream() is in a chunked body
+typedef enum
+{
+    CHUNK_SIZE,     // reading a chunk-size line
+    CHUNK_DATA,     // passing on chunk data
+    CHUNK_DATA_END, // reading the CRLF after the data
+    CHUNK_TRAILER   // reading trailer lines up to the blank one
+} ChunkState;
+
+// A response being streamed to the client while it is collected for the
+// cache. conn->response holds only what is queued for the client.
+typedef struct
+{
+    int chunked;              // the origin frames the body in chunks
+    int reframe;              // the client gets chunks (HTTP/1.1)
+    int status;
+    ChunkState chunkState;
+    size_t chunkLeft;         // data bytes left in the current chunk
+    char line[32];            // line read so far, cut off at 31 bytes
+    size_t lineLength;
+    char *header;             // the header for the cache, without framing
+    ssize_t headerSize;       //   fields or the blank line
+    char *body;               // the decoded body for the cache, or NULL
+    size_t bodySize, bodyCapacity; //   once it is too large to cache
+    ssize_t flushed;          // bytes written to the client and dropped from
+                              //   conn->response
+} Stream;
+
+// Admission state for one client address: a token bucket refilled at
+// config->clientRate, and the number of its connections being served
+typedef struct ClientBucket
+{
+    unsigned char addr[16]; // IPv6, or IPv4-mapped IPv6
+    double tokens;
+    long long refilled;     // ms, monotonic
+    unsigned active;
+    struct ClientBucket *next; // For hashmap chaining
+} ClientBucket;
+
+// One resolved origin address
+typedef struct
+{
+    struct sockaddr_storage addr;
+    socklen_t length;
+} Address;
+
+// One direction of a CONNECT tunnel. Bytes move from the source socket into
+// the pipe and from the pipe into the destination socket with splice(), so
+// the payload never enters user space.
+typedef struct
+{
+    int pipe[2];              // pipe[0] read end, pipe[1] write end
+    size_t pending;           // bytes sitting in the pipe
+    int eof;                  // the source has shut down its sending side
+    int shut;                 // the destination has been shut down for writes
+    unsigned long long bytes; // bytes delivered to the destination
+} Relay;
+
+typedef struct
+{
+    int clientFd, upstreamFd;    // -1 when not open
+    unsigned clientEvents, upstreamEvents; // current epoll interest
+    ConnectionState state;
+    int tunnel;                  // CONNECT request: relay after the 200
+    int head;                    // HEAD request: send the header only
+    char *ifNoneMatch;           // the client's validators, taken out of the
+    char *ifModifiedSince;       //   request so upstream sends it all
+    int prewarm;                 // prewarm fetch, with no client (fd -1)
+    int framingChecked;          // the response's header was checked for
+    Stream *stream;              //   streaming; the stream, or NULL
+    ClientBucket *client;        // the client's admission state, or NULL
+    char *peer;                  // cluster member asked instead of the
+                                 //   origin, or NULL
+    char *request;
+    ssize_t requestSize, requestSent;
+    char *response;
+    ssize_t responseSize, responseSent;
+    char *parsed;                // parseRequest() copy that the fields below
+    char *method, *key, *host;   //   point into
+    char *cacheKey;              // normalizeKey() of a GET's target
+    char target[MAX_HOST_LENGTH]; // host:port being connected to
+    Address *addresses;          // origin addresses in Happy Eyeballs order
+    unsigned numAddresses, nextAddress;
+    int *attemptFds;             // connects in flight, -1 once finished
+    unsigned numAttempts;        //   (one slot per started address)
+    long long nextAttemptAt;     // ms, monotonic; 0 when no attempt is due
+    long long connectDeadline;   // ms, monotonic; per-phase origin deadlines,
+    long long firstByteDeadline; //   0 when the phase is not under way
+    long long totalDeadline;
+    long long headerDeadline;    // ms, monotonic; for the client's header
+    Relay up, down;              // client to origin, origin to client
+    long long started;           // ms, monotonic
+    long long lastActivity;      // ms, monotonic
+    long long deadline;          // ms, monotonic; valid while timerIndex set
+    unsigned timerIndex;         // position in the timer heap, or NO_TIMER
+    long long marks[NUM_MARKS];  // us, monotonic; 0 for boundaries not
+                                 //   reached
+    const char *source;          // what answered, for traces
+} Connection;
+
+// io_uring completions, as waitUring() hands them to the event loop
+typedef enum
+{
+    URING_ACCEPT, // fd is a new client
+    URING_POLL,   // fd is ready; res holds the poll events
+    URING_RECV    // res bytes (or -errno) arrived for fd at data
+} UringOp;
+
+typedef struct
+{
+    UringOp op;
+    int fd;
+    int res;
+    char *data;
+} UringEvent;
+
+// What io_uring is doing for one descriptor
+typedef struct
+{
+    unsigned long long armed; // user_data of the poll or receive in flight
+    unsigned gen;             // bumped per operation; older completions are
+                              //   stale
+    unsigned events;          // poll events wanted while watched
+    int watched;              // re-arm the poll after each event
+} UringFd;
+
+typedef struct
+{
+    int ringFd, enterFd;      // enterFd is the registered ring when possible
+    unsigned enterFlags;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned *sqHead, *sqTail, sqMask, sqEntries;
+    unsigned sqLocalTail, sqSubmitted; // entries queued, and handed over
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead, *cqTail, cqMask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *bufRing; // provided buffers for receives
+    char *buffers;
+    unsigned short bufTail;
+    unsigned lent[MAX_EVENTS]; // buffers out with the last waitUring() events
+    unsigned numLent;
+    UringFd *fds;             // indexed by descriptor
+    int maxFds, listenFd, acceptArmed;
+} Uring;
+
+typedef struct
+{
+    int epollFd, listenFd;
+    int controlFd;               // handoff socket, -1 when not listening
+    int draining;                // handed the listener over; finishing up
+    long long drainDeadline;     // ms, monotonic; when to stop waiting
+    Uring *uring;                // NULL when using epoll
+    Cache *cache;
+    Config *config;
+    Connection **connections;    // indexed by client and upstream descriptors
+    int maxFds;
+    Connection **timers;         // min-heap on deadline
+    unsigned numTimers, timersCapacity;
+    unsigned long served;
+    unsigned long long tunnelBytesUp, tunnelBytesDown;
+    char **prewarmUrls;          // queue of URLs waiting to be prewarmed
+    unsigned numPrewarm, nextPrewarm, prewarmCapacity;
+    unsigned activePrewarm;      // prewarm fetches in flight
+    unsigned numClients;         // client connections being served
+    ClientBucket **clients;      // admission state by client address
+    unsigned numBuckets;
+    unsigned long shed;          // clients turned away since startup
+    int traceFd;                 // trace file or socket, -1 when not tracing
+    int pressureFd;              // PSI trigger, -1 when not watched
+    int eventsFd;                // cgroup memory.events, -1 when not watched
+    unsigned long memoryEvents;  // its high, max and oom_kill counts
+    long long pressuredAt;       // ms, monotonic; last memory pressure
+    long long grewAt;            // ms, monotonic; last cache limit increase
+} Proxy;
+
+// main.c
+void parseArguments(int argc, char **argv, Config *config);
+int openListener(unsigned port, int backlog, int reusePort);
+
+// proxy.c
+Proxy *createProxy(int listenFd, Cache *cache, Config *config);
+void deleteProxy(Proxy *proxy);
+void runProxy(Proxy *proxy);
+void dispatchEpoll(Proxy *proxy, long long timeout);
+void dispatchUring(Proxy *proxy, long long timeout);
+void acceptClients(Proxy *proxy);
+void addClient(Proxy *proxy, int fd);
+void handleEvent(Proxy *proxy, Connection *conn, int fd, unsigned events);
+void readRequest(Proxy *proxy, Connection *conn);
+void receiveRequest(Proxy *proxy, Connection *conn, char *data, int size);
+int requestReceived(Proxy *proxy, Connection *conn);
+void handleRequest(Proxy *proxy, Connection *conn);
+int adminAllowed(Proxy *proxy, Connection *conn);
+long purgeTarget(Proxy *proxy, char *argument);
+void handlePurgeRequest(Proxy *proxy, Connection *conn);
+void queryServer(Proxy *proxy, Connection *conn, char *hostport,
+                 long defaultPort);
+unsigned sortAddresses(struct addrinfo *list, Address *addresses);
+void startAttempt(Proxy *proxy, Connection *conn);
+void finishConnect(Proxy *proxy, Connection *conn, int fd);
+void closeUpstream(Proxy *proxy, Connection *conn);
+void writeRequest(Proxy *proxy, Connection *conn);
+void readResponse(Proxy *proxy, Connection *conn);
+void writeResponse(Proxy *proxy, Connection *conn);
+void shapeResponse(Connection *conn);
+void sendError(Proxy *proxy, Connection *conn, const char *status,
+               const char *message);
+void startTunnel(Proxy *proxy, Connection *conn);
+void pumpTunnel(Proxy *proxy, Connection *conn);
+int pumpRelay(Relay *relay, int src, int dst);
+void closeConnection(Proxy *proxy, Connection *conn);
+void setInterest(Proxy *proxy, Connection *conn, int fd, unsigned events);
+void watchFd(Proxy *proxy, int fd, unsigned events);
+void unwatchFd(Proxy *proxy, int fd);
+void scheduleTimer(Proxy *proxy, Connection *conn, long long deadline);
+void cancelTimer(Proxy *proxy, Connection *conn);
+void expireTimers(Proxy *proxy);
+void armTimer(Proxy *proxy, Connection *conn);
+void handleTimeout(Proxy *proxy, Connection *conn);
+long long nowMs();
+long long nowUs();
+
+// uring.c
+Uring *createUring(int listenFd, int maxFds);
+void deleteUring(Uring *uring);
+struct io_uring_sqe *getUringSqe(Uring *uring);
+void armUringAccept(Uring *uring);
+void watchUring(Uring *uring, int fd, unsigned events);
+void unwatchUring(Uring *uring, int fd);
+void rearmUring(Uring *uring, int fd);
+void receiveUring(Uring *uring, int fd, size_t size);
+void recycleUringBuffer(Uring *uring, unsigned bid);
+void stopUringAccept(Uring *uring);
+int waitUring(Uring *uring, long long timeout, UringEvent *events,
+              int maxEvents);
+
+// cache.c
+Cache *createCache(unsigned capacity);
+void deleteCache(Cache *cache);
+void putIntoCache(Cache *cache, char *key, char *request, char *response,
+                  ssize_t response_size);
+ssize_t getFromCache(Cache *cache, char *key, char *request, char *response);
+CacheBlock *findCacheBlock(Cache *cache, char *key, char *request);
+void linkCacheBlock(Cache *cache, CacheBlock *block);
+void organizeCache(Cache *cache);
+void removeCacheBlock(Cache *cache, CacheBlock* block);
+unsigned trimCache(Cache *cache, unsigned maxBlocks);
+void printCache(Cache *cache);
+void putHostFailure(Cache *cache, char *target, const char *message,
+                    long ttl);
+HostFailure *getHostFailure(Cache *cache, char *target);
+unsigned hashKey(char *key, unsigned hashSize);
+
+// index.c
+void indexCacheBlock(Cache *cache, CacheBlock *block);
+void unindexCacheBlock(Cache *cache, CacheBlock *block);
+void deleteIndex(Cache *cache);
+unsigned purgeCacheKey(Cache *cache, char *key);
+unsigned purgeCachePrefix(Cache *cache, char *prefix);
+unsigned purgeCacheHost(Cache *cache, char *host);
+
+// admission.c
+int admitClient(Proxy *proxy, int fd, ClientBucket **bucket,
+                long long *queued);
+void releaseClient(Proxy *proxy, ClientBucket *bucket);
+void deleteClients(Proxy *proxy);
+
+// cluster.c
+int loadCluster(Config *config, char *list);
+char *choosePeer(Proxy *proxy, char *key);
+void forwardToPeer(Proxy *proxy, Connection *conn, char *peer);
+void peerFailed(Proxy *proxy, Connection *conn);
+
+// pressure.c
+void openPressure(Proxy *proxy);
+void handlePressure(Proxy *proxy, int fd);
+long long adjustCache(Proxy *proxy);
+
+// worker.c
+int loadCpus(Config *config, char *list);
+int startWorkers(Config *config);
+void forwardAdmin(Proxy *proxy, char *target);
+void receiveAdmin(Proxy *proxy);
+
+// stream.c
+int startStream(Proxy *proxy, Connection *conn);
+void pumpStream(Proxy *proxy, Connection *conn);
+void deleteStream(Stream *stream);
+
+// trace.c
+int openTrace(char *path);
+void traceConnection(Proxy *proxy, Connection *conn);
+
+// handoff.c
+int receiveHandoff(char *path, Cache *cache, int wantCache);
+int openControl(char *path);
+void serveHandoff(Proxy *proxy);
+
+// prewarm.c
+int loadManifest(Proxy *proxy, char *path);
+int queuePrewarm(Proxy *proxy, char *url);
+void startPrewarms(Proxy *proxy);
+void handlePrewarmRequest(Proxy *proxy, Connection *conn);
+
+// http.c
+char *parseRequest(char *request, char **method, char **key, char **host);
+int splitHostPort(char *hostport, char *hostname, size_t size, long *port,
+                  long defaultPort);
+char *normalizeKey(char *target, char *host);
+HeaderId classifyHeader(const char *name, size_t length);
+char *findHeader(char *message, const char *name, size_t *length);
+char *findKnownHeader(char *message, HeaderId id, size_t *length);
+char *buildVariant(char *request, char *vary);
+int removeHeader(char *message, ssize_t *size, const char *name);
+int requestClose(char *request, ssize_t *size);
+int responseStatus(char *response);
+int notModified(char *ifNoneMatch, char *ifModifiedSince, char *response);
+ssize_t headerOnly(char *response, ssize_t size, const char *status);
+ssize_t addAgeField(char *reponse, ssize_t response_size, time_t age);
+
+#endif
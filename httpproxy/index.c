@@ -0,0 +1,432 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Secondary indexes over the cache, for purging. Every block is in a radix
+// trie keyed by its cache key and in the list of blocks for its hostname, so
+// purging a URL, a URL prefix or a host touches only the matching blocks
+// rather than the whole cache. cache.c keeps them up to date as blocks come
+// and go.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/types.h>
+
+#include "httpproxy.h"
+
+static TrieNode *newTrieNode(char *label, size_t length, TrieNode *parent);
+static TrieNode *findTrieNode(TrieNode *root, char *prefix, int exact);
+static void pruneTrieNode(TrieNode *node);
+static void deleteTrie(TrieNode *node);
+static void collectTrie(TrieNode *node, CacheBlock ***blocks, unsigned *count,
+                        unsigned *capacity);
+static HostList **findHostList(Cache *cache, char *host);
+static char *keyHost(char *key);
+static unsigned removeBlocks(Cache *cache, CacheBlock **blocks,
+                             unsigned count);
+
+// Function  : indexCacheBlock
+// Arguments : Cache * of cache, and CacheBlock * of a block just cached
+// Does      : 1) adds the block under its key in the trie, splitting the
+//                label it diverges from
+//             2) adds the block to the list for its hostname
+// Returns   : nothing
+void
+indexCacheBlock(Cache *cache, CacheBlock *block)
+{
+    TrieNode *node = cache->trie, *child, *middle, **link;
+    HostList **list;
+    char *rest = block->key, *host;
+    size_t common;
+
+    while (*rest)
+    {
+        link = &node->children;
+        while (*link && (*link)->label[0] != *rest) link = &(*link)->sibling;
+        child = *link;
+        if (!child)
+        {
+            child = newTrieNode(rest, strlen(rest), node);
+            child->sibling = node->children;
+            node->children = child;
+            node = child;
+            break;
+        }
+
+        for (common = 1; common < child->labelLength &&
+                         child->label[common] == rest[common]; common++);
+
+        // The key leaves the label part way: split it at that point
+        if (common < child->labelLength)
+        {
+            middle = newTrieNode(child->label, common, node);
+            middle->sibling = child->sibling;
+            *link = middle;
+            middle->children = child;
+            child->sibling = NULL;
+            child->parent = middle;
+            child->labelLength -= common;
+            memmove(child->label, child->label + common,
+                    child->labelLength + 1);
+            child = middle;
+        }
+
+        node = child;
+        rest += common;
+    }
+
+    block->node = node;
+    block->trieNext = node->blocks;
+    node->blocks = block;
+
+    host = keyHost(block->key);
+    list = findHostList(cache, host);
+    if (!*list)
+    {
+        *list = calloc(1, sizeof(HostList));
+        (*list)->host = host;
+    }
+    else
+        free(host);
+
+    block->hostList = *list;
+    block->hostPrev = NULL;
+    block->hostNext = (*list)->blocks;
+    if (block->hostNext) block->hostNext->hostPrev = block;
+    (*list)->blocks = block;
+}
+
+// Function  : unindexCacheBlock
+// Arguments : Cache * of cache, and CacheBlock * of a block being removed
+// Does      : 1) takes the block out of its trie node, pruning nodes left
+//                empty and merging ones left with a single child
+//             2) takes the block out of its host list, freeing the list when
+//                it empties
+// Returns   : nothing
+void
+unindexCacheBlock(Cache *cache, CacheBlock *block)
+{
+    CacheBlock **link;
+    HostList **list;
+
+    link = &block->node->blocks;
+    while (*link != block) link = &(*link)->trieNext;
+    *link = block->trieNext;
+    pruneTrieNode(block->node);
+
+    if (block->hostPrev) block->hostPrev->hostNext = block->hostNext;
+    else block->hostList->blocks = block->hostNext;
+    if (block->hostNext) block->hostNext->hostPrev = block->hostPrev;
+
+    if (!block->hostList->blocks)
+    {
+        list = findHostList(cache, block->hostList->host);
+        *list = block->hostList->next;
+        free(block->hostList->host);
+        free(block->hostList);
+    }
+}
+
+// Function  : deleteIndex
+// Arguments : Cache * of cache
+// Does      : 1) frees the trie and the host lists; the blocks themselves
+//                belong to the cache
+// Returns   : nothing
+void
+deleteIndex(Cache *cache)
+{
+    HostList *list, *next;
+    unsigned i;
+
+    deleteTrie(cache->trie);
+
+    for (i = 0; i < cache->hashSize; i++)
+    {
+        for (list = cache->hosts[i]; list; list = next)
+        {
+            next = list->next;
+            free(list->host);
+            free(list);
+        }
+    }
+    free(cache->hosts);
+}
+
+// Function  : purgeCacheKey
+// Arguments : Cache * of cache, and char * of a normalized cache key
+// Does      : 1) removes every variant cached under exactly that key
+// Returns   : unsigned of number of blocks removed
+unsigned
+purgeCacheKey(Cache *cache, char *key)
+{
+    TrieNode *node;
+    CacheBlock **blocks = NULL, *block;
+    unsigned count = 0;
+
+    node = findTrieNode(cache->trie, key, 1);
+    if (!node) return 0;
+
+    for (block = node->blocks; block; block = block->trieNext)
+    {
+        blocks = realloc(blocks, (count + 1) * sizeof(CacheBlock *));
+        blocks[count++] = block;
+    }
+
+    return removeBlocks(cache, blocks, count);
+}
+
+// Function  : purgeCachePrefix
+// Arguments : Cache * of cache, and char * of the start of cache keys
+// Does      : 1) removes every block whose key starts with the prefix
+// Returns   : unsigned of number of blocks removed
+unsigned
+purgeCachePrefix(Cache *cache, char *prefix)
+{
+    TrieNode *node;
+    CacheBlock **blocks = NULL;
+    unsigned count = 0, capacity = 0;
+
+    node = findTrieNode(cache->trie, prefix, 0);
+    if (!node) return 0;
+
+    collectTrie(node, &blocks, &count, &capacity);
+
+    return removeBlocks(cache, blocks, count);
+}
+
+// Function  : purgeCacheHost
+// Arguments : Cache * of cache, and char * of a hostname, optionally with a
+//             port, which is ignored
+// Does      : 1) removes every block cached for the hostname, on any port
+// Returns   : unsigned of number of blocks removed
+unsigned
+purgeCacheHost(Cache *cache, char *host)
+{
+    HostList **list;
+    CacheBlock **blocks = NULL, *block;
+    char *url, *name;
+    unsigned count = 0;
+
+    // Reduce the argument to a hostname the way keys are reduced
+    url = malloc(strlen("http://") + strlen(host) + 1);
+    sprintf(url, "http://%s", host);
+    name = keyHost(url);
+    free(url);
+
+    list = findHostList(cache, name);
+    free(name);
+    if (!*list) return 0;
+
+    for (block = (*list)->blocks; block; block = block->hostNext)
+    {
+        blocks = realloc(blocks, (count + 1) * sizeof(CacheBlock *));
+        blocks[count++] = block;
+    }
+
+    return removeBlocks(cache, blocks, count);
+}
+
+// Function  : newTrieNode
+// Arguments : char * and size_t of the label, and TrieNode * of the parent
+// Does      : allocates a node with a copy of the label and no children
+// Returns   : TrieNode * of the node
+static TrieNode *
+newTrieNode(char *label, size_t length, TrieNode *parent)
+{
+    TrieNode *node;
+
+    node = calloc(1, sizeof(TrieNode));
+    node->label = strndup(label, length);
+    node->labelLength = length;
+    node->parent = parent;
+
+    return node;
+}
+
+// Function  : findTrieNode
+// Arguments : TrieNode * of the root, char * of a key or key prefix, and int
+//             of whether the key must end exactly at the node
+// Does      : follows the labels that spell the prefix; a prefix ending part
+//             way through a label selects that label's node
+// Returns   : TrieNode * of the node whose subtree holds the matching keys,
+//             or NULL if there are none
+static TrieNode *
+findTrieNode(TrieNode *root, char *prefix, int exact)
+{
+    TrieNode *node = root, *child;
+    size_t length;
+
+    while (*prefix)
+    {
+        for (child = node->children; child && child->label[0] != *prefix;
+             child = child->sibling);
+        if (!child) return NULL;
+
+        length = strlen(prefix);
+        if (length < child->labelLength)
+        {
+            if (exact || strncmp(child->label, prefix, length) != 0)
+                return NULL;
+            return child;
+        }
+        if (strncmp(child->label, prefix, child->labelLength) != 0)
+            return NULL;
+
+        prefix += child->labelLength;
+        node = child;
+    }
+
+    return node;
+}
+
+// Function  : pruneTrieNode
+// Arguments : TrieNode * of a node that may have just lost its last block
+// Does      : walks towards the root freeing nodes with no blocks and no
+//             children, and folds a node with no blocks and a single child
+//             into that child, so the trie stays proportional to the keys
+// Returns   : nothing
+static void
+pruneTrieNode(TrieNode *node)
+{
+    TrieNode *parent, *child, **link;
+    char *label;
+
+    while (node->parent && !node->blocks)
+    {
+        parent = node->parent;
+        for (link = &parent->children; *link != node; link = &(*link)->sibling);
+
+        if (!node->children)
+        {
+            *link = node->sibling;
+            free(node->label);
+            free(node);
+            node = parent;
+            continue;
+        }
+
+        if (!node->children->sibling)
+        {
+            child = node->children;
+            label = malloc(node->labelLength + child->labelLength + 1);
+            memcpy(label, node->label, node->labelLength);
+            memcpy(label + node->labelLength, child->label,
+                   child->labelLength + 1);
+            free(child->label);
+            child->label = label;
+            child->labelLength += node->labelLength;
+            child->parent = parent;
+            child->sibling = node->sibling;
+            *link = child;
+            free(node->label);
+            free(node);
+        }
+        break;
+    }
+}
+
+// Function  : deleteTrie
+// Arguments : TrieNode * of a node
+// Does      : frees the node and its subtree
+// Returns   : nothing
+static void
+deleteTrie(TrieNode *node)
+{
+    TrieNode *child, *next;
+
+    for (child = node->children; child; child = next)
+    {
+        next = child->sibling;
+        deleteTrie(child);
+    }
+    free(node->label);
+    free(node);
+}
+
+// Function  : collectTrie
+// Arguments : TrieNode * of a node, and CacheBlock *** of an array with its
+//             unsigned * count and capacity, to append to
+// Does      : appends every block in the node's subtree
+// Returns   : nothing
+static void
+collectTrie(TrieNode *node, CacheBlock ***blocks, unsigned *count,
+            unsigned *capacity)
+{
+    CacheBlock *block;
+    TrieNode *child;
+
+    for (block = node->blocks; block; block = block->trieNext)
+    {
+        if (*count == *capacity)
+        {
+            *capacity = *capacity ? 2 * *capacity : 16;
+            *blocks = realloc(*blocks, *capacity * sizeof(CacheBlock *));
+        }
+        (*blocks)[(*count)++] = block;
+    }
+
+    for (child = node->children; child; child = child->sibling)
+        collectTrie(child, blocks, count, capacity);
+}
+
+// Function  : findHostList
+// Arguments : Cache * of cache, and char * of a hostname
+// Does      : walks the hostname's bucket
+// Returns   : HostList ** of the link pointing at the hostname's list, which
+//             holds NULL if there is none
+static HostList **
+findHostList(Cache *cache, char *host)
+{
+    HostList **list;
+
+    for (list = &cache->hosts[hashKey(host, cache->hashSize)]; *list;
+         list = &(*list)->next)
+    {
+        if (strcmp((*list)->host, host) == 0) break;
+    }
+
+    return list;
+}
+
+// Function  : keyHost
+// Arguments : char * of a cache key, "http://<host>[:<port>]/..."
+// Does      : copies the lowercased hostname out of the key, keeping the
+//             brackets of an IPv6 literal and dropping the port
+// Returns   : char * of the hostname, which the caller frees
+static char *
+keyHost(char *key)
+{
+    char *host, *end, *name;
+    size_t i;
+
+    host = key + strlen("http://");
+    if (*host == '[')
+    {
+        end = strchr(host, ']');
+        end = end ? end + 1 : host + strcspn(host, "/?#");
+    }
+    else
+        end = host + strcspn(host, ":/?#");
+
+    name = strndup(host, end - host);
+    for (i = 0; name[i]; i++) name[i] = tolower((unsigned char)name[i]);
+
+    return name;
+}
+
+// Function  : removeBlocks
+// Arguments : Cache * of cache, and CacheBlock ** of an array of count blocks
+// Does      : removes the blocks from the cache and frees the array; they are
+//             gathered first because removal reshapes the indexes
+// Returns   : unsigned of number of blocks removed
+static unsigned
+removeBlocks(Cache *cache, CacheBlock **blocks, unsigned count)
+{
+    unsigned i;
+
+    for (i = 0; i < count; i++) removeCacheBlock(cache, blocks[i]);
+    free(blocks);
+
+    return count;
+}
@@ -7,94 +7,50 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netdb.h>
 
-typedef struct CacheBlock
-{
-    char *key;
-    char *value;
-    ssize_t size;
-    time_t production;
-    time_t expiration;
-    struct CacheBlock *moreRU, *lessRU; // For recent usage doubly linked list
-    struct CacheBlock *hmPrev, *hmNext; // For hashmap chaining
-} CacheBlock;
-
-typedef struct
-{
-    CacheBlock *mru;
-    CacheBlock *lru;
-    CacheBlock **hashMap; // each hashMap[index] points to the head of chaining
-    unsigned numBlocks;
-} Cache;
-
-unsigned getPortNumber(int argc, char **argv);
-Cache *createCache();
-void deleteCache(Cache *cache);
-void serveClient(int sockfd, Cache *cache);
-ssize_t handleRequest(char *request, char *response, Cache *cache);
-ssize_t queryServer(char *host, char *request, char *response);
-void putIntoCache(Cache *cache, char *key, char *response,
-                  ssize_t response_size);
-ssize_t getFromCache(Cache *cache, char *key, char *response);
-void organizeCache(Cache *cache);
-void removeCacheBlock(Cache *cache, CacheBlock* block);
-void printCache(Cache *cache);
-unsigned hashKey(char *key);
-ssize_t addAgeField(char *reponse, ssize_t response_size, time_t age);
-
-#define MAX_URL_LENGTH 100
-#define MAX_CONTENT_SIZE 10000000 // 10MB
-#define CACHE_SIZE 10
-#define HASH_SIZE 13
-#define BACKLOG_SIZE 10
-#define CONNECTION_FAIL "Failed to connect to the host\n"
-#define DEFAULT_PORT 80
-#define MAX_SERVING_SIZE 1000000
-#define DEFAULT_MAXAGE 3600
+#include "httpproxy.h"
 
 int
 main(int argc, char **argv)
 {
     int sockfd;
-    unsigned portNum;
-    struct sockaddr_in addr;
+    Config config;
     Cache *cache;
+    Proxy *proxy;
 
-    // Handle input and get port number
-    portNum = getPortNumber(argc, argv);
+    // Handle input
+    parseArguments(argc, argv, &config);
 
-    // Create a TCP socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0)
-    {
-        fprintf(stderr, "[httpproxy] Failed to create socket in main()\n");
-        exit(EXIT_FAILURE);
-    }
+    // A client or origin hanging up mid-write must not kill the proxy
+    signal(SIGPIPE, SIG_IGN);
 
-    // Bind socket to the port number
-    bzero((char *) &addr, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(portNum);
-    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) 
-    {
-        fprintf(stderr, "[httpproxy] Failed to bind socket to port %d\n",
-                portNum);
-        exit(EXIT_FAILURE);
-    }
+    // Fork the workers, if any, and place them before they allocate
+    sockfd = startWorkers(&config);
 
     // Create cache
-    cache = createCache();
+    cache = createCache(config.cacheBlocks);
+    cache->errorTtl = config.errorTtl;
+    cache->maxBytes = cache->byteLimit = config.cacheBytes;
+
+    // Take the listener (and cache) over from a running proxy, if any
+    if (sockfd < 0 && config.handoffPath)
+        sockfd = receiveHandoff(config.handoffPath, cache, config.handoffCache);
+    if (sockfd < 0) sockfd = openListener(config.port, config.backlog, 0);
+    printf("[httpproxy] Listening...\n");
 
-    // Serve client
-    for (int i = 0; i < MAX_SERVING_SIZE; i++) serveClient(sockfd, cache);
+    // Serve clients
+    proxy = createProxy(sockfd, cache, &config);
+    if (config.prewarmFile) loadManifest(proxy, config.prewarmFile);
+    runProxy(proxy);
 
-    // Close socket
-    close(sockfd);
+    // Close socket, unless it was handed over
+    if (proxy->listenFd >= 0) close(proxy->listenFd);
+    deleteProxy(proxy);
 
     // Delete cache
     deleteCache(cache);
@@ -102,565 +58,337 @@ main(int argc, char **argv)
     return 0;
 }
 
-// Function  : getPortNumber
-// Arguments : int of argc and char ** of argv 
-// Does      : 1) checks for the singular argument, port number
-//             3) returns the port number
-// Returns   : unsigned int of port number
-unsigned
-getPortNumber(int argc, char **argv)
-{
-    char *rest;
-    long portNum;
-
-    // Checks for the singular argument
-    if (argc != 2)
-    {
-        fprintf(stderr, "[httpproxy] Usage: %s <port number>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-
-    // Gets port number
-    portNum = strtol(argv[1], &rest, 10);
-
-    return (unsigned)portNum;
-}
-
-// Function  : createCache
-// Arguments : nothing
-// Does      : 1) initializes and allocates a cache for the proxy
-//             2) returns the pointer to the cache
-// Returns   : Cache * of cache
-Cache *
-createCache()
-{
-    Cache *cache;
-    int i;
-
-    cache = (Cache *)malloc(sizeof(Cache));
-    cache->lru = NULL;
-    cache->mru = NULL;
-    cache->hashMap = (CacheBlock **)malloc(HASH_SIZE * sizeof(CacheBlock *));
-    cache->numBlocks = 0;
-
-    for (i = 0; i < HASH_SIZE; i++) cache->hashMap[i] = NULL;
-
-    return cache;
-}
-
-// Function  : deleteCache
-// Arguments : Cache * of cache
-// Does      : 1) deallocates memory in cache
+// Function  : parseArguments
+// Arguments : int of argc, char ** of argv, and Config * to fill in
+// Does      : 1) applies the defaults
+//             2) reads the options
+//             3) checks for the singular positional argument, port number
 // Returns   : nothing
 void
-deleteCache(Cache *cache)
+parseArguments(int argc, char **argv, Config *config)
 {
-    CacheBlock *curr, *prev;
-
-    curr = cache->mru;
-    while (curr)
+    char *rest, *cluster = NULL;
+    int opt, usage = 0;
+    static struct option options[] =
     {
-        prev = curr;
-        curr = curr->lessRU;
-        free(prev->key);
-        free(prev->value);
-        free(prev);
-    }
-    
-    free(cache->hashMap);
-    free(cache);
-}
-
-// Function  : serveClient
-// Arguments : int of socket file descriptor, and Cache * of cache
-// Does      : 1) listens on the socket
-//             2) accepts the first connection request
-//             3) reads an HTTP request
-//             4) retrieve the corresponding HTTP response either from the cache
-//                or directly from the server
-//             5) writes back the HTTP request
-// Returns   : nothing
-void
-serveClient(int sockfd, Cache *cache)
-{
-    int client_sockfd;
-    char *request;
-    char *response;
-    struct sockaddr *client_addr;
-    ssize_t request_size, response_size, write_size;
-    socklen_t *client_addrlen;
-
-    client_addr = malloc(sizeof(struct sockaddr));
-    client_addrlen = malloc(sizeof(socklen_t));
-    request = malloc(sizeof(char) * MAX_CONTENT_SIZE);
-    response = malloc(sizeof(char) * MAX_CONTENT_SIZE);
-
-    // Listen
-    if (listen(sockfd, BACKLOG_SIZE) != 0)
-    {
-        fprintf(stderr, "[httpproxy] Failed listening on socket\n");
-        fprintf(stderr, "[httpproxy] errno: %d\n", errno);
-        exit(EXIT_FAILURE);
-    }
-    printf("[httpproxy] Listening...\n");
-
-    // Accept the first connection request
-    *client_addrlen = sizeof(struct sockaddr_in);
-    client_sockfd = accept(sockfd, client_addr, client_addrlen);
-    if (client_sockfd < 0)
+        { "tunnel-idle-timeout", required_argument, NULL, 'i' },
+        { "attempt-delay", required_argument, NULL, 'a' },
+        { "connect-timeout", required_argument, NULL, 'c' },
+        { "first-byte-timeout", required_argument, NULL, 'f' },
+        { "request-timeout", required_argument, NULL, 't' },
+        { "header-timeout", required_argument, NULL, 'e' },
+        { "send-timeout", required_argument, NULL, 'o' },
+        { "prewarm", required_argument, NULL, 'w' },
+        { "prewarm-concurrency", required_argument, NULL, 'W' },
+        { "admin-token", required_argument, NULL, 'k' },
+        { "io-backend", required_argument, NULL, 'b' },
+        { "dns-failure-ttl", required_argument, NULL, 'D' },
+        { "connect-failure-ttl", required_argument, NULL, 'R' },
+        { "error-ttl", required_argument, NULL, 'E' },
+        { "backlog", required_argument, NULL, 'B' },
+        { "max-connections", required_argument, NULL, 'm' },
+        { "client-connections", required_argument, NULL, 'n' },
+        { "client-rate", required_argument, NULL, 'r' },
+        { "client-burst", required_argument, NULL, 'u' },
+        { "queue-delay-target", required_argument, NULL, 'q' },
+        { "handoff", required_argument, NULL, 'H' },
+        { "no-handoff-cache", no_argument, NULL, 'N' },
+        { "drain-timeout", required_argument, NULL, 'd' },
+        { "cluster", required_argument, NULL, 'C' },
+        { "node", required_argument, NULL, 'I' },
+        { "peer-timeout", required_argument, NULL, 'P' },
+        { "trace", required_argument, NULL, 'T' },
+        { "trace-sample", required_argument, NULL, 'S' },
+        { "trace-threshold", required_argument, NULL, 'L' },
+        { "workers", required_argument, NULL, 'j' },
+        { "cpus", required_argument, NULL, 'A' },
+        { "cache-blocks", required_argument, NULL, 'K' },
+        { "cache-bytes", required_argument, NULL, 'M' },
+        { "pressure-stall", required_argument, NULL, 's' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    config->tunnelIdleTimeout = DEFAULT_TUNNEL_IDLE_TIMEOUT;
+    config->attemptDelay = DEFAULT_ATTEMPT_DELAY;
+    config->connectTimeout = DEFAULT_CONNECT_TIMEOUT;
+    config->firstByteTimeout = DEFAULT_FIRST_BYTE_TIMEOUT;
+    config->requestTimeout = DEFAULT_REQUEST_TIMEOUT;
+    config->headerTimeout = DEFAULT_HEADER_TIMEOUT;
+    config->sendTimeout = DEFAULT_SEND_TIMEOUT;
+    config->prewarmFile = NULL;
+    config->prewarmConcurrency = DEFAULT_PREWARM_CONCURRENCY;
+    config->adminToken = NULL;
+    config->ioUring = 0;
+    config->dnsFailureTtl = DEFAULT_DNS_FAILURE_TTL;
+    config->connectFailureTtl = DEFAULT_CONNECT_FAILURE_TTL;
+    config->errorTtl = DEFAULT_ERROR_TTL;
+    config->backlog = DEFAULT_BACKLOG;
+    config->maxConnections = DEFAULT_MAX_CONNECTIONS;
+    config->clientConnections = 0;
+    config->clientRate = 0;
+    config->clientBurst = DEFAULT_CLIENT_BURST;
+    config->queueDelayTarget = DEFAULT_QUEUE_DELAY_TARGET;
+    config->handoffPath = NULL;
+    config->handoffCache = 1;
+    config->drainTimeout = DEFAULT_DRAIN_TIMEOUT;
+    config->nodes = NULL;
+    config->numNodes = 0;
+    config->self = NULL;
+    config->peerTimeout = DEFAULT_PEER_TIMEOUT;
+    config->tracePath = NULL;
+    config->traceSample = DEFAULT_TRACE_SAMPLE;
+    config->traceThreshold = DEFAULT_TRACE_THRESHOLD;
+    config->workers = 1;
+    config->cpus = NULL;
+    config->numCpus = 0;
+    config->adminFd = -1;
+    config->workerFds = NULL;
+    config->cacheBlocks = CACHE_SIZE;
+    config->cacheBytes = DEFAULT_CACHE_BYTES;
+    config->pressureStall = DEFAULT_PRESSURE_STALL;
+
+    while ((opt = getopt_long(argc, argv,
+                              "i:a:c:f:t:e:o:w:W:k:b:D:R:E:B:m:n:r:u:q:H:Nd:"
+                              "C:I:P:T:S:L:j:A:K:M:s:",
+                              options, NULL)) != -1)
     {
-        fprintf(stderr, "[httpproxy] Failed accepting connection request\n");
-        exit(EXIT_FAILURE);
-    }
-    printf("[httpproxy] Accepted connection request\n");
-
-    // Read from the connection
-    bzero(request, sizeof(request));
-    request_size = read(client_sockfd, request, MAX_CONTENT_SIZE);
-    if (request_size < 0)
-    {
-        fprintf(stderr, "[httpproxy] Failed reading from the connection\n");
-        exit(EXIT_FAILURE);
-    }
-    request[request_size] = 0; // null-termination for strtok_r
-    printf("[httpproxy] Read from the connection\n");
-
-    // Handle request
-    bzero(response, MAX_CONTENT_SIZE);
-    response_size = handleRequest(request, response, cache);
-
-    // Write response to the connection
-    if (write(client_sockfd, response, response_size) < 0)
-    {
-        fprintf(stderr, "[httpproxy] Failed writing to the connection\n");
-        exit(EXIT_FAILURE);
-    }
-    printf("[httpproxy] Wrote response to the connection\n");
-
-    printCache(cache);
-
-    // Close client socket
-    close(client_sockfd);
-    printf("[httpproxy] Closed connection\n");
-
-    free(request);
-    free(response);
-    free(client_addr);
-    free(client_addrlen);
-}
-
-// Function  : handleRequest
-// Arguments : char * of request, char * of response, and Cache * of cache
-// Does      : 1) parses the request
-//             2) handles the request appropriately and fills up response
-// Returns   : ssize_t of response size
-ssize_t
-handleRequest(char *request, char *response, Cache *cache)
-{
-    char *line, *key, *host;
-    char *str;
-    char *line_saveptr, *get_saveptr, *host_saveptr;
-    char line_delim[3] = "\r\n";
-    char token_delim[2] = " ";
-    ssize_t response_size;
-
-    printf("[httpproxy] Handling HTTP request\n");
-
-    // Find key
-    str = strdup(request); // strtok_r manipulates the string - make a copy
-    for (line = strtok_r(str, line_delim, &line_saveptr); line;
-         line = strtok_r(NULL, line_delim, &line_saveptr))
-    {
-        if (strstr(line, "GET ") == line)
+        switch (opt)
         {
-            strtok_r(line, token_delim, &get_saveptr);
-            key = strtok_r(NULL, token_delim, &get_saveptr);
-        }
-        if (strstr(line, "Host: ") == line)
-        {
-            strtok_r(line, token_delim, &host_saveptr);
-            host = strtok_r(NULL, token_delim, &host_saveptr);
+            case 'i':
+                config->tunnelIdleTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'a':
+                config->attemptDelay = strtol(optarg, &rest, 10);
+                break;
+            case 'c':
+                config->connectTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'f':
+                config->firstByteTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 't':
+                config->requestTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'e':
+                config->headerTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'o':
+                config->sendTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'w':
+                config->prewarmFile = optarg;
+                break;
+            case 'W':
+                config->prewarmConcurrency = strtoul(optarg, &rest, 10);
+                if (config->prewarmConcurrency == 0)
+                    config->prewarmConcurrency = 1;
+                break;
+            case 'k':
+                config->adminToken = optarg;
+                break;
+            case 'b':
+                if (strcmp(optarg, "io_uring") == 0)
+                    config->ioUring = 1;
+                else if (strcmp(optarg, "epoll") != 0)
+                    usage = 1;
+                break;
+            case 'D':
+                config->dnsFailureTtl = strtol(optarg, &rest, 10);
+                break;
+            case 'R':
+                config->connectFailureTtl = strtol(optarg, &rest, 10);
+                break;
+            case 'E':
+                config->errorTtl = strtol(optarg, &rest, 10);
+                break;
+            case 'B':
+                config->backlog = (int)strtol(optarg, &rest, 10);
+                break;
+            case 'm':
+                config->maxConnections = strtoul(optarg, &rest, 10);
+                break;
+            case 'n':
+                config->clientConnections = strtoul(optarg, &rest, 10);
+                break;
+            case 'r':
+                config->clientRate = strtod(optarg, &rest);
+                break;
+            case 'u':
+                config->clientBurst = strtod(optarg, &rest);
+                if (config->clientBurst < 1) config->clientBurst = 1;
+                break;
+            case 'q':
+                config->queueDelayTarget = strtol(optarg, &rest, 10);
+                break;
+            case 'H':
+                config->handoffPath = optarg;
+                break;
+            case 'N':
+                config->handoffCache = 0;
+                break;
+            case 'd':
+                config->drainTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'C':
+                cluster = optarg;
+                break;
+            case 'I':
+                config->self = optarg;
+                break;
+            case 'P':
+                config->peerTimeout = strtol(optarg, &rest, 10);
+                break;
+            case 'T':
+                config->tracePath = optarg;
+                break;
+            case 'S':
+                config->traceSample = strtod(optarg, &rest);
+                break;
+            case 'L':
+                config->traceThreshold = strtol(optarg, &rest, 10);
+                break;
+            case 'j':
+                config->workers = strtoul(optarg, &rest, 10);
+                if (config->workers == 0) config->workers = 1;
+                break;
+            case 'A':
+                if (loadCpus(config, optarg) < 0) usage = 1;
+                break;
+            case 'K':
+                config->cacheBlocks = strtoul(optarg, &rest, 10);
+                if (config->cacheBlocks == 0) usage = 1;
+                break;
+            case 'M':
+                config->cacheBytes = strtoull(optarg, &rest, 10);
+                if (config->cacheBytes < MIN_CACHE_BYTES)
+                    config->cacheBytes = MIN_CACHE_BYTES;
+                break;
+            case 's':
+                config->pressureStall = strtol(optarg, &rest, 10);
+                break;
+            default:
+                usage = 1;
+                break;
         }
     }
 
-    // Query cache
-    response_size = getFromCache(cache, key, response);
+    if (cluster && loadCluster(config, cluster) < 0) usage = 1;
 
-    if (response_size == 0) // If the key-value pair was not in the cache,
+    // Workers each hold their own listener and cache; there is no one
+    // process to hand them over
+    if (config->workers > 1 && config->handoffPath)
     {
-        // Directly query server
-        response_size = queryServer(host, request, response);
-        putIntoCache(cache, key, response, response_size); // Without age field
-        response_size = addAgeField(response, response_size, 0);
+        fprintf(stderr, "[httpproxy] --handoff needs a single worker\n");
+        usage = 1;
     }
 
-    free(str); // for malloc() within strdup()
-
-    return response_size;
-}
-
-// Function  : queryServer
-// Arguments : char * of request and char * of <hostname>:<portnumber>
-// Does      : 1) queries the server of the hostname with the request
-//             2) fills up/returns the response from the server
-// Returns   : ssize_t of the size of response
-ssize_t
-queryServer(char *host, char *request, char *response)
-{
-    int sockfd;
-    long portNum;
-    char *saveptr, *rest, *addendum;
-    char *hostname;
-    struct hostent *server;
-    struct sockaddr_in server_addr;
-    ssize_t response_size, read_size;
-    char delim[2] = ":";
-    char *buf;
-
-    buf = malloc(MAX_CONTENT_SIZE);
-
-    // Get hostname and port number
-    hostname = strtok_r(host, delim, &saveptr);
-    addendum = strtok_r(NULL, delim, &saveptr);
-    if (addendum)
-        portNum = strtol(addendum, &rest, 10);
-    else 
-        portNum = DEFAULT_PORT;
-
-    // Create TCP socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0)
+    // Checks for the singular argument
+    if (usage || optind != argc - 1)
     {
-        fprintf(stderr, "[httpproxy] Failed to create socket in queryServer\n");
+        fprintf(stderr, "[httpproxy] Usage: %s [options] <port number>\n",
+                argv[0]);
+        fprintf(stderr, "[httpproxy]   -i, --tunnel-idle-timeout <seconds>\n");
+        fprintf(stderr, "[httpproxy]   -a, --attempt-delay <ms>\n");
+        fprintf(stderr, "[httpproxy]   -c, --connect-timeout <ms>\n");
+        fprintf(stderr, "[httpproxy]   -f, --first-byte-timeout <ms>\n");
+        fprintf(stderr, "[httpproxy]   -t, --request-timeout <ms>\n");
+        fprintf(stderr, "[httpproxy]   -e, --header-timeout <ms>\n");
+        fprintf(stderr, "[httpproxy]   -o, --send-timeout <ms>\n");
+        fprintf(stderr, "[httpproxy]   -w, --prewarm <manifest file>\n");
+        fprintf(stderr, "[httpproxy]   -W, --prewarm-concurrency <count>\n");
+        fprintf(stderr, "[httpproxy]   -k, --admin-token <token>\n");
+        fprintf(stderr, "[httpproxy]   -b, --io-backend <epoll|io_uring>\n");
+        fprintf(stderr, "[httpproxy]   -D, --dns-failure-ttl <seconds>\n");
+        fprintf(stderr, "[httpproxy]   -R, --connect-failure-ttl <seconds>\n");
+        fprintf(stderr, "[httpproxy]   -E, --error-ttl <seconds>\n");
+        fprintf(stderr, "[httpproxy]   -B, --backlog <count>\n");
+        fprintf(stderr, "[httpproxy]   -m, --max-connections <count>\n");
+        fprintf(stderr, "[httpproxy]   -n, --client-connections <count>\n");
+        fprintf(stderr, "[httpproxy]   -r, --client-rate <per second>\n");
+        fprintf(stderr, "[httpproxy]   -u, --client-burst <count>\n");
+        fprintf(stderr, "[httpproxy]   -q, --queue-delay-target <ms>\n");
+        fprintf(stderr, "[httpproxy]   -H, --handoff <socket path>\n");
+        fprintf(stderr, "[httpproxy]   -N, --no-handoff-cache\n");
+        fprintf(stderr, "[httpproxy]   -d, --drain-timeout <seconds>\n");
+        fprintf(stderr, "[httpproxy]   -C, --cluster <host:port,...>\n");
+        fprintf(stderr, "[httpproxy]   -I, --node <host:port>\n");
+        fprintf(stderr, "[httpproxy]   -P, --peer-timeout <ms>\n");
+        fprintf(stderr, "[httpproxy]   -T, --trace <file|unix:path>\n");
+        fprintf(stderr, "[httpproxy]   -S, --trace-sample <fraction>\n");
+        fprintf(stderr, "[httpproxy]   -L, --trace-threshold <ms>\n");
+        fprintf(stderr, "[httpproxy]   -j, --workers <count>\n");
+        fprintf(stderr, "[httpproxy]   -A, --cpus <list, e.g. 0-3,8>\n");
+        fprintf(stderr, "[httpproxy]   -K, --cache-blocks <count>\n");
+        fprintf(stderr, "[httpproxy]   -M, --cache-bytes <bytes>\n");
+        fprintf(stderr, "[httpproxy]   -s, --pressure-stall <ms per second>\n");
         exit(EXIT_FAILURE);
     }
 
-    // Get server information
-    server = gethostbyname(hostname);
-    if (server == NULL)
-    {
-        fprintf(stderr, "[httpproxy] No such host as %s\n", hostname);
-        fprintf(stderr, "[httpproxy] h_errno: %d\n", h_errno);
-        strcpy(response, "No such host indicated by the hostname\n");
-        return 0;
-    }
-
-    // Build the server's Internet address
-    bzero((char *) &server_addr, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr,(char *)&server_addr.sin_addr.s_addr,
-           server->h_length);
-    server_addr.sin_port = htons(portNum);
-
-    // Connect with the server
-    if (connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr))
-        < 0) 
-    {
-        fprintf(stderr, "[httpproxy] Failed to connect to %s on port %ld\n",
-                hostname, portNum);
-        strcpy(response, CONNECTION_FAIL);
-        return 0;
-    }
-
-    // Send the HTTP request to the server
-    if(write(sockfd, request, strlen(request)) < 0)
-        fprintf(stderr, "[httpproxy] Failed to write to %s\n", hostname);
-    printf("[httpproxy] Querying host %s\n", hostname);
-    
-    // Read the HTTP response from the server
-    response_size = read(sockfd, response, MAX_CONTENT_SIZE);
-    while ((read_size = read(sockfd, buf, MAX_CONTENT_SIZE)) > 0)
-    {
-        memcpy(response + response_size, buf, read_size);
-        response_size += read_size;
-    }
-    if (response_size < 0)
-        fprintf(stderr, "[httpproxy] Failed to read from %s\n", hostname);
-    printf("[httpproxy] Received response from host %s\n", hostname);
-
-    close(sockfd);
-    free(buf);
-
-    return response_size;
+    // Gets port number
+    config->port = (unsigned)strtol(argv[optind], &rest, 10);
 }
 
-// Function  : putIntoCache
-// Arguments : Cache * of cache, char * of key, char * of response, and ssize_t
-//             of response_size
-// Does      : 1) Hashes the key
-//             2) Puts the key-response pair in an appropriate place in cache
-// Returns   : nothing
-void
-putIntoCache(Cache *cache, char *key, char *response, ssize_t response_size)
+// Function  : openListener
+// Arguments : unsigned of port number, int of listen() backlog, and int of
+//             whether the socket joins the port's SO_REUSEPORT group
+// Does      : 1) creates a dual-stack IPv6 TCP socket that also accepts IPv4
+//                clients, or a plain IPv4 one where IPv6 is unavailable
+//             2) binds it to the port and listens without blocking
+// Returns   : int of the listening socket file descriptor
+int
+openListener(unsigned port, int backlog, int reusePort)
 {
-    CacheBlock *newBlock, *currBlock;
-    char *line_saveptr, *cache_saveptr, *rest;
-    char *str, *line, *token;
-    unsigned hash;
-    long maxAge = DEFAULT_MAXAGE;
-    char line_delim[3] = "\r\n";
-    char cache_delim[9] = "max-age=";
-
-    hash = hashKey(key);
-    printf("[httpproxy] Caching key %s into cache\n", key);
-
-    if (cache->numBlocks == CACHE_SIZE)
-    {
-        organizeCache(cache);
-        if (cache->numBlocks == CACHE_SIZE) // If none were stale
-            removeCacheBlock(cache, cache->lru);
-    }
-
-    // Find max age
-    str = strdup(response); // strtok_r manipulates the string
-    for (line = strtok_r(str, line_delim, &line_saveptr); line;
-         line = strtok_r(NULL, line_delim, &line_saveptr))
-    {
-        if (strstr(line, "Cache-Control: ") == line)
-        {
-            strtok_r(line, cache_delim, &cache_saveptr);
-            token = strtok_r(NULL, cache_delim, &cache_saveptr);
-            if (token) maxAge = strtol(token, &rest, 10);
-        }
-    }
-
-    newBlock = malloc(sizeof(*newBlock));
-    newBlock->key = malloc(strlen(key) + 1);
-    memcpy(newBlock->key, key, strlen(key) + 1);
-    newBlock->value = malloc(response_size);
-    memcpy(newBlock->value, response, response_size);
-    newBlock->size = response_size;
-    newBlock->production = time(NULL);
-    newBlock->expiration = newBlock->production + (time_t)maxAge;
-    
-    // Recent usage linked list operations
-    newBlock->moreRU = NULL; // New block is always the MRU
-    newBlock->lessRU = cache->mru;
-    if (!cache->lru) cache->lru = newBlock;
-    if (cache->mru) cache->mru->moreRU = newBlock;
-    cache->mru = newBlock;
+    int sockfd, ipv6 = 1, one = 1, zero = 0;
+    struct sockaddr_in6 addr6;
+    struct sockaddr_in addr;
 
-    // Hash map operations
-    currBlock = cache->hashMap[hash];
-    if (currBlock) // If there's something already in hash at position hash
+    // Create a TCP socket
+    sockfd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sockfd >= 0)
     {
-        while (currBlock->hmNext) currBlock = currBlock->hmNext;
-        currBlock->hmNext = newBlock;
-        newBlock->hmPrev = currBlock;
+        setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        bzero((char *) &addr6, sizeof(addr6));
+        addr6.sin6_family = AF_INET6;
+        addr6.sin6_addr = in6addr_any;
+        addr6.sin6_port = htons(port);
     }
-    else // If there's nothing at hashed yet
+    else
     {
-        cache->hashMap[hash] = newBlock;
-        newBlock->hmPrev = NULL;
+        ipv6 = 0;
+        sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
     }
-    newBlock->hmNext = NULL; // New block always at the end of a hash chaining
-
-    cache->numBlocks++;
-
-    free(str);
-}
-
-// Function  : getFromCache
-// Arguments : Cache * of cache, char * of key, and char * of response
-// Does      : 1) Searches HTTP response in cache for the given key
-//             2) If found, inserts "Age" field to the HTTP header
-//             2) returns/fills in the response with the corresponding response
-// Returns   : ssize_t of response size
-ssize_t
-getFromCache(Cache *cache, char *key, char *response)
-{
-    CacheBlock *curr;
-    unsigned hash;
-    time_t age;
-    ssize_t response_size;
-
-    hash = hashKey(key);
-
-    organizeCache(cache);
-
-    curr = cache->hashMap[hash];
-    while (curr)
+    if (sockfd < 0)
     {
-        if (strcmp(key, curr->key) == 0)
-        {
-            response_size = curr->size;
-            memcpy(response, curr->value, response_size);
-            age = time(NULL) - curr->production;
-
-            // Add age field
-            response_size = addAgeField(response, response_size, age);
-
-            printf("[httpproxy] Retrieving cache with key %s\n", key);
-
-            // Update recent usage linked list
-            if (curr != cache->mru)
-            {
-                if (curr == cache->lru)cache->lru = curr->moreRU;
-                if (curr->moreRU) curr->moreRU->lessRU = curr->lessRU;
-                if (curr->lessRU) curr->lessRU->moreRU = curr->moreRU;
-                curr->moreRU = NULL;
-                curr->lessRU = cache->mru;
-                cache->mru->moreRU = curr;
-                cache->mru = curr;
-            }
-
-            return response_size;
-        }
-
-        curr = curr->hmNext;
+        fprintf(stderr, "[httpproxy] Failed to create socket in main()\n");
+        exit(EXIT_FAILURE);
     }
 
-    return 0;
-}
-
-// Function  : organizeCache
-// Arguments : Cache * of cache
-// Does      : 1) removes stale cache block
-// Returns   : nothing
-void
-organizeCache(Cache *cache)
-{
-    CacheBlock *curr, *next;
-
-    printf("[httpproxy] Organizing cache...\n");
+    // Allow rebinding while connections from a previous run sit in TIME_WAIT
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reusePort)
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
 
-    curr = cache->mru;
-    while (curr)
+    // Bind socket to the port number
+    bzero((char *) &addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if ((ipv6 ?
+         bind(sockfd, (struct sockaddr *)&addr6, sizeof(addr6)) :
+         bind(sockfd, (struct sockaddr *)&addr, sizeof(addr))) < 0)
     {
-        next = curr->lessRU;
-
-        if (curr->expiration < time(NULL)) // if stale
-        {
-            removeCacheBlock(cache, curr);
-        }
-
-        curr = next;
+        fprintf(stderr, "[httpproxy] Failed to bind socket to port %d\n",
+                port);
+        exit(EXIT_FAILURE);
     }
-}
-
-// Function  : removeCacheBlock
-// Arguments : Cache * of cache, CacheBlock * of block that needs to be deleted
-// Does      : 1) This function is called when space needs to be cleared up
-//             2) removes any stale cache block
-//             3) if it's still full, remove the LRU block
-// Returns   : nothing
-void
-removeCacheBlock(Cache *cache, CacheBlock *block)
-{
-    unsigned hash;
 
-    printf("[httpproxy] Removing stale cache with key %s\n", block->key);
-
-    // Recent usage linked list operation: remove
-    if (block == cache->mru) cache->mru = block->lessRU;
-    if (block == cache->lru) cache->lru = block->moreRU;
-    if (block->moreRU) block->moreRU->lessRU = block->lessRU;
-    if (block->lessRU) block->lessRU->moreRU = block->moreRU;
-
-    // Hash map chaining operation: remove
-    hash = hashKey(block->key);
-    if (block == cache->hashMap[hash]) cache->hashMap[hash] = block->hmNext;
-    if (block->hmPrev) block->hmPrev->hmNext = block->hmNext;
-    if (block->hmNext) block->hmNext->hmPrev = block->hmPrev;
-
-    free(block->key);
-    free(block->value);
-    free(block);
-    cache->numBlocks--;
-
-    printf("[httpproxy] Done removing cache block\n");
-}
-
-// Function  : printCache
-// Arguments : Cache * of cache, char * of key, and char * of response
-// Does      : 1) Searches the cache for the key
-//             2) returns/fills in the response with the corresponding response
-// Returns   : nothing
-void
-printCache(Cache *cache)
-{
-    CacheBlock *curr, *prev;
-    unsigned counter = 0;
-
-    curr = cache->mru;
-    while (curr)
+    // Listen, without blocking in accept() so the event loop stays live
+    if (listen(sockfd, backlog) != 0)
     {
-        prev = curr;
-        curr = curr->lessRU;
-        printf("[httpproxy] Cache Block %d\n", counter);
-        printf("[httpproxy]         Key: %s\n", prev->key);
-        printf("[httpproxy]         Size: %ld\n", prev->size);
-        printf("[httpproxy]         Production: %d\n", prev->production);
-        printf("[httpproxy]         Expiration: %d\n", prev->expiration);
-        counter++;
-
-        if (counter > CACHE_SIZE)
-        {
-            printf("[httpproxy] Cache size violated!\n");
-            break;
-        }
+        fprintf(stderr, "[httpproxy] Failed listening on socket\n");
+        fprintf(stderr, "[httpproxy] errno: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
-}
-
-// Function  : hashKey
-// Arguments : char * of a string key
-// Does      : 1) hashes the string key into an integer index
-// Returns   : unsigned of hashed value
-// Reference : The C Programming Language (Kernighan & Ritchie), Section 6.6
-unsigned
-hashKey(char *key)
-{
-    unsigned hashval;
 
-    for (hashval = 0; *key != '\0'; key++)
-        hashval = *key + 31 * hashval;
-
-    return hashval % HASH_SIZE;
+    return sockfd;
 }
-
-// Function  : addAgeField
-// Arguments : char * of response, ssize_t of response_size, and time_t of age
-// Does      : 1) adds the age field to the HTTP response
-// Returns   : ssize_t of new response_size
-ssize_t
-addAgeField(char *response, ssize_t response_size, time_t age)
-{
-    size_t offset;
-    char *originalCopy;
-    char *save_ptr;
-    char *str, *token;
-    char line_delim[3] = "\r\n";
-    char age_header[6] = "Age: ";
-    char ageStr[256];
-
-    printf("[httpproxy] Adding age field\n");
-
-    offset = 0;
-    originalCopy = malloc(response_size);
-    str = malloc(response_size);
-    memcpy(originalCopy, response, response_size);
-    memcpy(str, response, response_size);
-    sprintf(ageStr, "%ld", age);
-
-    // Add age field
-    token = strtok_r(str, line_delim, &save_ptr); // First line
-    memcpy(response + offset, token, strlen(token));
-    offset += strlen(token);
-    memcpy(response + offset, line_delim, strlen(line_delim));
-    offset += strlen(line_delim);
-    memcpy(response + offset, age_header, strlen(age_header));
-    offset += strlen(age_header);
-    memcpy(response + offset, ageStr, strlen(ageStr));
-    offset += strlen(ageStr);
-    memcpy(response + offset, line_delim, strlen(line_delim));
-    offset += strlen(line_delim);
-    memcpy(response + offset,
-           originalCopy + strlen(token) + strlen(line_delim),
-           response_size - (strlen(token) + strlen(line_delim)));
-
-    free(str);
-    free(originalCopy);
-
-    return response_size + strlen(age_header) + (2 * strlen(line_delim)) + 
-           strlen(ageStr);
-}
\ No newline at end of file
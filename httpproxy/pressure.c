@@ -0,0 +1,213 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Cache sizing under memory pressure. The cache may hold config->cacheBytes,
+// but in a container the proxy should give memory back before the kernel
+// reclaims it the hard way or kills the proxy. The event loop watches the
+// cgroup v2 memory.pressure file with a PSI trigger (fired when tasks stall
+// on memory for config->pressureStall ms per second, over a two-second
+// window, the shortest unprivileged processes may ask for) and memory.events
+// (which changes when the cgroup goes over memory.high or memory.max). Each
+// signal lowers the cache's byte limit to three quarters of what it holds,
+// and adjustCache() evicts down to it PRESSURE_EVICT_BATCH blocks per loop
+// iteration so no single iteration stalls. Once the pressure has been gone
+// for PRESSURE_CALM seconds, the limit grows back by an eighth of the ceiling
+// per second.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+#include "httpproxy.h"
+
+static char *cgroupDirectory();
+static unsigned long readMemoryEvents(int fd);
+
+// Function  : openPressure
+// Arguments : Proxy * of proxy
+// Does      : 1) finds the proxy's cgroup v2 directory
+//             2) registers a PSI trigger on its memory.pressure, falling back
+//                to the system-wide /proc/pressure/memory
+//             3) opens its memory.events, if it has one
+//             4) watches both for EPOLLPRI
+// Returns   : nothing
+void
+openPressure(Proxy *proxy)
+{
+    char path[PATH_MAX], trigger[64], *directory;
+    int length;
+
+    proxy->pressureFd = proxy->eventsFd = -1;
+    if (proxy->config->pressureStall <= 0) return;
+
+    directory = cgroupDirectory();
+    length = snprintf(trigger, sizeof(trigger), "some %ld 2000000",
+                      proxy->config->pressureStall * 2000);
+
+    if (directory)
+    {
+        snprintf(path, sizeof(path), "%s/memory.pressure", directory);
+        proxy->pressureFd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    }
+    if (proxy->pressureFd < 0)
+        proxy->pressureFd = open("/proc/pressure/memory",
+                                 O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (proxy->pressureFd >= 0 &&
+        write(proxy->pressureFd, trigger, length + 1) < 0)
+    {
+        close(proxy->pressureFd);
+        proxy->pressureFd = -1;
+    }
+    if (proxy->pressureFd >= 0)
+        watchFd(proxy, proxy->pressureFd, EPOLLPRI);
+    else
+        fprintf(stderr, "[httpproxy] No memory pressure information, the "
+                "cache stays at its ceiling\n");
+
+    if (directory)
+    {
+        snprintf(path, sizeof(path), "%s/memory.events", directory);
+        proxy->eventsFd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (proxy->eventsFd >= 0)
+        {
+            proxy->memoryEvents = readMemoryEvents(proxy->eventsFd);
+            watchFd(proxy, proxy->eventsFd, EPOLLPRI);
+        }
+    }
+    free(directory);
+}
+
+// Function  : handlePressure
+// Arguments : Proxy * of proxy, and int of the descriptor that fired
+// Does      : 1) ignores memory.events changes other than going over
+//                memory.high or memory.max (or an OOM kill)
+//             2) lowers the cache's byte limit to three quarters of its
+//                contents, no lower than MIN_CACHE_BYTES
+// Returns   : nothing
+void
+handlePressure(Proxy *proxy, int fd)
+{
+    Cache *cache = proxy->cache;
+    unsigned long events;
+    size_t limit;
+
+    if (fd == proxy->eventsFd)
+    {
+        events = readMemoryEvents(fd);
+        if (events == proxy->memoryEvents) return;
+        proxy->memoryEvents = events;
+    }
+
+    limit = cache->bytes - cache->bytes / 4;
+    if (limit < MIN_CACHE_BYTES) limit = MIN_CACHE_BYTES;
+    if (limit < cache->byteLimit) cache->byteLimit = limit;
+    proxy->pressuredAt = nowMs();
+
+    fprintf(stderr, "[httpproxy] Memory pressure (%s), cache limited to %zu "
+            "bytes\n", fd == proxy->eventsFd ? "memory.events" : "PSI",
+            cache->byteLimit);
+}
+
+// Function  : adjustCache
+// Arguments : Proxy * of proxy
+// Does      : 1) evicts a batch of LRU blocks while the cache is over its
+//                limit
+//             2) grows the limit back toward the ceiling, once a second, when
+//                there has been no pressure for PRESSURE_CALM seconds
+// Returns   : long long of ms until the next adjustment is due, or -1 if none
+long long
+adjustCache(Proxy *proxy)
+{
+    Cache *cache = proxy->cache;
+    long long now;
+
+    if (cache->bytes > cache->byteLimit)
+    {
+        trimCache(cache, PRESSURE_EVICT_BATCH);
+        if (cache->bytes > cache->byteLimit) return 0;
+    }
+
+    if (cache->byteLimit >= cache->maxBytes) return -1;
+
+    now = nowMs();
+    if (now < proxy->pressuredAt + PRESSURE_CALM * 1000)
+        return proxy->pressuredAt + PRESSURE_CALM * 1000 - now;
+    if (now < proxy->grewAt + 1000) return proxy->grewAt + 1000 - now;
+
+    cache->byteLimit += cache->maxBytes / 8;
+    if (cache->byteLimit > cache->maxBytes) cache->byteLimit = cache->maxBytes;
+    proxy->grewAt = now;
+    printf("[httpproxy] Memory pressure gone, cache limited to %zu bytes\n",
+           cache->byteLimit);
+
+    return cache->byteLimit < cache->maxBytes ? 1000 : -1;
+}
+
+// Function  : cgroupDirectory
+// Arguments : nothing
+// Does      : reads the proxy's cgroup v2 path from /proc/self/cgroup and
+//             finds where the unified hierarchy is mounted
+// Returns   : char * of the directory, which the caller frees, or NULL
+static char *
+cgroupDirectory()
+{
+    char line[PATH_MAX], *directory = NULL;
+    const char *mount;
+    FILE *file;
+    size_t length;
+
+    // Pure cgroup v2, or the unified part of a hybrid setup
+    if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+        mount = "/sys/fs/cgroup";
+    else if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) == 0)
+        mount = "/sys/fs/cgroup/unified";
+    else
+        return NULL;
+
+    file = fopen("/proc/self/cgroup", "r");
+    if (!file) return NULL;
+    while (!directory && fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, "0::", 3) != 0) continue;
+        length = strcspn(line + 3, "\n");
+        line[3 + length] = 0;
+        directory = malloc(strlen(mount) + length + 1);
+        sprintf(directory, "%s%s", mount, line + 3);
+    }
+    fclose(file);
+
+    return directory;
+}
+
+// Function  : readMemoryEvents
+// Arguments : int of the memory.events descriptor
+// Does      : rereads the file, which also rearms its notification, and adds
+//             up the high, max and oom_kill counters
+// Returns   : unsigned long of the sum
+static unsigned long
+readMemoryEvents(int fd)
+{
+    char buffer[512], *line;
+    unsigned long sum = 0, count;
+    ssize_t size;
+
+    size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0) return 0;
+    buffer[size] = 0;
+
+    for (line = buffer; line && *line; line = strchr(line, '\n'))
+    {
+        if (*line == '\n') line++;
+        if (sscanf(line, "high %lu", &count) == 1 ||
+            sscanf(line, "max %lu", &count) == 1 ||
+            sscanf(line, "oom_kill %lu", &count) == 1)
+            sum += count;
+    }
+
+    return sum;
+}
@@ -0,0 +1,202 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Cache prewarming. URLs from a manifest file (one per line) or from the
+// /__prewarm admin endpoint are queued and fetched by connections that have
+// no client: they run the usual CONNECTING .. READING_RESPONSE states, store
+// the response with putIntoCache(), and close. At most
+// config->prewarmConcurrency of them are in flight at once, so a long
+// manifest does not crowd out client traffic.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "httpproxy.h"
+
+// Function  : loadManifest
+// Arguments : Proxy * of proxy and char * of the manifest file path
+// Does      : queues every URL in the file, until the queue is full; blank
+//             lines and lines starting with '#' are skipped. Each worker
+//             loads the whole file, since any of them may get the request
+// Returns   : int of number of URLs queued, -1 if the file can't be read, or
+//             -2 if the queue filled up before the end of the file
+int
+loadManifest(Proxy *proxy, char *path)
+{
+    FILE *manifest;
+    char line[MAX_REQUEST_SIZE];
+    char *url;
+    int queued = 0, result = 0;
+
+    manifest = fopen(path, "r");
+    if (!manifest)
+    {
+        fprintf(stderr, "[httpproxy] Failed to open manifest %s\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), manifest))
+    {
+        url = line + strspn(line, " \t");
+        url[strcspn(url, " \t\r\n")] = 0;
+        if (*url == 0 || *url == '#') continue;
+        result = queuePrewarm(proxy, url);
+        if (result == 0) queued++;
+        if (result == -2)
+        {
+            fprintf(stderr, "[httpproxy] Prewarm queue is full, skipping the "
+                    "rest of manifest %s\n", path);
+            break;
+        }
+    }
+
+    fclose(manifest);
+    printf("[httpproxy] Queued %d URLs from manifest %s\n", queued, path);
+
+    return result == -2 ? -2 : queued;
+}
+
+// Function  : queuePrewarm
+// Arguments : Proxy * of proxy and char * of an absolute http:// URL
+// Does      : appends a copy of the URL to the prewarm queue, unless
+//             MAX_PREWARM_QUEUE URLs are waiting already
+// Returns   : 0 on success, -1 if the URL is not absolute http://, -2 if the
+//             queue is full
+int
+queuePrewarm(Proxy *proxy, char *url)
+{
+    char *key;
+
+    key = normalizeKey(url, NULL);
+    if (!key || strlen(url) > MAX_REQUEST_SIZE / 2)
+    {
+        fprintf(stderr, "[httpproxy] Not prewarming malformed URL %s\n", url);
+        free(key);
+        return -1;
+    }
+    free(key);
+
+    if (proxy->numPrewarm - proxy->nextPrewarm >= MAX_PREWARM_QUEUE)
+        return -2;
+
+    // Reuse the slots of URLs already started before growing
+    if (proxy->numPrewarm == proxy->prewarmCapacity && proxy->nextPrewarm > 0)
+    {
+        memmove(proxy->prewarmUrls, proxy->prewarmUrls + proxy->nextPrewarm,
+                (proxy->numPrewarm - proxy->nextPrewarm) * sizeof(char *));
+        proxy->numPrewarm -= proxy->nextPrewarm;
+        proxy->nextPrewarm = 0;
+    }
+    if (proxy->numPrewarm == proxy->prewarmCapacity)
+    {
+        proxy->prewarmCapacity = proxy->prewarmCapacity ?
+                                 2 * proxy->prewarmCapacity : 16;
+        proxy->prewarmUrls = realloc(proxy->prewarmUrls,
+                                     proxy->prewarmCapacity * sizeof(char *));
+    }
+    proxy->prewarmUrls[proxy->numPrewarm++] = strdup(url);
+
+    return 0;
+}
+
+// Function  : startPrewarms
+// Arguments : Proxy * of proxy
+// Does      : starts fetches from the queue until the concurrency limit is
+//             reached or the queue is empty
+// Returns   : nothing
+void
+startPrewarms(Proxy *proxy)
+{
+    Connection *conn;
+    char *url, *authority;
+    size_t authorityLength;
+
+    while (proxy->nextPrewarm < proxy->numPrewarm &&
+           proxy->activePrewarm < proxy->config->prewarmConcurrency)
+    {
+        url = proxy->prewarmUrls[proxy->nextPrewarm++];
+        authority = url + strlen("http://");
+        authorityLength = strcspn(authority, "/?#");
+
+        conn = calloc(1, sizeof(Connection));
+        conn->prewarm = 1;
+        conn->clientFd = -1;
+        conn->upstreamFd = -1;
+        conn->up.pipe[0] = conn->up.pipe[1] = -1;
+        conn->down.pipe[0] = conn->down.pipe[1] = -1;
+        conn->started = conn->lastActivity = nowMs();
+        conn->timerIndex = NO_TIMER;
+        conn->request = malloc(MAX_REQUEST_SIZE + 1);
+        conn->requestSize = snprintf(conn->request, MAX_REQUEST_SIZE + 1,
+                                     "GET %s HTTP/1.1\r\nHost: %.*s\r\n"
+                                     "Connection: close\r\n\r\n", url,
+                                     (int)authorityLength, authority);
+        conn->parsed = parseRequest(conn->request, &conn->method, &conn->key,
+                                    &conn->host);
+        conn->cacheKey = normalizeKey(conn->key, conn->host);
+        conn->response = malloc(MAX_CONTENT_SIZE);
+        free(url);
+
+        proxy->activePrewarm++;
+        printf("[httpproxy] Prewarming %s\n", conn->cacheKey);
+        queryServer(proxy, conn, conn->host, DEFAULT_PORT);
+    }
+
+    // Everything has been started; reuse the queue from the front
+    if (proxy->nextPrewarm == proxy->numPrewarm)
+        proxy->nextPrewarm = proxy->numPrewarm = 0;
+}
+
+// Function  : handlePrewarmRequest
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : serves the admin endpoint, to clients that adminAllowed() lets
+//             through:
+//             GET /__prewarm           re-reads the configured manifest
+//             GET /__prewarm?<URL>     queues one absolute http:// URL
+//             and answers 503 once the queue is full; valid requests are
+//             passed on to the other workers
+// Returns   : nothing
+void
+handlePrewarmRequest(Proxy *proxy, Connection *conn)
+{
+    char message[64];
+    char *url;
+    int queued;
+
+    if (!adminAllowed(proxy, conn)) return;
+
+    url = strchr(conn->key, '?');
+    if (url)
+    {
+        queued = queuePrewarm(proxy, url + 1);
+        if (queued == 0) queued = 1;
+    }
+    else if (proxy->config->prewarmFile)
+        queued = loadManifest(proxy, proxy->config->prewarmFile);
+    else
+    {
+        sendError(proxy, conn, "404 Not Found", "No manifest configured\n");
+        return;
+    }
+    if (queued != -1) forwardAdmin(proxy, conn->key);
+
+    if (queued == -2)
+    {
+        sendError(proxy, conn, "503 Service Unavailable",
+                  "Prewarm queue is full\n");
+        return;
+    }
+
+    if (queued < 0)
+    {
+        sendError(proxy, conn, "400 Bad Request", url ? "Malformed URL\n" :
+                  "Failed to read the manifest\n");
+        return;
+    }
+
+    snprintf(message, sizeof(message), "Queued %d URLs\n", queued);
+    sendError(proxy, conn, "202 Accepted", message);
+}
@@ -0,0 +1,1777 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// The proxy's event loop. Every client connection is a small state machine
+// (see ConnectionState) driven by epoll readiness on its client and upstream
+// sockets, so a slow origin or a long-lived CONNECT tunnel no longer holds up
+// everyone else. Deadlines live in a binary min-heap keyed on each
+// connection's next deadline.
+
+#define _GNU_SOURCE // splice()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "httpproxy.h"
+
+#define TUNNEL_ESTABLISHED "HTTP/1.1 200 Connection Established\r\n\r\n"
+
+// Function  : deadlineAfter
+// Arguments : long of milliseconds from now
+// Does      : turns a configured timeout into an absolute deadline
+// Returns   : long long of deadline, or 0 when the timeout is disabled (<= 0)
+static long long
+deadlineAfter(long ms)
+{
+    return ms > 0 ? nowMs() + ms : 0;
+}
+
+// Function  : createProxy
+// Arguments : int of the listening socket, Cache * of cache, and Config * of
+//             configuration
+// Does      : 1) sizes the descriptor-to-connection table from RLIMIT_NOFILE
+//             2) sets up the io_uring backend if asked to, or else (and as
+//                its fallback) creates the epoll instance and registers the
+//                listener
+//             3) opens the handoff socket and the trace target, if configured
+//             4) starts watching for memory pressure
+// Returns   : Proxy * of proxy
+Proxy *
+createProxy(int listenFd, Cache *cache, Config *config)
+{
+    Proxy *proxy;
+    struct rlimit limit;
+    struct epoll_event event;
+
+    proxy = calloc(1, sizeof(Proxy));
+    proxy->listenFd = listenFd;
+    proxy->cache = cache;
+    proxy->config = config;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        proxy->maxFds = (int)limit.rlim_cur;
+    else
+        proxy->maxFds = 65536;
+    proxy->connections = calloc(proxy->maxFds, sizeof(Connection *));
+
+    proxy->epollFd = -1;
+    if (config->ioUring)
+        proxy->uring = createUring(listenFd, proxy->maxFds);
+
+    if (!proxy->uring)
+    {
+        proxy->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (proxy->epollFd < 0)
+        {
+            fprintf(stderr, "[httpproxy] epoll_create1() failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        event.events = EPOLLIN;
+        event.data.fd = listenFd;
+        if (epoll_ctl(proxy->epollFd, EPOLL_CTL_ADD, listenFd, &event) < 0)
+        {
+            fprintf(stderr, "[httpproxy] Failed to watch the listening "
+                    "socket\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Wait for the next process to take over
+    proxy->controlFd = -1;
+    if (config->handoffPath)
+    {
+        proxy->controlFd = openControl(config->handoffPath);
+        if (proxy->controlFd >= 0) watchFd(proxy, proxy->controlFd, EPOLLIN);
+    }
+
+    proxy->traceFd = config->tracePath ? openTrace(config->tracePath) : -1;
+    openPressure(proxy);
+    if (config->adminFd >= 0) watchFd(proxy, config->adminFd, EPOLLIN);
+
+    return proxy;
+}
+
+// Function  : deleteProxy
+// Arguments : Proxy * of proxy
+// Does      : closes every open connection and frees the proxy
+// Returns   : nothing
+void
+deleteProxy(Proxy *proxy)
+{
+    int fd;
+
+    for (fd = 0; fd < proxy->maxFds; fd++)
+        if (proxy->connections[fd]) closeConnection(proxy, proxy->connections[fd]);
+
+    for (; proxy->nextPrewarm < proxy->numPrewarm; proxy->nextPrewarm++)
+        free(proxy->prewarmUrls[proxy->nextPrewarm]);
+    free(proxy->prewarmUrls);
+
+    if (proxy->controlFd >= 0) close(proxy->controlFd);
+    if (proxy->traceFd >= 0) close(proxy->traceFd);
+    if (proxy->pressureFd >= 0) close(proxy->pressureFd);
+    if (proxy->eventsFd >= 0) close(proxy->eventsFd);
+    if (proxy->uring)
+        deleteUring(proxy->uring);
+    else
+        close(proxy->epollFd);
+    free(proxy->connections);
+    free(proxy->timers);
+    deleteClients(proxy);
+    free(proxy);
+}
+
+// Function  : runProxy
+// Arguments : Proxy * of proxy
+// Does      : waits for socket readiness or the next deadline and dispatches
+//             to the connection state machines, and resizes the cache to the
+//             memory available, until MAX_SERVING_SIZE
+//             requests have been served, or until the connections left after
+//             handing the listener over are done
+// Returns   : nothing
+void
+runProxy(Proxy *proxy)
+{
+    long long timeout, adjustment;
+
+    while (proxy->served < MAX_SERVING_SIZE)
+    {
+        // After a handoff, run until the old connections are done
+        if (proxy->draining &&
+            (proxy->numClients + proxy->activePrewarm == 0 ||
+             nowMs() >= proxy->drainDeadline))
+        {
+            printf("[httpproxy] Drained, %u connections left\n",
+                   proxy->numClients + proxy->activePrewarm);
+            break;
+        }
+
+        if (proxy->nextPrewarm < proxy->numPrewarm) startPrewarms(proxy);
+        adjustment = adjustCache(proxy);
+
+        timeout = -1;
+        if (proxy->numTimers)
+        {
+            timeout = proxy->timers[0]->deadline - nowMs();
+            if (timeout < 0) timeout = 0;
+        }
+        if (proxy->draining &&
+            (timeout < 0 || timeout > proxy->drainDeadline - nowMs()))
+            timeout = proxy->drainDeadline - nowMs();
+        if (adjustment >= 0 && (timeout < 0 || timeout > adjustment))
+            timeout = adjustment;
+
+        if (proxy->uring)
+            dispatchUring(proxy, timeout);
+        else
+            dispatchEpoll(proxy, timeout);
+
+        expireTimers(proxy);
+    }
+}
+
+// Function  : dispatchEpoll
+// Arguments : Proxy * of proxy and long long of timeout in ms (-1 for none)
+// Does      : waits for epoll events and hands them to the state machines
+// Returns   : nothing
+void
+dispatchEpoll(Proxy *proxy, long long timeout)
+{
+    struct epoll_event events[MAX_EVENTS];
+    Connection *conn;
+    int i, numEvents, fd;
+
+    numEvents = epoll_wait(proxy->epollFd, events, MAX_EVENTS, (int)timeout);
+    if (numEvents < 0)
+    {
+        if (errno == EINTR) return;
+        fprintf(stderr, "[httpproxy] epoll_wait() failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < numEvents; i++)
+    {
+        fd = events[i].data.fd;
+        if (fd == proxy->listenFd)
+        {
+            acceptClients(proxy);
+            continue;
+        }
+        if (fd == proxy->controlFd)
+        {
+            serveHandoff(proxy);
+            continue;
+        }
+        if (fd == proxy->pressureFd || fd == proxy->eventsFd)
+        {
+            handlePressure(proxy, fd);
+            continue;
+        }
+        if (fd == proxy->config->adminFd)
+        {
+            receiveAdmin(proxy);
+            continue;
+        }
+
+        // The connection may have been closed by an earlier event
+        conn = proxy->connections[fd];
+        if (conn) handleEvent(proxy, conn, fd, events[i].events);
+    }
+}
+
+// Function  : dispatchUring
+// Arguments : Proxy * of proxy and long long of timeout in ms (-1 for none)
+// Does      : submits the queued io_uring operations, waits for completions
+//             and hands them to the state machines: new clients, received
+//             request bytes, and readiness, after which the one-shot poll is
+//             re-armed
+// Returns   : nothing
+void
+dispatchUring(Proxy *proxy, long long timeout)
+{
+    UringEvent events[MAX_EVENTS];
+    Connection *conn;
+    int i, numEvents, fd;
+
+    numEvents = waitUring(proxy->uring, timeout, events, MAX_EVENTS);
+    if (numEvents < 0)
+    {
+        fprintf(stderr, "[httpproxy] io_uring_enter() failed, errno %d\n",
+                errno);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < numEvents; i++)
+    {
+        fd = events[i].fd;
+        if (events[i].op == URING_ACCEPT)
+        {
+            addClient(proxy, fd);
+            continue;
+        }
+        if (fd == proxy->controlFd)
+        {
+            serveHandoff(proxy);
+            if (proxy->controlFd >= 0) rearmUring(proxy->uring, fd);
+            continue;
+        }
+        if (fd == proxy->pressureFd || fd == proxy->eventsFd)
+        {
+            handlePressure(proxy, fd);
+            rearmUring(proxy->uring, fd);
+            continue;
+        }
+        if (fd == proxy->config->adminFd)
+        {
+            receiveAdmin(proxy);
+            rearmUring(proxy->uring, fd);
+            continue;
+        }
+
+        conn = proxy->connections[fd];
+        if (!conn) continue;
+
+        if (events[i].op == URING_RECV)
+            receiveRequest(proxy, conn, events[i].data, events[i].res);
+        else
+        {
+            handleEvent(proxy, conn, fd, events[i].res);
+            rearmUring(proxy->uring, fd);
+        }
+    }
+}
+
+// Function  : acceptClients
+// Arguments : Proxy * of proxy
+// Does      : accepts every pending connection request
+// Returns   : nothing
+void
+acceptClients(Proxy *proxy)
+{
+    int fd;
+
+    for (;;)
+    {
+        fd = accept4(proxy->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED)
+                fprintf(stderr, "[httpproxy] Failed accepting connection "
+                        "request, errno %d\n", errno);
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        addClient(proxy, fd);
+    }
+}
+
+// Function  : addClient
+// Arguments : Proxy * of proxy and int of the accepted, non-blocking socket
+// Does      : unless admitClient() turns the client away, creates its
+//             connection and starts reading its HTTP request, under the
+//             header deadline; the request buffer is allocated when bytes
+//             arrive
+// Returns   : nothing
+void
+addClient(Proxy *proxy, int fd)
+{
+    Connection *conn;
+    ClientBucket *bucket;
+    long long queued;
+
+    if (fd >= proxy->maxFds)
+    {
+        close(fd);
+        return;
+    }
+    if (admitClient(proxy, fd, &bucket, &queued) < 0) return;
+    printf("[httpproxy] Accepted connection request\n");
+
+    conn = calloc(1, sizeof(Connection));
+    conn->client = bucket;
+    conn->clientFd = fd;
+    conn->upstreamFd = -1;
+    conn->up.pipe[0] = conn->up.pipe[1] = -1;
+    conn->down.pipe[0] = conn->down.pipe[1] = -1;
+    conn->state = READING_REQUEST;
+    conn->started = conn->lastActivity = nowMs();
+    conn->timerIndex = NO_TIMER;
+    conn->marks[MARK_QUEUED] = queued;
+    conn->marks[MARK_ACCEPTED] = nowUs();
+    conn->headerDeadline = deadlineAfter(proxy->config->headerTimeout);
+    proxy->connections[fd] = conn;
+    armTimer(proxy, conn);
+
+    // io_uring receives the header itself, without polling first
+    if (proxy->uring)
+        receiveUring(proxy->uring, fd, MAX_REQUEST_SIZE);
+    else
+    {
+        conn->clientEvents = EPOLLIN;
+        watchFd(proxy, fd, EPOLLIN);
+    }
+}
+
+// Function  : handleEvent
+// Arguments : Proxy * of proxy, Connection * of connection, int of the ready
+//             descriptor, and unsigned of epoll events
+// Does      : advances the connection's state machine
+// Returns   : nothing
+void
+handleEvent(Proxy *proxy, Connection *conn, int fd, unsigned events)
+{
+    // The client went away while we were busy with the origin
+    if (fd == conn->clientFd && (events & (EPOLLERR | EPOLLHUP)) &&
+        conn->state != TUNNELING)
+    {
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    // The origin reset a stream, which may be paused for the client
+    if (fd == conn->upstreamFd && (events & (EPOLLERR | EPOLLHUP)) &&
+        conn->state == STREAMING_RESPONSE)
+    {
+        fprintf(stderr, "[httpproxy] Response from %s was cut short\n",
+                conn->target);
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    switch (conn->state)
+    {
+        case READING_REQUEST: readRequest(proxy, conn); break;
+        case CONNECTING: finishConnect(proxy, conn, fd); break;
+        case WRITING_REQUEST: writeRequest(proxy, conn); break;
+        case READING_RESPONSE: readResponse(proxy, conn); break;
+        case WRITING_RESPONSE: writeResponse(proxy, conn); break;
+        case STREAMING_RESPONSE: pumpStream(proxy, conn); break;
+        case TUNNELING: pumpTunnel(proxy, conn); break;
+    }
+}
+
+// Function  : readRequest
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) reads whatever the client has sent
+//             2) once the header is complete, handles the request
+// Returns   : nothing
+void
+readRequest(Proxy *proxy, Connection *conn)
+{
+    ssize_t read_size;
+
+    if (!conn->request) conn->request = malloc(MAX_REQUEST_SIZE + 1);
+
+    while ((read_size = read(conn->clientFd, conn->request + conn->requestSize,
+                             MAX_REQUEST_SIZE - conn->requestSize)) > 0)
+    {
+        conn->requestSize += read_size;
+        if (requestReceived(proxy, conn)) return;
+    }
+
+    if (read_size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        closeConnection(proxy, conn);
+}
+
+// Function  : receiveRequest
+// Arguments : Proxy * of proxy, Connection * of connection, char * of the
+//             provided buffer holding the bytes, and int of the receive's
+//             result: byte count, 0 at end of stream, or -errno
+// Does      : 1) appends bytes io_uring received to the request
+//             2) handles the request once the header is complete, or else
+//                receives again
+// Returns   : nothing
+void
+receiveRequest(Proxy *proxy, Connection *conn, char *data, int size)
+{
+    // Out of provided buffers: read this client the epoll way instead
+    if (size == -ENOBUFS)
+    {
+        conn->clientEvents = EPOLLIN;
+        watchFd(proxy, conn->clientFd, EPOLLIN);
+        return;
+    }
+    if (size <= 0 || !data)
+    {
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    if (!conn->request) conn->request = malloc(MAX_REQUEST_SIZE + 1);
+    memcpy(conn->request + conn->requestSize, data, size);
+    conn->requestSize += size;
+
+    if (!requestReceived(proxy, conn))
+        receiveUring(proxy->uring, conn->clientFd,
+                     MAX_REQUEST_SIZE - conn->requestSize);
+}
+
+// Function  : requestReceived
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : checks whether the bytes read so far complete the header, and
+//             if so handles the request; rejects headers that are too large
+// Returns   : 1 if the request was handled or rejected, 0 to keep reading
+int
+requestReceived(Proxy *proxy, Connection *conn)
+{
+    conn->request[conn->requestSize] = 0; // null-termination for strtok_r
+    if (strstr(conn->request, "\r\n\r\n"))
+    {
+        printf("[httpproxy] Read from the connection\n");
+        conn->marks[MARK_REQUEST_READ] = nowUs();
+        handleRequest(proxy, conn);
+        return 1;
+    }
+    if (conn->requestSize == MAX_REQUEST_SIZE)
+    {
+        sendError(proxy, conn, "431 Request Header Fields Too Large",
+                  "Request header too large\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// Function  : handleRequest
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) parses the request
+//             2) answers a GET or HEAD from the cache, or else asks the
+//                cluster peer owning the key or starts querying the origin;
+//                conditional requests are checked against the complete
+//                response, so the validators are kept aside
+//             3) starts a tunnel for CONNECT
+// Returns   : nothing
+void
+handleRequest(Proxy *proxy, Connection *conn)
+{
+    ssize_t response_size;
+    char *peer, *value;
+    size_t length;
+    int fromPeer;
+
+    printf("[httpproxy] Handling HTTP request\n");
+
+    conn->parsed = parseRequest(conn->request, &conn->method, &conn->key,
+                                &conn->host);
+    conn->marks[MARK_PARSED] = nowUs();
+    if (!conn->method || !conn->key)
+    {
+        sendError(proxy, conn, "400 Bad Request", "Malformed request line\n");
+        return;
+    }
+
+    if (strcmp(conn->method, "CONNECT") == 0)
+    {
+        conn->tunnel = 1;
+        queryServer(proxy, conn, conn->key, DEFAULT_TUNNEL_PORT);
+        return;
+    }
+
+    conn->head = strcmp(conn->method, "HEAD") == 0;
+    if (strcmp(conn->method, "GET") != 0 && !conn->head)
+    {
+        sendError(proxy, conn, "501 Not Implemented",
+                  "Only GET, HEAD and CONNECT are supported\n");
+        return;
+    }
+
+    // Admin endpoints, for requests addressed to the proxy itself
+    if (strncmp(conn->key, PREWARM_PATH, strlen(PREWARM_PATH)) == 0 &&
+        (conn->key[strlen(PREWARM_PATH)] == 0 ||
+         conn->key[strlen(PREWARM_PATH)] == '?'))
+    {
+        handlePrewarmRequest(proxy, conn);
+        return;
+    }
+    if (strncmp(conn->key, PURGE_PATH, strlen(PURGE_PATH)) == 0 &&
+        (conn->key[strlen(PURGE_PATH)] == 0 ||
+         conn->key[strlen(PURGE_PATH)] == '?'))
+    {
+        handlePurgeRequest(proxy, conn);
+        return;
+    }
+
+    if (!conn->host)
+    {
+        sendError(proxy, conn, "400 Bad Request", "Missing Host header\n");
+        return;
+    }
+
+    // A peer's marker is not for the origin
+    fromPeer = removeHeader(conn->request, &conn->requestSize, PEER_HEADER);
+
+    // Equivalent spellings of a URL share one cache entry
+    conn->cacheKey = normalizeKey(conn->key, conn->host);
+    if (!conn->cacheKey)
+    {
+        sendError(proxy, conn, "400 Bad Request", "Malformed request target\n");
+        return;
+    }
+
+    value = findKnownHeader(conn->request, HEADER_IF_NONE_MATCH, &length);
+    if (value) conn->ifNoneMatch = strndup(value, length);
+    value = findKnownHeader(conn->request, HEADER_IF_MODIFIED_SINCE, &length);
+    if (value) conn->ifModifiedSince = strndup(value, length);
+    while (removeHeader(conn->request, &conn->requestSize, "If-None-Match"));
+    while (removeHeader(conn->request, &conn->requestSize,
+                        "If-Modified-Since"));
+
+    // Query cache
+    conn->response = malloc(MAX_CONTENT_SIZE);
+    response_size = getFromCache(proxy->cache, conn->cacheKey, conn->request,
+                                 conn->response);
+    conn->marks[MARK_CACHE_CHECKED] = nowUs();
+    if (response_size > 0)
+    {
+        conn->source = "cache";
+        conn->responseSize = response_size;
+        shapeResponse(conn);
+        conn->state = WRITING_RESPONSE;
+        writeResponse(proxy, conn);
+        return;
+    }
+
+    // The response is complete when the origin closes, so ask it to
+    if (requestClose(conn->request, &conn->requestSize) < 0)
+    {
+        sendError(proxy, conn, "431 Request Header Fields Too Large",
+                  "Request header too large\n");
+        return;
+    }
+
+    // If the key-value pair was not in the cache, ask the peer that owns the
+    // key, unless a peer is asking us; otherwise query the server
+    peer = fromPeer ? NULL : choosePeer(proxy, conn->cacheKey);
+    if (peer)
+        forwardToPeer(proxy, conn, peer);
+    else
+        queryServer(proxy, conn, conn->host, DEFAULT_PORT);
+}
+
+// Function  : adminAllowed
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : answers 403 unless the client connected from loopback or sent
+//             the configured admin token in ADMIN_HEADER
+// Returns   : int of 1 if the admin request may go ahead, 0 if answered
+int
+adminAllowed(Proxy *proxy, Connection *conn)
+{
+    struct sockaddr_storage peer;
+    struct sockaddr_in *peer4;
+    struct sockaddr_in6 *peer6;
+    socklen_t length = sizeof(peer);
+    char *token = proxy->config->adminToken;
+    char *value;
+    size_t valueLength, i;
+    unsigned char differ = 0;
+
+    if (getpeername(conn->clientFd, (struct sockaddr *)&peer, &length) == 0)
+    {
+        peer4 = (struct sockaddr_in *)&peer;
+        peer6 = (struct sockaddr_in6 *)&peer;
+        if (peer.ss_family == AF_INET &&
+            ntohl(peer4->sin_addr.s_addr) >> 24 == 127)
+            return 1;
+        if (peer.ss_family == AF_INET6 &&
+            (IN6_IS_ADDR_LOOPBACK(&peer6->sin6_addr) ||
+             (IN6_IS_ADDR_V4MAPPED(&peer6->sin6_addr) &&
+              peer6->sin6_addr.s6_addr[12] == 127)))
+            return 1;
+    }
+
+    // Compare in constant time so the token can't be guessed byte by byte
+    value = findHeader(conn->request, ADMIN_HEADER, &valueLength);
+    if (token && value && valueLength == strlen(token))
+    {
+        for (i = 0; i < valueLength; i++)
+            differ |= value[i] ^ token[i];
+        if (!differ) return 1;
+    }
+
+    sendError(proxy, conn, "403 Forbidden",
+              "Admin endpoints need loopback or the admin token\n");
+    return 0;
+}
+
+// Function  : purgeTarget
+// Arguments : Proxy * of proxy and char * of the purge query:
+//             <URL>           drops every variant of the URL
+//             prefix=<URL>    drops every URL starting with it
+//             host=<hostname> drops every URL on the host, on any port
+// Does      : drops the cache entries the query names
+// Returns   : long of number of cache blocks purged, or -1 if the URL is
+//             malformed
+long
+purgeTarget(Proxy *proxy, char *argument)
+{
+    char *key;
+    unsigned purged;
+    int prefix;
+
+    if (strncmp(argument, "host=", 5) == 0)
+        purged = purgeCacheHost(proxy->cache, argument + 5);
+    else
+    {
+        // Spell the URL the way the cache keys it
+        prefix = strncmp(argument, "prefix=", 7) == 0;
+        key = normalizeKey(prefix ? argument + 7 : argument, NULL);
+        if (!key) return -1;
+        purged = prefix ? purgeCachePrefix(proxy->cache, key) :
+                          purgeCacheKey(proxy->cache, key);
+        free(key);
+    }
+
+    printf("[httpproxy] Purged %u cache blocks for %s\n", purged, argument);
+    return purged;
+}
+
+// Function  : handlePurgeRequest
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : serves the purge admin endpoint, GET /__purge?<query> (see
+//             purgeTarget()), to clients that adminAllowed() lets through,
+//             and passes the purge on to the other workers
+// Returns   : nothing
+void
+handlePurgeRequest(Proxy *proxy, Connection *conn)
+{
+    char message[64];
+    char *argument;
+    long purged;
+
+    if (!adminAllowed(proxy, conn)) return;
+
+    argument = strchr(conn->key, '?');
+    if (!argument || !argument[1])
+    {
+        sendError(proxy, conn, "400 Bad Request", "Nothing to purge\n");
+        return;
+    }
+
+    purged = purgeTarget(proxy, argument + 1);
+    if (purged < 0)
+    {
+        sendError(proxy, conn, "400 Bad Request", "Malformed URL\n");
+        return;
+    }
+    forwardAdmin(proxy, conn->key);
+
+    snprintf(message, sizeof(message), "Purged %ld entries\n", purged);
+    sendError(proxy, conn, "200 OK", message);
+}
+
+// Function  : queryServer
+// Arguments : Proxy * of proxy, Connection * of connection, char * of
+//             <hostname>[:<portnumber>], and long of the port to assume
+// Does      : 1) answers 502 at once if the origin failed to resolve or
+//                connect within the negative-cache TTL
+//             2) resolves every IPv6 and IPv4 address of the hostname
+//             3) orders them for Happy Eyeballs (RFC 8305) and starts racing
+//                non-blocking connects to them
+// Returns   : nothing
+void
+queryServer(Proxy *proxy, Connection *conn, char *hostport, long defaultPort)
+{
+    char hostname[MAX_HOST_LENGTH], service[8];
+    long portNum;
+    struct addrinfo hints, *list;
+    HostFailure *failure;
+    int status;
+
+    // Get hostname and port number
+    if (splitHostPort(hostport, hostname, sizeof(hostname), &portNum,
+                      defaultPort) < 0)
+    {
+        sendError(proxy, conn, "400 Bad Request", "Malformed host\n");
+        return;
+    }
+    snprintf(conn->target, sizeof(conn->target),
+             strchr(hostname, ':') ? "[%s]:%ld" : "%s:%ld", hostname, portNum);
+    snprintf(service, sizeof(service), "%ld", portNum);
+
+    // Fail fast for an origin that recently could not be reached
+    failure = getHostFailure(proxy->cache, conn->target);
+    if (failure)
+    {
+        fprintf(stderr, "[httpproxy] %s failed recently, not retrying yet\n",
+                conn->target);
+        sendError(proxy, conn, "502 Bad Gateway", failure->message);
+        return;
+    }
+
+    // Get server information
+    bzero((char *) &hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+    status = getaddrinfo(hostname, service, &hints, &list);
+    if (status != 0)
+    {
+        fprintf(stderr, "[httpproxy] No such host as %s\n", hostname);
+        fprintf(stderr, "[httpproxy] getaddrinfo: %s\n", gai_strerror(status));
+        putHostFailure(proxy->cache, conn->target, NO_SUCH_HOST,
+                       proxy->config->dnsFailureTtl);
+        sendError(proxy, conn, "502 Bad Gateway", NO_SUCH_HOST);
+        return;
+    }
+    conn->marks[MARK_RESOLVED] = nowUs();
+
+    conn->numAddresses = sortAddresses(list, NULL);
+    conn->addresses = malloc(conn->numAddresses * sizeof(Address));
+    sortAddresses(list, conn->addresses);
+    freeaddrinfo(list);
+    conn->attemptFds = malloc(conn->numAddresses * sizeof(int));
+
+    // Nothing to do for the client until the origin answers
+    setInterest(proxy, conn, conn->clientFd, 0);
+    conn->state = CONNECTING;
+    conn->connectDeadline = deadlineAfter(conn->peer ?
+                                          proxy->config->peerTimeout :
+                                          proxy->config->connectTimeout);
+    conn->totalDeadline = deadlineAfter(proxy->config->requestTimeout);
+    printf("[httpproxy] Connecting to host %s (%u addresses)\n", conn->target,
+           conn->numAddresses);
+    startAttempt(proxy, conn);
+}
+
+// Function  : sortAddresses
+// Arguments : struct addrinfo * of resolved addresses, and Address * to fill
+//             in, or NULL to only count
+// Does      : interleaves the address families, starting with the family
+//             getaddrinfo() preferred, so a broken family costs one attempt
+//             delay rather than one per address (RFC 8305, section 4)
+// Returns   : unsigned of number of addresses
+unsigned
+sortAddresses(struct addrinfo *list, Address *addresses)
+{
+    struct addrinfo *preferred = list, *other = list;
+    unsigned count = 0;
+    int family = list->ai_family;
+    int turn = 0;
+
+    for (;;)
+    {
+        while (preferred && preferred->ai_family != family)
+            preferred = preferred->ai_next;
+        while (other && other->ai_family == family) other = other->ai_next;
+        if (!preferred && !other) break;
+
+        // Alternate, falling back to whichever family has addresses left
+        if ((turn == 0 && preferred) || !other)
+        {
+            if (addresses)
+            {
+                memcpy(&addresses[count].addr, preferred->ai_addr,
+                       preferred->ai_addrlen);
+                addresses[count].length = preferred->ai_addrlen;
+            }
+            preferred = preferred->ai_next;
+        }
+        else
+        {
+            if (addresses)
+            {
+                memcpy(&addresses[count].addr, other->ai_addr,
+                       other->ai_addrlen);
+                addresses[count].length = other->ai_addrlen;
+            }
+            other = other->ai_next;
+        }
+        count++;
+        turn = !turn;
+    }
+
+    return count;
+}
+
+// Function  : startAttempt
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) starts a non-blocking connect to the next address, skipping
+//                addresses that fail outright
+//             2) schedules the attempt after it, or answers 502 once every
+//                address has failed
+// Returns   : nothing
+void
+startAttempt(Proxy *proxy, Connection *conn)
+{
+    Address *address;
+    unsigned i;
+    int sockfd;
+
+    conn->nextAttemptAt = 0;
+
+    while (conn->nextAddress < conn->numAddresses)
+    {
+        address = &conn->addresses[conn->nextAddress++];
+
+        // Create TCP socket
+        sockfd = socket(address->addr.ss_family,
+                        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd < 0 || sockfd >= proxy->maxFds)
+        {
+            fprintf(stderr, "[httpproxy] Failed to create socket in "
+                    "startAttempt\n");
+            if (sockfd >= 0) close(sockfd);
+            continue;
+        }
+
+        // Connect with the server; completion is reported as writability
+        if (connect(sockfd, (struct sockaddr *)&address->addr,
+                    address->length) < 0 && errno != EINPROGRESS)
+        {
+            close(sockfd);
+            continue;
+        }
+
+        conn->attemptFds[conn->numAttempts++] = sockfd;
+        proxy->connections[sockfd] = conn;
+        watchFd(proxy, sockfd, EPOLLOUT);
+
+        if (conn->nextAddress < conn->numAddresses)
+            conn->nextAttemptAt = nowMs() + proxy->config->attemptDelay;
+        armTimer(proxy, conn);
+        return;
+    }
+
+    // Out of addresses; give up only when no attempt is still in flight
+    for (i = 0; i < conn->numAttempts; i++)
+        if (conn->attemptFds[i] >= 0) return;
+
+    fprintf(stderr, "[httpproxy] Failed to connect to %s\n", conn->target);
+    putHostFailure(proxy->cache, conn->target, CONNECTION_FAIL,
+                   proxy->config->connectFailureTtl);
+    sendError(proxy, conn, "502 Bad Gateway", CONNECTION_FAIL);
+}
+
+// Function  : finishConnect
+// Arguments : Proxy * of proxy, Connection * of connection, and int of the
+//             attempt's socket
+// Does      : 1) checks the outcome of the non-blocking connect; a failure
+//                starts the next attempt right away
+//             2) the first success wins and the other attempts are dropped
+//             3) for CONNECT, answers 200 and then starts the tunnel;
+//                otherwise forwards the request
+// Returns   : nothing
+void
+finishConnect(Proxy *proxy, Connection *conn, int fd)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    unsigned i;
+
+    for (i = 0; i < conn->numAttempts && conn->attemptFds[i] != fd; i++);
+    if (i == conn->numAttempts) return;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 ||
+        error != 0)
+    {
+        unwatchFd(proxy, fd);
+        proxy->connections[fd] = NULL;
+        close(fd);
+        conn->attemptFds[i] = -1;
+        startAttempt(proxy, conn);
+        return;
+    }
+
+    // Winner: it becomes the upstream socket, the rest are abandoned
+    conn->attemptFds[i] = -1;
+    closeUpstream(proxy, conn);
+    conn->upstreamFd = fd;
+    conn->upstreamEvents = EPOLLOUT;
+    proxy->connections[fd] = conn;
+    conn->nextAttemptAt = 0;
+    conn->connectDeadline = 0;
+    armTimer(proxy, conn);
+    conn->marks[MARK_CONNECTED] = nowUs();
+    printf("[httpproxy] Connected to %s on attempt %u of %u\n", conn->target,
+           i + 1, conn->numAddresses);
+
+    if (conn->tunnel)
+    {
+        conn->source = "tunnel";
+        setInterest(proxy, conn, conn->upstreamFd, 0);
+        conn->response = strdup(TUNNEL_ESTABLISHED);
+        conn->responseSize = strlen(TUNNEL_ESTABLISHED);
+        conn->state = WRITING_RESPONSE;
+        writeResponse(proxy, conn);
+        return;
+    }
+
+    printf("[httpproxy] Querying host %s\n", conn->target);
+    conn->state = WRITING_REQUEST;
+    writeRequest(proxy, conn);
+}
+
+// Function  : closeUpstream
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : closes the origin socket and any connects still in flight
+// Returns   : nothing
+void
+closeUpstream(Proxy *proxy, Connection *conn)
+{
+    unsigned i;
+    int fd;
+
+    for (i = 0; i < conn->numAttempts; i++)
+    {
+        fd = conn->attemptFds[i];
+        if (fd < 0) continue;
+        unwatchFd(proxy, fd);
+        proxy->connections[fd] = NULL;
+        close(fd);
+        conn->attemptFds[i] = -1;
+    }
+
+    if (conn->upstreamFd >= 0)
+    {
+        unwatchFd(proxy, conn->upstreamFd);
+        proxy->connections[conn->upstreamFd] = NULL;
+        close(conn->upstreamFd);
+        conn->upstreamFd = -1;
+    }
+}
+
+// Function  : writeRequest
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : sends the HTTP request to the server, then waits for the
+//             response
+// Returns   : nothing
+void
+writeRequest(Proxy *proxy, Connection *conn)
+{
+    ssize_t write_size;
+
+    while (conn->requestSent < conn->requestSize)
+    {
+        write_size = write(conn->upstreamFd, conn->request + conn->requestSent,
+                           conn->requestSize - conn->requestSent);
+        if (write_size < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                setInterest(proxy, conn, conn->upstreamFd, EPOLLOUT);
+                return;
+            }
+            fprintf(stderr, "[httpproxy] Failed to write to %s\n",
+                    conn->target);
+            sendError(proxy, conn, "502 Bad Gateway", CONNECTION_FAIL);
+            return;
+        }
+        conn->requestSent += write_size;
+    }
+    conn->marks[MARK_REQUEST_SENT] = nowUs();
+
+    conn->state = READING_RESPONSE;
+    conn->firstByteDeadline = deadlineAfter(conn->peer ?
+                                            proxy->config->peerTimeout :
+                                            proxy->config->firstByteTimeout);
+    armTimer(proxy, conn);
+    setInterest(proxy, conn, conn->upstreamFd, EPOLLIN);
+}
+
+// Function  : readResponse
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) reads the HTTP response from the server until it closes,
+//                or to the end of the header if it has no body
+//             2) caches it (unless it answers a HEAD) and sends it to the
+//                client with an Age field; a peer's response is passed on as
+//                it is
+// Returns   : nothing
+void
+readResponse(Proxy *proxy, Connection *conn)
+{
+    ssize_t read_size, room;
+    int streamed;
+
+    for (;;)
+    {
+        room = MAX_CONTENT_SIZE - RESPONSE_SLACK - conn->responseSize;
+        if (room <= 0)
+        {
+            fprintf(stderr, "[httpproxy] Response from %s is too large\n",
+                    conn->target);
+            sendError(proxy, conn, "502 Bad Gateway",
+                      "Response too large to proxy\n");
+            return;
+        }
+
+        read_size = read(conn->upstreamFd, conn->response + conn->responseSize,
+                         room);
+        if (read_size > 0)
+        {
+            // The timer catches up lazily in handleTimeout()
+            if (conn->responseSize == 0)
+                conn->marks[MARK_FIRST_BYTE] = nowUs();
+            conn->responseSize += read_size;
+            conn->firstByteDeadline = 0;
+            if (conn->framingChecked) continue;
+            streamed = startStream(proxy, conn);
+            if (streamed > 0) return;
+            if (streamed < 0) break;
+            continue;
+        }
+        if (read_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        break;
+    }
+
+    if (read_size < 0 || conn->responseSize == 0)
+    {
+        fprintf(stderr, "[httpproxy] Failed to read from %s\n", conn->target);
+        sendError(proxy, conn, "502 Bad Gateway", CONNECTION_FAIL);
+        return;
+    }
+    printf("[httpproxy] Received response from host %s\n", conn->target);
+    conn->marks[MARK_RESPONSE_READ] = nowUs();
+    conn->source = conn->peer ? "peer" : "origin";
+
+    closeUpstream(proxy, conn);
+
+    conn->response[conn->responseSize] = 0; // putIntoCache() copies a string
+    if (conn->peer)
+    {
+        // The owner caches it and has added the Age field; one that is
+        // shedding load is treated like one that is down
+        if (responseStatus(conn->response) == 503 ||
+            responseStatus(conn->response) == 429)
+        {
+            peerFailed(proxy, conn);
+            return;
+        }
+    }
+    else
+    {
+        if (!conn->head)
+            putIntoCache(proxy->cache, conn->cacheKey, conn->request,
+                         conn->response, conn->responseSize);
+        if (conn->prewarm)
+        {
+            closeConnection(proxy, conn);
+            return;
+        }
+        conn->responseSize = addAgeField(conn->response, conn->responseSize,
+                                         0);
+    }
+    shapeResponse(conn);
+
+    conn->state = WRITING_RESPONSE;
+    armTimer(proxy, conn);
+    writeResponse(proxy, conn);
+}
+
+// Function  : writeResponse
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) writes the response to the client as far as it will go
+//             2) when done, starts the tunnel for CONNECT or closes the
+//                connection
+// Returns   : nothing
+void
+writeResponse(Proxy *proxy, Connection *conn)
+{
+    ssize_t write_size;
+
+    if (!conn->marks[MARK_WRITING])
+    {
+        conn->marks[MARK_WRITING] = nowUs();
+        conn->lastActivity = nowMs();
+    }
+    while (conn->responseSent < conn->responseSize)
+    {
+        write_size = write(conn->clientFd, conn->response + conn->responseSent,
+                           conn->responseSize - conn->responseSent);
+        if (write_size < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // The send deadline, if no timer is left from before
+                if (conn->timerIndex == NO_TIMER) armTimer(proxy, conn);
+                setInterest(proxy, conn, conn->clientFd, EPOLLOUT);
+                return;
+            }
+            fprintf(stderr, "[httpproxy] Failed writing to the connection\n");
+            closeConnection(proxy, conn);
+            return;
+        }
+        conn->responseSent += write_size;
+        conn->lastActivity = nowMs();
+    }
+    conn->marks[MARK_RESPONSE_SENT] = nowUs();
+
+    if (conn->tunnel && conn->upstreamFd >= 0)
+    {
+        startTunnel(proxy, conn);
+        return;
+    }
+
+    printf("[httpproxy] Wrote response to the connection\n");
+    printCache(proxy->cache);
+    proxy->served++;
+    closeConnection(proxy, conn);
+}
+
+// Function  : shapeResponse
+// Arguments : Connection * of connection holding a complete response
+// Does      : answers with just the header, as a 304 when the client's
+//             validators show its copy is current, or as it is for HEAD
+// Returns   : nothing
+void
+shapeResponse(Connection *conn)
+{
+    if ((conn->ifNoneMatch || conn->ifModifiedSince) &&
+        notModified(conn->ifNoneMatch, conn->ifModifiedSince, conn->response))
+    {
+        printf("[httpproxy] Client's copy of %s is current\n",
+               conn->cacheKey);
+        conn->responseSize = headerOnly(conn->response, conn->responseSize,
+                                        "304 Not Modified");
+    }
+    else if (conn->head)
+        conn->responseSize = headerOnly(conn->response, conn->responseSize,
+                                        NULL);
+}
+
+// Function  : sendError
+// Arguments : Proxy * of proxy, Connection * of connection, const char * of
+//             status line text (e.g. "502 Bad Gateway"), and const char * of
+//             body
+// Does      : drops any origin connection and answers the client with the
+//             error instead; a failed peer is replaced by the origin
+// Returns   : nothing
+void
+sendError(Proxy *proxy, Connection *conn, const char *status,
+          const char *message)
+{
+    char *response;
+    int size;
+
+    closeUpstream(proxy, conn);
+
+    if (conn->peer)
+    {
+        peerFailed(proxy, conn);
+        return;
+    }
+
+    if (conn->prewarm)
+    {
+        fprintf(stderr, "[httpproxy] Failed to prewarm %s: %s\n",
+                conn->cacheKey, status);
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    response = malloc(strlen(status) + strlen(message) + 128);
+    size = sprintf(response, "HTTP/1.1 %s\r\nContent-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n%s", status, strlen(message),
+                   message);
+
+    free(conn->response);
+    conn->response = response;
+    conn->responseSize = size;
+    conn->responseSent = 0;
+    conn->tunnel = 0;
+    conn->source = "proxy";
+    conn->state = WRITING_RESPONSE;
+    armTimer(proxy, conn);
+    writeResponse(proxy, conn);
+}
+
+// Function  : startTunnel
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) creates a pipe per direction for splice()
+//             2) queues any bytes the client sent after the CONNECT header
+//             3) arms the idle timer and starts relaying
+// Returns   : nothing
+void
+startTunnel(Proxy *proxy, Connection *conn)
+{
+    char *extra;
+    ssize_t extra_size;
+
+    if (pipe2(conn->up.pipe, O_NONBLOCK | O_CLOEXEC) < 0 ||
+        pipe2(conn->down.pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        fprintf(stderr, "[httpproxy] Failed to create tunnel pipes\n");
+        closeConnection(proxy, conn);
+        return;
+    }
+    fcntl(conn->up.pipe[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+    fcntl(conn->down.pipe[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+
+    // A client may pipeline its first bytes (e.g. a TLS ClientHello) right
+    // behind the CONNECT header
+    extra = strstr(conn->request, "\r\n\r\n") + 4;
+    extra_size = conn->requestSize - (extra - conn->request);
+    if (extra_size > 0 &&
+        write(conn->up.pipe[1], extra, extra_size) == extra_size)
+        conn->up.pending = extra_size;
+
+    printf("[httpproxy] Tunneling to %s\n", conn->target);
+    conn->state = TUNNELING;
+    conn->lastActivity = nowMs();
+    armTimer(proxy, conn);
+    pumpTunnel(proxy, conn);
+}
+
+// Function  : pumpTunnel
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) moves as many bytes as possible in both directions
+//             2) closes the tunnel once both sides have finished, or on error
+//             3) otherwise re-arms epoll for whatever each side waits on
+// Returns   : nothing
+void
+pumpTunnel(Proxy *proxy, Connection *conn)
+{
+    unsigned long long before;
+    unsigned clientEvents = 0, upstreamEvents = 0;
+
+    before = conn->up.bytes + conn->down.bytes + conn->up.pending +
+             conn->down.pending;
+    if (pumpRelay(&conn->up, conn->clientFd, conn->upstreamFd) < 0 ||
+        pumpRelay(&conn->down, conn->upstreamFd, conn->clientFd) < 0)
+    {
+        closeConnection(proxy, conn);
+        return;
+    }
+    if (conn->up.bytes + conn->down.bytes + conn->up.pending +
+        conn->down.pending != before)
+        conn->lastActivity = nowMs();
+
+    if (conn->up.shut && conn->down.shut)
+    {
+        proxy->served++;
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    // Read a side while its pipe has room, write a side while bytes wait
+    if (!conn->up.eof && conn->up.pending < RELAY_PIPE_SIZE)
+        clientEvents |= EPOLLIN;
+    if (conn->down.pending > 0) clientEvents |= EPOLLOUT;
+    if (!conn->down.eof && conn->down.pending < RELAY_PIPE_SIZE)
+        upstreamEvents |= EPOLLIN;
+    if (conn->up.pending > 0) upstreamEvents |= EPOLLOUT;
+
+    setInterest(proxy, conn, conn->clientFd, clientEvents);
+    setInterest(proxy, conn, conn->upstreamFd, upstreamEvents);
+}
+
+// Function  : pumpRelay
+// Arguments : Relay * of one tunnel direction, int of source socket, and int
+//             of destination socket
+// Does      : 1) alternately drains the pipe into the destination and refills
+//                it from the source with splice(), until neither moves
+//             2) passes end-of-stream on with a write shutdown
+// Returns   : 0, or -1 if either socket failed
+int
+pumpRelay(Relay *relay, int src, int dst)
+{
+    ssize_t moved;
+    int progress = 1;
+
+    while (progress)
+    {
+        progress = 0;
+
+        if (relay->pending > 0)
+        {
+            moved = splice(relay->pipe[0], NULL, dst, NULL, relay->pending,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0)
+            {
+                relay->pending -= moved;
+                relay->bytes += moved;
+                progress = 1;
+            }
+            else if (moved < 0 && errno != EAGAIN)
+                return -1;
+        }
+
+        if (!relay->eof && relay->pending < RELAY_PIPE_SIZE)
+        {
+            moved = splice(src, NULL, relay->pipe[1], NULL,
+                           RELAY_PIPE_SIZE - relay->pending,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0)
+            {
+                relay->pending += moved;
+                progress = 1;
+            }
+            else if (moved == 0)
+                relay->eof = 1;
+            else if (errno != EAGAIN)
+                return -1;
+        }
+    }
+
+    if (relay->eof && relay->pending == 0 && !relay->shut)
+    {
+        shutdown(dst, SHUT_WR);
+        relay->shut = 1;
+    }
+
+    return 0;
+}
+
+// Function  : closeConnection
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) logs the byte counts of a tunnel, and traces the request if
+//                it is sampled or slow
+//             2) closes every descriptor of the connection and frees it
+// Returns   : nothing
+void
+closeConnection(Proxy *proxy, Connection *conn)
+{
+    int i, *pipes[2] = { conn->up.pipe, conn->down.pipe };
+
+    if (conn->state == TUNNELING)
+    {
+        proxy->tunnelBytesUp += conn->up.bytes;
+        proxy->tunnelBytesDown += conn->down.bytes;
+        printf("[httpproxy] Closed tunnel to %s after %lld ms: %llu bytes up, "
+               "%llu bytes down (all tunnels: %llu up, %llu down)\n",
+               conn->target, nowMs() - conn->started, conn->up.bytes,
+               conn->down.bytes, proxy->tunnelBytesUp,
+               proxy->tunnelBytesDown);
+    }
+    if (proxy->traceFd >= 0 && !conn->prewarm) traceConnection(proxy, conn);
+
+    cancelTimer(proxy, conn);
+    closeUpstream(proxy, conn);
+
+    if (conn->prewarm)
+        proxy->activePrewarm--;
+    else
+    {
+        unwatchFd(proxy, conn->clientFd);
+        proxy->connections[conn->clientFd] = NULL;
+        close(conn->clientFd);
+        releaseClient(proxy, conn->client);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        if (pipes[i][0] >= 0) close(pipes[i][0]);
+        if (pipes[i][1] >= 0) close(pipes[i][1]);
+    }
+
+    free(conn->request);
+    free(conn->response);
+    free(conn->parsed);
+    free(conn->cacheKey);
+    free(conn->ifNoneMatch);
+    free(conn->ifModifiedSince);
+    deleteStream(conn->stream);
+    free(conn->addresses);
+    free(conn->attemptFds);
+    free(conn);
+
+    printf("[httpproxy] Closed connection\n");
+}
+
+// Function  : setInterest
+// Arguments : Proxy * of proxy, Connection * of connection, int of the
+//             client or upstream descriptor, and unsigned of epoll events
+// Does      : changes the events epoll reports for the descriptor, skipping
+//             the system call when nothing changes
+// Returns   : nothing
+void
+setInterest(Proxy *proxy, Connection *conn, int fd, unsigned events)
+{
+    struct epoll_event event;
+    unsigned *current;
+
+    if (fd < 0) return; // prewarm fetches have no client
+
+    current = fd == conn->clientFd ? &conn->clientEvents :
+                                     &conn->upstreamEvents;
+    if (*current == events) return;
+    *current = events;
+
+    if (proxy->uring)
+    {
+        watchUring(proxy->uring, fd, events);
+        return;
+    }
+
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(proxy->epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+// Function  : watchFd
+// Arguments : Proxy * of proxy, int of descriptor, and unsigned of epoll
+//             events
+// Does      : starts delivering the descriptor's readiness to handleEvent()
+// Returns   : nothing
+void
+watchFd(Proxy *proxy, int fd, unsigned events)
+{
+    struct epoll_event event;
+
+    if (proxy->uring)
+    {
+        watchUring(proxy->uring, fd, events);
+        return;
+    }
+
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(proxy->epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Function  : unwatchFd
+// Arguments : Proxy * of proxy and int of descriptor
+// Does      : stops delivering events for a descriptor about to be closed
+// Returns   : nothing
+void
+unwatchFd(Proxy *proxy, int fd)
+{
+    if (proxy->uring)
+        unwatchUring(proxy->uring, fd);
+    else
+        epoll_ctl(proxy->epollFd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Function  : swapTimers, siftTimerUp, siftTimerDown
+// Arguments : Proxy * of proxy and unsigned of heap positions
+// Does      : maintain the heap property, keeping each connection's
+//             timerIndex in step with its position
+// Returns   : nothing
+static void
+swapTimers(Proxy *proxy, unsigned a, unsigned b)
+{
+    Connection *swap = proxy->timers[a];
+
+    proxy->timers[a] = proxy->timers[b];
+    proxy->timers[b] = swap;
+    proxy->timers[a]->timerIndex = a;
+    proxy->timers[b]->timerIndex = b;
+}
+
+static void
+siftTimerUp(Proxy *proxy, unsigned index)
+{
+    unsigned parent;
+
+    while (index > 0)
+    {
+        parent = (index - 1) / 2;
+        if (proxy->timers[parent]->deadline <= proxy->timers[index]->deadline)
+            break;
+        swapTimers(proxy, parent, index);
+        index = parent;
+    }
+}
+
+static void
+siftTimerDown(Proxy *proxy, unsigned index)
+{
+    unsigned child;
+
+    for (;;)
+    {
+        child = 2 * index + 1;
+        if (child >= proxy->numTimers) break;
+        if (child + 1 < proxy->numTimers &&
+            proxy->timers[child + 1]->deadline < proxy->timers[child]->deadline)
+            child++;
+        if (proxy->timers[index]->deadline <= proxy->timers[child]->deadline)
+            break;
+        swapTimers(proxy, index, child);
+        index = child;
+    }
+}
+
+// Function  : scheduleTimer
+// Arguments : Proxy * of proxy, Connection * of connection, and long long of
+//             the deadline in monotonic ms
+// Does      : sets (or moves) the connection's single deadline
+// Returns   : nothing
+void
+scheduleTimer(Proxy *proxy, Connection *conn, long long deadline)
+{
+    if (conn->timerIndex == NO_TIMER)
+    {
+        if (proxy->numTimers == proxy->timersCapacity)
+        {
+            proxy->timersCapacity = proxy->timersCapacity ?
+                                    proxy->timersCapacity * 2 : 64;
+            proxy->timers = realloc(proxy->timers, proxy->timersCapacity *
+                                                   sizeof(Connection *));
+        }
+        conn->timerIndex = proxy->numTimers++;
+        proxy->timers[conn->timerIndex] = conn;
+    }
+
+    conn->deadline = deadline;
+    siftTimerUp(proxy, conn->timerIndex);
+    siftTimerDown(proxy, conn->timerIndex);
+}
+
+// Function  : cancelTimer
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : removes the connection's deadline, if it has one
+// Returns   : nothing
+void
+cancelTimer(Proxy *proxy, Connection *conn)
+{
+    unsigned index = conn->timerIndex;
+
+    if (index == NO_TIMER) return;
+
+    conn->timerIndex = NO_TIMER;
+    proxy->numTimers--;
+    if (index == proxy->numTimers) return;
+
+    proxy->timers[index] = proxy->timers[proxy->numTimers];
+    proxy->timers[index]->timerIndex = index;
+    siftTimerUp(proxy, index);
+    siftTimerDown(proxy, index);
+}
+
+// Function  : expireTimers
+// Arguments : Proxy * of proxy
+// Does      : fires every deadline that has passed
+// Returns   : nothing
+void
+expireTimers(Proxy *proxy)
+{
+    long long now = nowMs();
+    Connection *conn;
+
+    while (proxy->numTimers && proxy->timers[0]->deadline <= now)
+    {
+        conn = proxy->timers[0];
+        cancelTimer(proxy, conn);
+        handleTimeout(proxy, conn);
+    }
+}
+
+// Function  : earliest
+// Arguments : long long of two deadlines, 0 meaning none
+// Does      : picks the deadline that comes first
+// Returns   : long long of that deadline, or 0 when neither is set
+static long long
+earliest(long long a, long long b)
+{
+    if (!a) return b;
+    if (!b) return a;
+    return a < b ? a : b;
+}
+
+// Function  : armTimer
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : sets the connection's timer to the earliest of its pending
+//             deadlines for its current state, or cancels it
+// Returns   : nothing
+void
+armTimer(Proxy *proxy, Connection *conn)
+{
+    long long deadline = 0;
+
+    switch (conn->state)
+    {
+        case READING_REQUEST:
+            deadline = conn->headerDeadline;
+            break;
+        case CONNECTING:
+            deadline = earliest(conn->nextAttemptAt, conn->connectDeadline);
+            deadline = earliest(deadline, conn->totalDeadline);
+            break;
+        case WRITING_REQUEST:
+            deadline = conn->totalDeadline;
+            break;
+        case READING_RESPONSE:
+            deadline = earliest(conn->firstByteDeadline, conn->totalDeadline);
+            break;
+        case WRITING_RESPONSE:
+            if (proxy->config->sendTimeout > 0)
+                deadline = conn->lastActivity + proxy->config->sendTimeout;
+            break;
+        case STREAMING_RESPONSE:
+            deadline = conn->totalDeadline;
+            if (proxy->config->sendTimeout > 0)
+                deadline = earliest(deadline, conn->lastActivity +
+                                    proxy->config->sendTimeout);
+            break;
+        case TUNNELING:
+            deadline = conn->lastActivity +
+                       proxy->config->tunnelIdleTimeout * 1000;
+            break;
+    }
+
+    if (deadline)
+        scheduleTimer(proxy, conn, deadline);
+    else
+        cancelTimer(proxy, conn);
+}
+
+// Function  : handleTimeout
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) answers 408 when the client missed its header deadline, and
+//                closes one that has taken none of the response, written or
+//                streamed, for the send timeout
+//             2) answers 504 when the origin missed its connect, first-byte
+//                or total deadline
+//             3) starts the next Happy Eyeballs attempt when it is due
+//             4) closes a stream past its total deadline, or a tunnel that
+//                has been idle for too long
+//             5) otherwise re-arms the timer; traffic only records its time
+//                or clears a deadline, so the timer catches up here lazily
+// Returns   : nothing
+void
+handleTimeout(Proxy *proxy, Connection *conn)
+{
+    long long now = nowMs();
+    const char *phase = NULL;
+
+    if (conn->state == READING_REQUEST && conn->headerDeadline &&
+        conn->headerDeadline <= now)
+    {
+        fprintf(stderr, "[httpproxy] Timed out reading a request header\n");
+        sendError(proxy, conn, "408 Request Timeout",
+                  "Timed out waiting for the request\n");
+        return;
+    }
+    // A stream waiting on the origin isn't waiting on the client
+    if (conn->state == STREAMING_RESPONSE &&
+        conn->responseSent == conn->responseSize)
+        conn->lastActivity = now;
+    if ((conn->state == WRITING_RESPONSE ||
+         conn->state == STREAMING_RESPONSE) &&
+        proxy->config->sendTimeout > 0 &&
+        conn->lastActivity + proxy->config->sendTimeout <= now)
+    {
+        fprintf(stderr, "[httpproxy] Timed out writing to the connection\n");
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    if (conn->state == CONNECTING && conn->connectDeadline &&
+        conn->connectDeadline <= now)
+        phase = "connecting to";
+    else if (conn->state == READING_RESPONSE && conn->firstByteDeadline &&
+             conn->firstByteDeadline <= now)
+        phase = "waiting for a response from";
+    else if ((conn->state == CONNECTING || conn->state == WRITING_REQUEST ||
+              conn->state == READING_RESPONSE) && conn->totalDeadline &&
+             conn->totalDeadline <= now)
+        phase = "exchanging with";
+
+    if (phase)
+    {
+        fprintf(stderr, "[httpproxy] Timed out %s %s\n", phase, conn->target);
+        sendError(proxy, conn, GATEWAY_TIMEOUT, "Timed out waiting for the "
+                  "host\n");
+        return;
+    }
+
+    if (conn->state == CONNECTING && conn->nextAttemptAt &&
+        conn->nextAttemptAt <= now)
+    {
+        startAttempt(proxy, conn);
+        return;
+    }
+
+    // Part of the response is out, so it is too late for a 504
+    if (conn->state == STREAMING_RESPONSE && conn->totalDeadline &&
+        conn->totalDeadline <= now)
+    {
+        fprintf(stderr, "[httpproxy] Timed out streaming from %s\n",
+                conn->target);
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    if (conn->state == TUNNELING &&
+        conn->lastActivity + proxy->config->tunnelIdleTimeout * 1000 <= now)
+    {
+        printf("[httpproxy] Tunnel to %s idle for %ld s\n", conn->target,
+               proxy->config->tunnelIdleTimeout);
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    armTimer(proxy, conn);
+}
+
+// Function  : nowMs
+// Arguments : nothing
+// Does      : reads the monotonic clock
+// Returns   : long long of milliseconds
+long long
+nowMs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Function  : nowUs
+// Arguments : nothing
+// Does      : reads the monotonic clock, for timing request phases
+// Returns   : long long of microseconds
+long long
+nowUs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
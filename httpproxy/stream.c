@@ -0,0 +1,398 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Streaming responses of unknown length. A response that is chunked or ends
+// when the origin closes can't be sized up front, so rather than holding it
+// all before the client sees a byte, the proxy passes the body on as it
+// arrives: re-framed as chunks for HTTP/1.1 clients (or delimited by the close
+// for HTTP/1.0 ones), while the decoded body is also collected for the cache.
+// The entry is cached, with a Content-Length, only once the body is complete,
+// so a later request never sees part of it. Reading from the origin pauses
+// while more than STREAM_HIGH_WATER bytes wait for a slow client.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+#include "httpproxy.h"
+
+static int decodeStream(Proxy *proxy, Connection *conn, char *data,
+                        size_t size);
+static void emitBody(Connection *conn, char *data, size_t size);
+static void completeStream(Proxy *proxy, Connection *conn);
+
+// Function  : startStream
+// Arguments : Proxy * of proxy, and Connection * of connection with part of
+//             the origin's response read
+// Does      : once the header is in, and the response has no Content-Length
+//             (and the client wants the whole body, uncached):
+//             1) keeps the header without its framing fields for the cache
+//             2) queues the client's header, with chunked framing if the
+//                client speaks HTTP/1.1
+//             3) passes on the body bytes read so far
+// Returns   : int of 1 if the response is now streamed, 0 to keep reading it
+//             whole, or -1 if it is complete at the end of its header
+int
+startStream(Proxy *proxy, Connection *conn)
+{
+    static const char *framing[] = { "Transfer-Encoding", "Content-Length",
+                                     "Connection", "Keep-Alive", "Trailer",
+                                     "Proxy-Connection" };
+    Stream *stream;
+    char *end, *encoding, *line, *rest;
+    ssize_t headerSize, restSize;
+    size_t length, i;
+    int status;
+
+    conn->response[conn->responseSize] = 0;
+    end = strstr(conn->response, "\r\n\r\n");
+    if (!end) return 0;
+
+    // Interim responses (100 Continue to a client's Expect) go; the final
+    // one follows them
+    status = responseStatus(conn->response);
+    if (status >= 100 && status < 200)
+    {
+        conn->responseSize -= end + 4 - conn->response;
+        memmove(conn->response, end + 4, conn->responseSize + 1);
+        return startStream(proxy, conn);
+    }
+
+    // Responses that never have a body end with their header (RFC 9112,
+    // section 6.3), whatever their framing fields say
+    conn->framingChecked = 1;
+    if (conn->head || status == 204 || status == 304)
+    {
+        conn->responseSize = end + 4 - conn->response;
+        conn->response[conn->responseSize] = 0;
+        return -1;
+    }
+
+    // Only responses of unknown length, going to one client
+    if (conn->peer || conn->prewarm || conn->ifNoneMatch ||
+        conn->ifModifiedSince ||
+        findKnownHeader(conn->response, HEADER_CONTENT_LENGTH, &length))
+        return 0;
+
+    stream = calloc(1, sizeof(Stream));
+    encoding = findKnownHeader(conn->response, HEADER_TRANSFER_ENCODING,
+                               &length);
+    stream->chunked = encoding && length >= 7 &&
+                      strncasecmp(encoding + length - 7, "chunked", 7) == 0;
+    line = strstr(conn->request, "\r\n");
+    stream->reframe = !(line && line - conn->request >= 8 &&
+                        strncmp(line - 8, "HTTP/1.0", 8) == 0);
+    stream->status = responseStatus(conn->response);
+
+    // Keep the body read so far aside; the buffer becomes the client's queue
+    headerSize = end + 4 - conn->response;
+    restSize = conn->responseSize - headerSize;
+    rest = malloc(restSize + 1);
+    memcpy(rest, end + 4, restSize);
+
+    // The stored header: HTTP/1.1, without framing, and without the blank
+    // line, so the length can be added at the end
+    stream->header = malloc(headerSize + 1);
+    memcpy(stream->header, conn->response, headerSize);
+    stream->header[headerSize] = 0;
+    stream->headerSize = headerSize;
+    if (strncmp(stream->header, "HTTP/1.0", 8) == 0)
+        stream->header[7] = '1';
+    for (i = 0; i < sizeof(framing) / sizeof(framing[0]); i++)
+        while (removeHeader(stream->header, &stream->headerSize, framing[i]));
+    stream->headerSize -= 2;
+    stream->body = malloc(STREAM_READ_SIZE);
+    stream->bodyCapacity = STREAM_READ_SIZE;
+
+    memcpy(conn->response, stream->header, stream->headerSize);
+    conn->responseSize = stream->headerSize;
+    conn->response[conn->responseSize] = 0;
+    conn->responseSize = addAgeField(conn->response, conn->responseSize, 0);
+    conn->responseSize += sprintf(conn->response + conn->responseSize,
+                                  "%sConnection: close\r\n\r\n",
+                                  stream->reframe ?
+                                  "Transfer-Encoding: chunked\r\n" : "");
+    conn->responseSent = 0;
+
+    printf("[httpproxy] Streaming %s response from %s\n",
+           stream->chunked ? "chunked" : "close-delimited", conn->target);
+    conn->stream = stream;
+    conn->source = "origin";
+    conn->state = STREAMING_RESPONSE;
+    conn->lastActivity = nowMs();
+
+    if (decodeStream(proxy, conn, rest, restSize) < 0)
+    {
+        free(rest);
+        closeConnection(proxy, conn);
+        return 1;
+    }
+    free(rest);
+
+    armTimer(proxy, conn);
+    pumpStream(proxy, conn);
+    return 1;
+}
+
+// Function  : pumpStream
+// Arguments : Proxy * of proxy and Connection * of a streaming connection
+// Does      : 1) writes the queue to the client as far as it will go
+//             2) reads and passes on more of the body while the queue is
+//                short enough
+//             3) closes the connection once the body is complete and sent
+// Returns   : nothing
+void
+pumpStream(Proxy *proxy, Connection *conn)
+{
+    Stream *stream = conn->stream;
+    char buffer[STREAM_READ_SIZE];
+    ssize_t size;
+
+    // No MARK_WRITING: writing overlaps the body phase, which traces show
+    for (;;)
+    {
+        // The send timeout runs only while the client leaves bytes unsent
+        if (conn->responseSent == conn->responseSize)
+            conn->lastActivity = nowMs();
+        while (conn->responseSent < conn->responseSize)
+        {
+            size = write(conn->clientFd, conn->response + conn->responseSent,
+                         conn->responseSize - conn->responseSent);
+            if (size < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                fprintf(stderr, "[httpproxy] Failed writing to the "
+                        "connection\n");
+                closeConnection(proxy, conn);
+                return;
+            }
+            conn->responseSent += size;
+            conn->lastActivity = nowMs();
+        }
+        if (conn->upstreamFd < 0 ||
+            conn->responseSize - conn->responseSent > STREAM_HIGH_WATER)
+            break;
+
+        // Drop what the client has, so the queue never outgrows the buffer
+        if (conn->responseSent > 0)
+        {
+            memmove(conn->response, conn->response + conn->responseSent,
+                    conn->responseSize - conn->responseSent);
+            stream->flushed += conn->responseSent;
+            conn->responseSize -= conn->responseSent;
+            conn->responseSent = 0;
+        }
+
+        size = read(conn->upstreamFd, buffer, sizeof(buffer));
+        if (size > 0)
+        {
+            if (decodeStream(proxy, conn, buffer, size) < 0)
+            {
+                closeConnection(proxy, conn);
+                return;
+            }
+            continue;
+        }
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        // The origin closed: the end of the body, unless it was chunked
+        if (size < 0 || stream->chunked)
+        {
+            fprintf(stderr, "[httpproxy] Response from %s was cut short\n",
+                    conn->target);
+            closeConnection(proxy, conn);
+            return;
+        }
+        completeStream(proxy, conn);
+    }
+
+    if (conn->upstreamFd < 0 && conn->responseSent == conn->responseSize)
+    {
+        conn->marks[MARK_RESPONSE_SENT] = nowUs();
+        printf("[httpproxy] Wrote response to the connection\n");
+        proxy->served++;
+        closeConnection(proxy, conn);
+        return;
+    }
+
+    setInterest(proxy, conn, conn->clientFd,
+                conn->responseSent < conn->responseSize ? EPOLLOUT : 0);
+    setInterest(proxy, conn, conn->upstreamFd,
+                conn->responseSize - conn->responseSent > STREAM_HIGH_WATER ?
+                0 : EPOLLIN);
+}
+
+// Function  : deleteStream
+// Arguments : Stream * of stream, or NULL
+// Does      : frees the stream
+// Returns   : nothing
+void
+deleteStream(Stream *stream)
+{
+    if (!stream) return;
+    free(stream->header);
+    free(stream->body);
+    free(stream);
+}
+
+// Function  : decodeStream
+// Arguments : Proxy * of proxy, Connection * of connection, and char * and
+//             size_t of bytes of the body from the origin
+// Does      : takes the chunked framing off, if any, a byte at a time through
+//             the size and trailer lines, and passes on the data; the end of
+//             the last chunk completes the stream
+// Returns   : int of 0, or -1 if the framing is malformed
+static int
+decodeStream(Proxy *proxy, Connection *conn, char *data, size_t size)
+{
+    Stream *stream = conn->stream;
+    char *end;
+    size_t length;
+
+    if (!stream->chunked)
+    {
+        emitBody(conn, data, size);
+        return 0;
+    }
+
+    while (size > 0 && conn->upstreamFd >= 0)
+    {
+        if (stream->chunkState == CHUNK_DATA)
+        {
+            length = size < stream->chunkLeft ? size : stream->chunkLeft;
+            emitBody(conn, data, length);
+            data += length;
+            size -= length;
+            stream->chunkLeft -= length;
+            if (stream->chunkLeft == 0) stream->chunkState = CHUNK_DATA_END;
+            continue;
+        }
+
+        // The other states read a line
+        if (*data != '\n')
+        {
+            if (stream->lineLength < sizeof(stream->line) - 1)
+                stream->line[stream->lineLength++] = *data;
+            data++;
+            size--;
+            continue;
+        }
+        data++;
+        size--;
+        if (stream->lineLength && stream->line[stream->lineLength - 1] == '\r')
+            stream->lineLength--;
+        stream->line[stream->lineLength] = 0;
+
+        switch (stream->chunkState)
+        {
+            case CHUNK_SIZE:
+                stream->chunkLeft = strtoul(stream->line, &end, 16);
+                if (end == stream->line)
+                {
+                    fprintf(stderr, "[httpproxy] Malformed chunk from %s\n",
+                            conn->target);
+                    return -1;
+                }
+                stream->chunkState = stream->chunkLeft ? CHUNK_DATA :
+                                     CHUNK_TRAILER;
+                break;
+            case CHUNK_DATA_END:
+                stream->chunkState = CHUNK_SIZE;
+                break;
+            case CHUNK_TRAILER:
+                if (stream->lineLength == 0) completeStream(proxy, conn);
+                break;
+            default:
+                break;
+        }
+        stream->lineLength = 0;
+    }
+
+    return 0;
+}
+
+// Function  : emitBody
+// Arguments : Connection * of connection, and char * and size_t of body bytes
+// Does      : 1) queues the bytes for the client, as a chunk when re-framing
+//             2) adds them to the copy for the cache, giving the copy up once
+//                the response is too large to cache
+// Returns   : nothing
+static void
+emitBody(Connection *conn, char *data, size_t size)
+{
+    Stream *stream = conn->stream;
+
+    if (size == 0) return;
+
+    if (stream->reframe)
+        conn->responseSize += sprintf(conn->response + conn->responseSize,
+                                      "%zx\r\n", size);
+    memcpy(conn->response + conn->responseSize, data, size);
+    conn->responseSize += size;
+    if (stream->reframe)
+    {
+        memcpy(conn->response + conn->responseSize, "\r\n", 2);
+        conn->responseSize += 2;
+    }
+
+    if (!stream->body) return;
+    if (stream->headerSize + stream->bodySize + size >
+        MAX_CONTENT_SIZE - RESPONSE_SLACK)
+    {
+        printf("[httpproxy] Response from %s too large to cache\n",
+               conn->target);
+        free(stream->body);
+        stream->body = NULL;
+        return;
+    }
+    if (stream->bodySize + size > stream->bodyCapacity)
+    {
+        while (stream->bodySize + size > stream->bodyCapacity)
+            stream->bodyCapacity *= 2;
+        stream->body = realloc(stream->body, stream->bodyCapacity);
+    }
+    memcpy(stream->body + stream->bodySize, data, size);
+    stream->bodySize += size;
+}
+
+// Function  : completeStream
+// Arguments : Proxy * of proxy and Connection * of connection
+// Does      : 1) closes the origin connection and ends the client's chunks
+//             2) caches the whole response, with its Content-Length
+// Returns   : nothing
+static void
+completeStream(Proxy *proxy, Connection *conn)
+{
+    Stream *stream = conn->stream;
+    char *response;
+    ssize_t size;
+
+    conn->marks[MARK_RESPONSE_READ] = nowUs();
+    printf("[httpproxy] Received response from host %s\n", conn->target);
+    closeUpstream(proxy, conn);
+
+    if (stream->reframe)
+    {
+        memcpy(conn->response + conn->responseSize, "0\r\n\r\n", 5);
+        conn->responseSize += 5;
+    }
+
+    if (!stream->body) return;
+
+    response = malloc(stream->headerSize + stream->bodySize + 64);
+    memcpy(response, stream->header, stream->headerSize);
+    size = stream->headerSize;
+    size += sprintf(response + size, "Content-Length: %zu\r\n\r\n",
+                    stream->bodySize);
+    memcpy(response + size, stream->body, stream->bodySize);
+    size += stream->bodySize;
+    response[size] = 0;
+
+    putIntoCache(proxy->cache, conn->cacheKey, conn->request, response, size);
+    free(response);
+}
@@ -0,0 +1,190 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Per-request phase tracing. Each connection stamps the monotonic clock in
+// Connection.marks as it crosses the boundaries of TraceMark. When it closes,
+// a random config->traceSample of requests, plus every request slower than
+// config->traceThreshold, is written as one JSON line to the trace target:
+// a file, or a Unix datagram socket ("unix:<path>") for a collector. Each
+// phase is timed from the previous boundary the request actually crossed, so
+// a cache hit has no dns or connect phase. Records are dropped rather than
+// waited for when the socket is full.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "httpproxy.h"
+
+#define MAX_TRACE_RECORD 2048
+#define MAX_TRACE_URL 512
+#define MAX_TRACE_METHOD 64
+
+// Name of the phase that ends at each mark
+static const char *phaseNames[NUM_MARKS] = {
+    NULL, "queue", "read", "parse", "lookup", "dns", "connect", "send",
+    "ttfb", "body", "prepare", "write"
+};
+
+static int traceStatus(Connection *conn);
+static size_t escapeJson(char *out, size_t size, const char *in);
+
+// Function  : openTrace
+// Arguments : char * of a file path, or "unix:<path>" of a datagram socket
+// Does      : opens the file for appending, or connects a non-blocking
+//             datagram socket to the path
+// Returns   : int of the descriptor, or -1 (tracing off) on failure
+int
+openTrace(char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    srandom(time(NULL) ^ getpid());
+
+    if (strncmp(path, "unix:", 5) != 0)
+    {
+        fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            fprintf(stderr, "[httpproxy] Failed to open trace file %s\n",
+                    path);
+        return fd;
+    }
+
+    path += 5;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "[httpproxy] Trace socket path too long\n");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "[httpproxy] Failed to connect to trace socket %s\n",
+                path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Function  : traceConnection
+// Arguments : Proxy * of proxy, and Connection * of a closing connection
+// Does      : 1) skips connections that never sent a complete request
+//             2) times the request up to its last response byte (a tunnel's
+//                200), or up to now if it never got that far
+//             3) writes a record if the request is slower than the threshold
+//                or is in the sample
+// Returns   : nothing
+void
+traceConnection(Proxy *proxy, Connection *conn)
+{
+    Config *config = proxy->config;
+    char record[MAX_TRACE_RECORD], url[MAX_TRACE_URL];
+    char method[MAX_TRACE_METHOD];
+    long long start, end, previous;
+    size_t size;
+    int mark;
+
+    if (!conn->marks[MARK_REQUEST_READ]) return;
+
+    start = conn->marks[MARK_QUEUED] ? conn->marks[MARK_QUEUED] :
+            conn->marks[MARK_ACCEPTED];
+    end = conn->marks[MARK_RESPONSE_SENT] ? conn->marks[MARK_RESPONSE_SENT] :
+          nowUs();
+
+    if (end - start < config->traceThreshold * 1000 &&
+        random() >= config->traceSample * ((double)RAND_MAX + 1))
+        return;
+
+    escapeJson(url, sizeof(url), conn->cacheKey ? conn->cacheKey :
+               conn->key ? conn->key : "");
+    escapeJson(method, sizeof(method), conn->method ? conn->method : "");
+    size = snprintf(record, sizeof(record),
+                    "{\"start_us\":%lld,\"method\":\"%s\",\"url\":\"%s\","
+                    "\"status\":%d,\"bytes\":%zd,\"source\":\"%s\","
+                    "\"total_us\":%lld", start, method, url,
+                    traceStatus(conn),
+                    conn->responseSent +
+                    (conn->stream ? conn->stream->flushed : 0),
+                    conn->source ? conn->source : "none", end - start);
+
+    previous = start;
+    for (mark = MARK_ACCEPTED; mark < NUM_MARKS; mark++)
+    {
+        if (!conn->marks[mark]) continue;
+        size += snprintf(record + size, sizeof(record) - size,
+                         ",\"%s_us\":%lld", phaseNames[mark],
+                         conn->marks[mark] - previous);
+        previous = conn->marks[mark];
+    }
+    size += snprintf(record + size, sizeof(record) - size, "}\n");
+
+    if (write(proxy->traceFd, record, size) < 0)
+        fprintf(stderr, "[httpproxy] Dropped a trace record\n");
+}
+
+// Function  : traceStatus
+// Arguments : Connection * of connection
+// Does      : reads the status code of the response the client got, looking
+//             no further than the response buffer, which a stream has reused
+// Returns   : int of the status code, or 0 if nothing was sent
+static int
+traceStatus(Connection *conn)
+{
+    int status = 0;
+    ssize_t i;
+
+    if (conn->stream) return conn->stream->status;
+    if (conn->responseSent < 12 || memcmp(conn->response, "HTTP/", 5) != 0)
+        return 0;
+
+    for (i = 9; i < 12; i++)
+    {
+        if (conn->response[i] < '0' || conn->response[i] > '9') return 0;
+        status = status * 10 + conn->response[i] - '0';
+    }
+
+    return status;
+}
+
+// Function  : escapeJson
+// Arguments : char * and size_t of the output buffer, and const char * of
+//             the string to escape
+// Does      : copies the string as the inside of a JSON string literal,
+//             truncating it to fit
+// Returns   : size_t of the escaped length
+static size_t
+escapeJson(char *out, size_t size, const char *in)
+{
+    size_t length = 0;
+
+    for (; *in && length + 7 < size; in++)
+    {
+        if (*in == '"' || *in == '\\')
+        {
+            out[length++] = '\\';
+            out[length++] = *in;
+        }
+        else if ((unsigned char)*in < 0x20)
+            length += sprintf(out + length, "\\u%04x", (unsigned char)*in);
+        else
+            out[length++] = *in;
+    }
+    out[length] = 0;
+
+    return length;
+}
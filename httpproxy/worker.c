@@ -0,0 +1,378 @@
+// Date   : October 19, 2026
+// Author : Eric Park
+//
+// Worker processes placed on CPUs and NUMA nodes. With --workers N the proxy
+// forks N workers, each with its own listener in one SO_REUSEPORT group, its
+// own event loop and its own cache. Worker i is pinned to the i-th CPU of
+// --cpus (by default, of the CPUs the proxy may run on) and, before it
+// allocates anything, prefers memory on that CPU's NUMA node, so its cache
+// and connection buffers sit next to the core that uses them. A classic BPF
+// program on the group hands each connection to the worker pinned to the CPU
+// that received it; with the NIC's queue interrupts spread over the same CPUs,
+// a request stays on one core and one node from the wire to the cache. The
+// parent holds on to every listener and restarts workers that exit. Since each cache is private, the worker
+// that serves an admin request (purge, prewarm) passes its target on to the
+// others over a datagram socketpair per worker, created before the fork.
+
+#define _GNU_SOURCE // sched_setaffinity(), CPU_SET()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+
+#include "httpproxy.h"
+
+#define MAX_NUMA_NODES 1024
+
+static int becomeWorker(Config *config, int *listeners, int (*admin)[2],
+                        unsigned index);
+static void steerConnections(Config *config, int fd);
+static void placeWorker(unsigned index, int cpu);
+static int cpuNode(int cpu);
+
+// Function  : loadCpus
+// Arguments : Config * of configuration, and char * of a CPU list such as
+//             "0-3,8,10-11"
+// Does      : appends the CPUs, in order, to config->cpus
+// Returns   : 0 on success, -1 if the list is malformed
+int
+loadCpus(Config *config, char *list)
+{
+    char *rest;
+    long first, last;
+
+    while (*list)
+    {
+        first = strtol(list, &rest, 10);
+        if (rest == list || first < 0 || first >= CPU_SETSIZE) return -1;
+        last = first;
+        if (*rest == '-')
+        {
+            list = rest + 1;
+            last = strtol(list, &rest, 10);
+            if (rest == list || last < first || last >= CPU_SETSIZE)
+                return -1;
+        }
+        if (*rest && *rest != ',') return -1;
+        list = *rest ? rest + 1 : rest;
+
+        config->cpus = realloc(config->cpus,
+                               (config->numCpus + last - first + 1) *
+                               sizeof(int));
+        for (; first <= last; first++)
+            config->cpus[config->numCpus++] = (int)first;
+    }
+
+    return config->numCpus > 0 ? 0 : -1;
+}
+
+// Function  : startWorkers
+// Arguments : Config * of configuration
+// Does      : 1) with one worker, just pins the process if --cpus was given
+//             2) otherwise opens a listener per worker in one SO_REUSEPORT
+//                group, steers connections to them by receiving CPU, and
+//                forks the workers
+//             3) the parent keeps every listener open and forks a new
+//                worker on the same one whenever a worker exits, so no
+//                socket ever leaves the group
+// Returns   : int of the worker's listening socket, or -1 when there is a
+//             single worker, which opens its own
+int
+startWorkers(Config *config)
+{
+    cpu_set_t allowed;
+    int *listeners, (*admin)[2], status;
+    unsigned i;
+    int cpu;
+    pid_t *pids, pid;
+    time_t *started;
+
+    if (config->workers <= 1)
+    {
+        if (config->numCpus > 0) placeWorker(0, config->cpus[0]);
+        return -1;
+    }
+
+    // By default, one CPU per worker out of those the proxy may use
+    if (config->numCpus == 0 &&
+        sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            config->cpus = realloc(config->cpus,
+                                   (config->numCpus + 1) * sizeof(int));
+            config->cpus[config->numCpus++] = cpu;
+        }
+    }
+
+    // The group's sockets are numbered in the order they listen; the
+    // program attaches to the group, so the first socket carries it for all
+    listeners = malloc(config->workers * sizeof(int));
+    for (i = 0; i < config->workers; i++)
+    {
+        listeners[i] = openListener(config->port, config->backlog, 1);
+        if (config->numCpus == 0) continue;
+        cpu = config->cpus[i % config->numCpus];
+        setsockopt(listeners[i], SOL_SOCKET, SO_INCOMING_CPU, &cpu,
+                   sizeof(cpu));
+        if (i == 0) steerConnections(config, listeners[i]);
+    }
+
+    // Worker i reads admin requests from admin[i][0]; the others write them
+    // to admin[i][1]
+    admin = malloc(config->workers * sizeof(*admin));
+    for (i = 0; i < config->workers; i++)
+    {
+        if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0,
+                       admin[i]) < 0)
+        {
+            fprintf(stderr, "[httpproxy] Failed to create admin socket for "
+                    "worker %u\n", i);
+            admin[i][0] = admin[i][1] = -1;
+        }
+    }
+
+    pids = malloc(config->workers * sizeof(pid_t));
+    started = malloc(config->workers * sizeof(time_t));
+    for (i = 0; i < config->workers; i++)
+    {
+        started[i] = time(NULL);
+        pids[i] = fork();
+        if (pids[i] == 0) return becomeWorker(config, listeners, admin, i);
+        if (pids[i] < 0)
+            fprintf(stderr, "[httpproxy] Failed to fork worker %u\n", i);
+    }
+
+    // Closing a listener would renumber the group under the steering
+    // program, so a worker that exits is replaced on the same socket, which
+    // also keeps the connections waiting in its queue
+    for (;;)
+    {
+        pid = wait(&status);
+        if (pid < 0 && errno == EINTR) continue;
+        if (pid < 0) break;
+        for (i = 0; i < config->workers && pids[i] != pid; i++);
+        if (i == config->workers) continue;
+
+        fprintf(stderr, "[httpproxy] Worker %u exited with status %d, "
+                "restarting it\n", i, status);
+        if (time(NULL) - started[i] < 1) sleep(1); // don't spin on a crash
+        started[i] = time(NULL);
+        pids[i] = fork();
+        if (pids[i] == 0) return becomeWorker(config, listeners, admin, i);
+        if (pids[i] < 0)
+            fprintf(stderr, "[httpproxy] Failed to fork worker %u\n", i);
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+// Function  : becomeWorker
+// Arguments : Config * of configuration, int * of the group's listeners,
+//             int (*)[2] of the admin socketpairs, and unsigned of the
+//             worker's index
+// Does      : in a just forked worker:
+//             1) arranges to go when the parent does
+//             2) keeps only its own listener, the reading end of its own
+//                admin socketpair and the writing ends of the others'
+//             3) takes its 1/N share of the cache budget
+//             4) places itself on its CPU and node
+// Returns   : int of the worker's listening socket
+static int
+becomeWorker(Config *config, int *listeners, int (*admin)[2], unsigned index)
+{
+    unsigned i;
+    int fd = listeners[index];
+
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    config->adminFd = admin[index][0];
+    config->workerFds = malloc(config->workers * sizeof(int));
+    for (i = 0; i < config->workers; i++)
+    {
+        if (i != index) close(listeners[i]);
+        if (i != index && admin[i][0] >= 0) close(admin[i][0]);
+        config->workerFds[i] = i != index ? admin[i][1] : -1;
+    }
+    if (admin[index][1] >= 0) close(admin[index][1]);
+
+    // The cache budget is the whole proxy's; each worker gets its share
+    config->cacheBlocks /= config->workers;
+    if (config->cacheBlocks == 0) config->cacheBlocks = 1;
+    config->cacheBytes /= config->workers;
+    if (config->cacheBytes < MIN_CACHE_BYTES)
+        config->cacheBytes = MIN_CACHE_BYTES;
+
+    if (config->numCpus > 0)
+        placeWorker(index, config->cpus[index % config->numCpus]);
+
+    return fd;
+}
+
+// Function  : forwardAdmin
+// Arguments : Proxy * of proxy, and char * of the request target of an admin
+//             request this worker has carried out
+// Does      : sends the target to every other worker, to carry out on its
+//             own cache
+// Returns   : nothing
+void
+forwardAdmin(Proxy *proxy, char *target)
+{
+    Config *config = proxy->config;
+    size_t length = strlen(target);
+    unsigned i;
+
+    if (!config->workerFds) return;
+
+    for (i = 0; i < config->workers; i++)
+    {
+        if (config->workerFds[i] < 0) continue;
+        if (send(config->workerFds[i], target, length, 0) < 0)
+            fprintf(stderr, "[httpproxy] Failed to pass %s on to worker "
+                    "%u\n", target, i);
+    }
+}
+
+// Function  : receiveAdmin
+// Arguments : Proxy * of proxy
+// Does      : carries out every admin request target the other workers have
+//             sent: purges, manifest reloads and single prewarms
+// Returns   : nothing
+void
+receiveAdmin(Proxy *proxy)
+{
+    char target[MAX_REQUEST_SIZE + 1];
+    char *query;
+    ssize_t length;
+
+    while ((length = recv(proxy->config->adminFd, target, MAX_REQUEST_SIZE,
+                          0)) > 0)
+    {
+        target[length] = 0;
+        query = strchr(target, '?');
+
+        if (strncmp(target, PURGE_PATH, strlen(PURGE_PATH)) == 0 && query)
+            purgeTarget(proxy, query + 1);
+        else if (strncmp(target, PREWARM_PATH, strlen(PREWARM_PATH)) == 0)
+        {
+            if (query)
+                queuePrewarm(proxy, query + 1);
+            else if (proxy->config->prewarmFile)
+                loadManifest(proxy, proxy->config->prewarmFile);
+        }
+    }
+}
+
+// Function  : steerConnections
+// Arguments : Config * of configuration, and int of a socket in the group
+// Does      : attaches a classic BPF program to the SO_REUSEPORT group that
+//             picks the listener of the worker pinned to the CPU handling the
+//             connection; connections arriving on other CPUs are spread by
+//             the kernel's usual hash. The program returns positions in the
+//             group, which the kernel renumbers when a socket closes, so the
+//             listeners must stay open as long as the group does
+// Returns   : nothing
+static void
+steerConnections(Config *config, int fd)
+{
+    struct sock_filter *code;
+    struct sock_fprog program;
+    unsigned i, length = 0;
+
+    // ld cpu; then per worker: jeq #cpu, ret #worker; finally ret #-1
+    code = malloc((2 * config->workers + 2) * sizeof(struct sock_filter));
+    code[length++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (i = 0; i < config->workers; i++)
+    {
+        code[length++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                     config->cpus[i % config->numCpus], 0, 1);
+        code[length++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    code[length++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ~0u);
+
+    program.len = length;
+    program.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                   sizeof(program)) < 0)
+        fprintf(stderr, "[httpproxy] Failed to steer connections by CPU, "
+                "hashing them instead\n");
+    free(code);
+}
+
+// Function  : placeWorker
+// Arguments : unsigned of worker index, and int of its CPU
+// Does      : 1) pins the process to the CPU
+//             2) makes the CPU's NUMA node the preferred node for its memory,
+//                so the cache it is about to create is node-local
+// Returns   : nothing
+static void
+placeWorker(unsigned index, int cpu)
+{
+    unsigned long nodes[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    cpu_set_t set;
+    int node;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        fprintf(stderr, "[httpproxy] Failed to pin worker %u to CPU %d\n",
+                index, cpu);
+
+    node = cpuNode(cpu);
+    if (node >= 0 && node < MAX_NUMA_NODES)
+    {
+        memset(nodes, 0, sizeof(nodes));
+        nodes[node / (8 * sizeof(unsigned long))] |=
+            1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes,
+                    MAX_NUMA_NODES + 1) < 0)
+            fprintf(stderr, "[httpproxy] Failed to prefer NUMA node %d\n",
+                    node);
+    }
+
+    printf("[httpproxy] Worker %u on CPU %d, NUMA node %d\n", index, cpu,
+           node);
+}
+
+// Function  : cpuNode
+// Arguments : int of CPU
+// Does      : finds the node<N> link in the CPU's sysfs directory
+// Returns   : int of the CPU's NUMA node, or -1 if unknown
+static int
+cpuNode(int cpu)
+{
+    char path[64];
+    DIR *dir;
+    struct dirent *entry;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (!dir) return -1;
+
+    while ((entry = readdir(dir)) && node < 0)
+    {
+        if (strncmp(entry->d_name, "node", 4) == 0 &&
+            entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+            node = atoi(entry->d_name + 4);
+    }
+    closedir(dir);
+
+    return node;
+}